@@ -20,6 +20,7 @@
 #define CDBSCAN_H
 
 #include <stddef.h>
+#include <stdint.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -64,8 +65,98 @@ typedef struct cdbscan_params {
 	cdbscan_dist_func_t custom_dist; /* Custom distance function */
 	void *custom_dist_params; /* Parameters for custom distance */
 	int use_kdtree; /* Use KD-tree for O(n log n) performance (1=yes, 0=no) */
+	int num_threads; /* Threads when called without a context (0=serial) */
+	int curve_order; /* Sort points along a space-filling curve first
+			    (0=auto: low dimensions, 1=always, -1=never) */
 } cdbscan_params_t;
 
+/* Execution context
+ * Owns a pool of worker threads and scratch memory that are created once
+ * and reused by every call made with the context. A context may be shared
+ * by concurrent calls: the workers serve one call at a time and a call
+ * that finds them busy runs on its own thread. All functions are
+ * re-entrant; calls without a context reuse scratch memory private to
+ * the calling thread, keeping only arrays of up to 1MB between calls.
+ */
+typedef struct cdbscan_context cdbscan_context_t;
+
+/* num_threads: total threads including the caller, 0 = online CPUs */
+cdbscan_context_t *cdbscan_context_create(int num_threads);
+void cdbscan_context_destroy(cdbscan_context_t *ctx);
+int cdbscan_context_num_threads(const cdbscan_context_t *ctx);
+
+/* NUMA placement flags for cdbscan_context_set_numa() */
+typedef enum {
+	CDBSCAN_NUMA_PIN = 1, /* Pin workers to CPUs spread over all nodes */
+	CDBSCAN_NUMA_FIRST_TOUCH = 2, /* Workers initialize the data they use */
+	CDBSCAN_NUMA_REPLICATE = 4 /* One copy of the search index per node */
+} cdbscan_numa_flags_t;
+
+/* Enable NUMA placement for later calls; 0 turns it off and unpins the
+ * workers. Any flag implies CDBSCAN_NUMA_PIN, which is only supported on
+ * Linux. The calling thread is never pinned.
+ * Returns 0 on success, -1 on error. */
+int cdbscan_context_set_numa(cdbscan_context_t *ctx, int flags);
+int cdbscan_context_num_nodes(const cdbscan_context_t *ctx);
+
+/* Memory for a context's working arrays. alloc and free are required,
+ * aligned_alloc is optional and used for cache-line aligned arrays if
+ * given. free gets the size the memory was allocated with. */
+typedef struct {
+	void *(*alloc)(size_t size, void *user);
+	void *(*aligned_alloc)(size_t alignment, size_t size, void *user);
+	void (*free)(void *ptr, size_t size, void *user);
+	void *user;
+} cdbscan_allocator_t;
+
+/* Take the working memory of later cdbscan_cluster_ctx(),
+ * cdbscan_cluster_dataset(), cdbscan_cluster_batch() and
+ * cdbscan_cluster_pq() calls with ctx from allocator, NULL for malloc.
+ * Other calls, and calls that find the context busy and run on their
+ * own thread, still use malloc. Returns 0 on success, -1 on error. */
+int cdbscan_context_set_allocator(cdbscan_context_t *ctx,
+				  const cdbscan_allocator_t *allocator);
+
+/* With enable set, working arrays of 2MB and more (coordinate copies,
+ * search index, labels, neighbor bit matrix) are mapped in 2MB pages
+ * straight from the kernel, from the reserved huge page pool if any and
+ * else as transparent huge pages, bypassing the allocator. Fewer TLB
+ * misses speed up queries over very large inputs.
+ * Returns 0 on success, -1 on error. */
+int cdbscan_context_set_huge_pages(cdbscan_context_t *ctx, int enable);
+
+/* Limit the working memory of each later cdbscan_cluster_ctx(),
+ * cdbscan_cluster_dataset(), cdbscan_cluster_batch() and
+ * cdbscan_cluster_pq() call with ctx to limit bytes, 0 for no limit;
+ * other calls are not bounded. A call that would go over gives up its
+ * speedups until it fits: per-node copies, the neighbor bit matrix, cost
+ * estimates, the curve-ordered copy, the density sketch and last the
+ * KD-tree, after which queries are brute force. Labels do not change. A
+ * call that does not fit even then fails with -1 before allocating.
+ * Memory the context keeps from earlier calls is freed as needed to stay
+ * under the limit; a batch divides the limit among the datasets it runs
+ * side by side. Without a limit the bit matrix is only built up to 64MB;
+ * with one, it is built whenever the call fits.
+ * Returns 0 on success, -1 on error. */
+int cdbscan_context_set_memory_limit(cdbscan_context_t *ctx, size_t limit);
+
+/* Per-thread scheduler statistics, cumulative since creation or reset */
+typedef struct {
+	double busy_seconds; /* Time spent running tasks */
+	double wall_seconds; /* Time the context spent in parallel jobs */
+	unsigned long long tasks; /* Tasks run by this thread */
+	unsigned long long steals; /* Tasks taken from other threads */
+	unsigned long long items; /* Loop iterations in those tasks */
+	int node; /* NUMA node the thread runs on, for per-node totals */
+} cdbscan_thread_stats_t;
+
+/* Fills up to max_threads entries, returns the number filled.
+ * Utilization of thread i is busy_seconds / wall_seconds. */
+int cdbscan_context_thread_stats(const cdbscan_context_t *ctx,
+				 cdbscan_thread_stats_t *stats,
+				 int max_threads);
+void cdbscan_context_reset_stats(cdbscan_context_t *ctx);
+
 /* Main DBSCAN clustering function
  * Returns: number of clusters found (excluding noise)
  * Sets cluster_id field in each point:
@@ -75,6 +166,263 @@ typedef struct cdbscan_params {
 int cdbscan_cluster(cdbscan_point_t *points, int num_points,
 		    cdbscan_params_t params);
 
+/* Same as cdbscan_cluster() using the context's threads.
+ * With ctx == NULL, params.num_threads > 1 starts threads for this call.
+ */
+int cdbscan_cluster_ctx(cdbscan_context_t *ctx, cdbscan_point_t *points,
+			int num_points, cdbscan_params_t params);
+
+/* Dataset in one row-major array: point i is
+ * coords[i * dimensions] .. coords[i * dimensions + dimensions - 1] */
+typedef struct {
+	const double *coords;
+	int num_points;
+	int dimensions;
+} cdbscan_dataset_t;
+
+/* Cluster a row-major dataset without copying it. Writes num_points
+ * cluster ids (or CDBSCAN_NOISE) to labels.
+ * Returns: number of clusters found, -1 on error */
+int cdbscan_cluster_dataset(cdbscan_context_t *ctx,
+			    const cdbscan_dataset_t *data,
+			    cdbscan_params_t params, int *labels);
+
+/* Peak bytes of working memory cdbscan_cluster_dataset() takes on ctx
+ * (NULL for a call without a context) for num_points points of dims
+ * dimensions; params choose the search index. Under the context's memory
+ * limit, this is what the call falls back to, and more than the limit if
+ * it would fail. cdbscan_cluster() and cdbscan_cluster_ctx() also pack
+ * the points, num_points * (dims * sizeof(double) + sizeof(int)) bytes.
+ * Returns: the size, 0 if the arguments are invalid */
+size_t cdbscan_memory_estimate(const cdbscan_context_t *ctx, int num_points,
+			       int dims, cdbscan_params_t params);
+
+/* Bytes of workspace cdbscan_cluster_workspace() needs for num_points
+ * points of dims dimensions, which depends on nothing else.
+ * Returns: the size, 0 if the arguments are invalid */
+size_t cdbscan_workspace_size(int num_points, int dims,
+			      cdbscan_params_t params);
+
+/* Same as cdbscan_cluster_dataset() without allocating: all working
+ * memory comes from the caller's workspace of workspace_size bytes, at
+ * least cdbscan_workspace_size(). Runs serially on the calling thread
+ * and ignores params.num_threads. Each point is queried at most twice,
+ * so the worst case, every point within eps of every other, takes
+ * O(n^2 * dims) time. The KD-tree build is O(n log n) on typical data
+ * and O(n^2) at worst.
+ * Returns: number of clusters found, -1 on error or a short workspace */
+int cdbscan_cluster_workspace(const cdbscan_dataset_t *data,
+			      cdbscan_params_t params, void *workspace,
+			      size_t workspace_size, int *labels);
+
+/* Dataset of integer coordinates, row-major like cdbscan_dataset_t */
+typedef struct {
+	const int32_t *coords;
+	int num_points;
+	int dimensions;
+} cdbscan_int_dataset_t;
+
+/* Cluster points on an integer lattice (pixels, voxels, grid cells).
+ * eps is in lattice units and dist_type must be Euclidean, Manhattan or
+ * Minkowski. The offsets within eps are enumerated once and neighbors
+ * are found by cell lookup, without distance computations; points may
+ * share a cell. Labels match cdbscan_cluster_dataset() on the same
+ * coordinates. Fails if eps spans more than 2^20 candidate offsets.
+ * Returns: number of clusters found, -1 on error */
+int cdbscan_cluster_lattice(cdbscan_context_t *ctx,
+			    const cdbscan_int_dataset_t *data,
+			    cdbscan_params_t params, int *labels);
+
+/* Same for a dense row-major raster of shape[0] x ... x shape[dims - 1]
+ * cells, whose nonzero cells are the points. labels has one entry per
+ * cell; empty cells are set to CDBSCAN_UNCLASSIFIED. */
+int cdbscan_cluster_raster(cdbscan_context_t *ctx,
+			   const unsigned char *occupied, const int *shape,
+			   int dims, cdbscan_params_t params, int *labels);
+
+/* Cluster integer coordinates with exact integer arithmetic. Euclidean
+ * and Manhattan distances are computed in 64-bit integers and compared
+ * with eps exactly, so points at the eps boundary are never decided by
+ * rounding; the KD-tree keeps integer bounds. Other metrics cluster a
+ * double copy of the coordinates. Fails if eps >= 2^31.
+ * Returns: number of clusters found, -1 on error */
+int cdbscan_cluster_int_dataset(cdbscan_context_t *ctx,
+				const cdbscan_int_dataset_t *data,
+				cdbscan_params_t params, int *labels);
+
+/* Options for cdbscan_cluster_quantized() */
+typedef struct {
+	int bits; /* 8 or 16 bits per coordinate */
+	unsigned long long verified; /* Set by the call: pairs checked
+					against the original coordinates */
+} cdbscan_quant_opts_t;
+
+/* Cluster with coordinates quantized to opts->bits per dimension over
+ * the range of each dimension; the KD-tree and distance kernels use the
+ * quantized values, 4-8x smaller than doubles. Pairs within the
+ * quantization error of eps are checked against data->coords, which may
+ * be memory-mapped from disk as only those pairs touch it. Labels are
+ * the same as cdbscan_cluster_dataset(). Euclidean, Manhattan and
+ * Minkowski with p >= 1 are quantized; other metrics cluster the
+ * original coordinates.
+ * Returns: number of clusters found, -1 on error */
+int cdbscan_cluster_quantized(cdbscan_context_t *ctx,
+			      const cdbscan_dataset_t *data,
+			      cdbscan_quant_opts_t *opts,
+			      cdbscan_params_t params, int *labels);
+
+/* Product-quantized dataset for approximate clustering of embeddings.
+ * Each vector is stored as one byte per group of dimensions (the index of
+ * the nearest of 256 trained centroids), and points are partitioned into
+ * coarse lists that region queries skip when out of reach. Only the
+ * codes are kept; the dataset passed to cdbscan_pq_build() is not
+ * referenced afterwards. Euclidean distance only. Zeroed fields use
+ * defaults. */
+typedef struct cdbscan_pq cdbscan_pq_t;
+
+typedef struct {
+	int num_subspaces; /* Bytes per point (default dimensions / 4) */
+	int num_lists; /* Coarse lists (default sqrt(num_points), max 1024) */
+	int train_points; /* k-means sample size (default 10240) */
+	unsigned long long seed; /* Seed for the training sample */
+} cdbscan_pq_opts_t;
+
+cdbscan_pq_t *cdbscan_pq_build(cdbscan_context_t *ctx,
+			       const cdbscan_dataset_t *data,
+			       const cdbscan_pq_opts_t *opts);
+void cdbscan_pq_free(cdbscan_pq_t *pq);
+
+/* Approximate clustering on the codes. With exact vectors (same points
+ * as the codes), pairs whose approximate distance is within
+ * eps * (1 +- rerank) are decided on the exact vectors, and queries use
+ * the exact query vector; with exact == NULL only codes are used.
+ * Returns: number of clusters found, -1 on error */
+int cdbscan_cluster_pq(cdbscan_context_t *ctx, const cdbscan_pq_t *pq,
+		       const cdbscan_dataset_t *exact, double rerank,
+		       cdbscan_params_t params, int *labels);
+
+/* Quality of the approximate region queries of cdbscan_cluster_pq() */
+typedef struct {
+	double recall; /* Exact eps-neighbors that were found */
+	double precision; /* Neighbors found that are exact eps-neighbors */
+	int num_queries;
+} cdbscan_pq_quality_t;
+
+/* Measure recall and precision on num_queries random points against a
+ * brute-force search of the exact vectors. Returns 0, -1 on error. */
+int cdbscan_pq_measure(cdbscan_context_t *ctx, const cdbscan_pq_t *pq,
+		       const cdbscan_dataset_t *exact, double rerank,
+		       cdbscan_params_t params, int num_queries,
+		       unsigned long long seed, cdbscan_pq_quality_t *quality);
+
+/* One dataset of a batch */
+typedef struct {
+	cdbscan_dataset_t data;
+	int *labels; /* Caller buffer of data.num_points entries */
+	int num_clusters; /* Set by the call: clusters found, -1 on error */
+} cdbscan_batch_item_t;
+
+/* Cluster many independent datasets with the same parameters. Datasets
+ * of 50000 points and more are clustered first, one at a time on all of
+ * the context's threads. The smaller ones are then spread over the
+ * threads, largest first, each clustered by a single thread with memory
+ * reused from dataset to dataset.
+ * Returns: 0 if every dataset was clustered, -1 otherwise */
+int cdbscan_cluster_batch(cdbscan_context_t *ctx, cdbscan_batch_item_t *items,
+			  int num_items, cdbscan_params_t params);
+
+/* Frame-to-frame clustering of points that move a little between frames.
+ * Point i of a frame must be point i of the previous frame; a frame with
+ * a different number of points starts over. Only neighborhoods a moved
+ * point entered or left are checked again. Clusters that persist keep
+ * their ids and new clusters get ids never used before, so ids are not
+ * contiguous. Border points shared by two clusters may go to either.
+ * With Euclidean distance a KD-tree is kept and refitted between frames;
+ * other metrics recluster every frame. */
+typedef struct cdbscan_tracker cdbscan_tracker_t;
+
+cdbscan_tracker_t *cdbscan_tracker_create(cdbscan_params_t params);
+void cdbscan_tracker_destroy(cdbscan_tracker_t *tracker);
+
+/* Cluster the next frame into labels (num_points entries).
+ * Returns: number of clusters, -1 on error */
+int cdbscan_tracker_update(cdbscan_tracker_t *tracker, cdbscan_context_t *ctx,
+			   const cdbscan_dataset_t *frame, int *labels);
+
+/* Points whose neighborhood the last update checked again */
+int cdbscan_tracker_verified(const cdbscan_tracker_t *tracker);
+
+/* Options for cdbscan_load_csv(); zeroed fields use defaults */
+typedef struct {
+	char delimiter; /* Field separator, 0 for ',' */
+	int header; /* 1: first line names the columns, -1: it is data,
+		     * 0: it names them unless every field is a number */
+	const int *columns; /* Zero-based fields to load, in this order */
+	const char *const *column_names; /* Or their names, if no columns */
+	int num_columns; /* Entries in either, 0 loads every field */
+	int error_line; /* Set by the call: line of a bad field, 0 if none */
+} cdbscan_csv_options_t;
+
+/* Load a CSV file of numbers into a row-major dataset, one point per
+ * line that is not blank. The file is memory-mapped and parsed on ctx's
+ * threads straight into data->coords. Fields may be padded with blanks
+ * and wrapped in double quotes; every loaded field must be a finite
+ * number. opts may be NULL. Free the dataset with cdbscan_free_dataset().
+ * Returns: 0 on success, -1 on error */
+int cdbscan_load_csv(cdbscan_context_t *ctx, const char *path,
+		     cdbscan_csv_options_t *opts, cdbscan_dataset_t *data);
+void cdbscan_free_dataset(cdbscan_dataset_t *data);
+
+/* Binary dataset files: a versioned header, the points as rows of
+ * doubles or int32 values, and optional per-point labels and weights,
+ * each section 64-byte aligned. Files are read in the byte order they
+ * were written in. */
+#define CDBSCAN_FILE_VERSION 1
+
+typedef enum {
+	CDBSCAN_FILE_DOUBLE = 0,
+	CDBSCAN_FILE_INT32 = 1
+} cdbscan_file_dtype_t;
+
+/* Flags for cdbscan_file_writer_create() */
+#define CDBSCAN_FILE_LABELS 1 /* An int32_t label per point */
+#define CDBSCAN_FILE_WEIGHTS 2 /* A double weight per point */
+#define CDBSCAN_FILE_APPEND 4 /* Add to the points of an existing file */
+
+typedef struct cdbscan_file cdbscan_file_t;
+
+/* Map a dataset file; nothing is read beyond the header. The file must
+ * not change while open. Returns NULL if it is not a complete file of a
+ * supported version. */
+cdbscan_file_t *cdbscan_file_open(const char *path);
+void cdbscan_file_close(cdbscan_file_t *file);
+
+/* Point data at the mapped rows, valid until the file is closed.
+ * Returns: 0 on success, -1 if the file holds the other type */
+int cdbscan_file_dataset(const cdbscan_file_t *file, cdbscan_dataset_t *data);
+int cdbscan_file_int_dataset(const cdbscan_file_t *file,
+			     cdbscan_int_dataset_t *data);
+
+/* Mapped labels and weights, NULL if the file has none */
+const int32_t *cdbscan_file_labels(const cdbscan_file_t *file);
+const double *cdbscan_file_weights(const cdbscan_file_t *file);
+
+/* Stream points into a dataset file. Labels and weights are passed to
+ * every append if the writer was created with their flags. Points go to
+ * "<path>.tmp", which replaces the file only once the writer is closed
+ * without error; until then an existing file stays as it was. Appending
+ * copies the existing points into the new file first.
+ * Returns: 0 on success, -1 on error */
+typedef struct cdbscan_file_writer cdbscan_file_writer_t;
+
+cdbscan_file_writer_t *cdbscan_file_writer_create(const char *path, int dims,
+						  cdbscan_file_dtype_t dtype,
+						  int flags);
+int cdbscan_file_writer_append(cdbscan_file_writer_t *writer,
+			       const void *coords, const int32_t *labels,
+			       const double *weights, int count);
+int cdbscan_file_writer_close(cdbscan_file_writer_t *writer);
+
 /* Distance functions */
 double cdbscan_euclidean_distance(const double *a, const double *b, int dims);
 double cdbscan_manhattan_distance(const double *a, const double *b, int dims);
@@ -85,6 +433,10 @@ double cdbscan_cosine_distance(const double *a, const double *b, int dims);
 /* Data normalization functions */
 void cdbscan_normalize_minmax(cdbscan_point_t *points, int num_points);
 void cdbscan_normalize_zscore(cdbscan_point_t *points, int num_points);
+void cdbscan_normalize_minmax_ctx(cdbscan_context_t *ctx,
+				  cdbscan_point_t *points, int num_points);
+void cdbscan_normalize_zscore_ctx(cdbscan_context_t *ctx,
+				  cdbscan_point_t *points, int num_points);
 
 /* Parameter estimation utilities */
 typedef struct {
@@ -97,8 +449,65 @@ cdbscan_kdist_result_t *cdbscan_estimate_eps(const cdbscan_point_t *points,
 					     int num_points,
 					     int k /* typically 4 for 2D data */
 );
+cdbscan_kdist_result_t *cdbscan_estimate_eps_ctx(cdbscan_context_t *ctx,
+						 const cdbscan_point_t *points,
+						 int num_points, int k);
 void cdbscan_free_kdist_result(cdbscan_kdist_result_t *result);
 
+/* k-distance curves for k = 1..max_k from a single kNN sweep.
+ * Curve k is stored ascending at distances[(k - 1) * num_points].
+ * suggested_eps[k - 1] is the knee of curve k (Kneedle), or its 95th
+ * percentile when the curve has no knee (knee_index[k - 1] == -1).
+ */
+typedef struct {
+	double *distances; /* max_k sorted curves of num_points values */
+	double *suggested_eps; /* Suggested eps per k */
+	int *knee_index; /* Knee position in each sorted curve, or -1 */
+	int max_k; /* Largest k computed */
+	int num_points; /* Length of each curve */
+} cdbscan_kdist_curves_t;
+
+cdbscan_kdist_curves_t *
+cdbscan_estimate_eps_multi(const cdbscan_point_t *points, int num_points,
+			   int max_k);
+cdbscan_kdist_curves_t *
+cdbscan_estimate_eps_multi_ctx(cdbscan_context_t *ctx,
+			       const cdbscan_point_t *points, int num_points,
+			       int max_k);
+void cdbscan_free_kdist_curves(cdbscan_kdist_curves_t *curves);
+
+/* Sampled eps estimation
+ * k-distances are computed for a random sample of query points against
+ * an index over the full dataset, so the neighbor work depends on the
+ * sample size rather than on num_points. Zeroed fields use defaults.
+ */
+typedef struct {
+	int num_samples; /* Query points m (default 1000) */
+	double target_width; /* Grow m until ci_high - ci_low <= this (0=off) */
+	int max_samples; /* Cap on m when target_width is set (default 16*m) */
+	int num_bootstrap; /* Bootstrap resamples (default 200) */
+	double confidence; /* Interval confidence level (default 0.95) */
+	unsigned long long seed; /* Seed for sampling and bootstrap */
+} cdbscan_sample_opts_t;
+
+typedef struct {
+	double *distances; /* Sampled k-distances, ascending */
+	int num_samples; /* Number of query points actually used */
+	int k; /* k value used */
+	double suggested_eps; /* Suggested eps value */
+	double ci_low; /* Lower bound of the bootstrap interval */
+	double ci_high; /* Upper bound of the bootstrap interval */
+} cdbscan_eps_sample_result_t;
+
+cdbscan_eps_sample_result_t *
+cdbscan_estimate_eps_sampled(const cdbscan_point_t *points, int num_points,
+			     int k, const cdbscan_sample_opts_t *opts);
+cdbscan_eps_sample_result_t *
+cdbscan_estimate_eps_sampled_ctx(cdbscan_context_t *ctx,
+				 const cdbscan_point_t *points, int num_points,
+				 int k, const cdbscan_sample_opts_t *opts);
+void cdbscan_free_eps_sample_result(cdbscan_eps_sample_result_t *result);
+
 /* Region query: find all points within eps distance of point
  * Returns: number of neighbors found
  * neighbors: array to store neighbor indices (must be pre-allocated)
@@ -16,11 +16,25 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* sched_setaffinity, CPU_SET on Linux */
 #include "cdbscan.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <float.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef CDBSCAN_USE_LIBNUMA
+#include <numa.h>
+#endif
 
 /* Internal comparison function for qsort */
 static int compare_doubles(const void *a, const void *b)
@@ -29,6 +43,15 @@ static int compare_doubles(const void *a, const void *b)
 	return (diff > 0) - (diff < 0);
 }
 
+/* Internal pseudo-random generator (splitmix64), state owned by the caller */
+static uint64_t rng_next(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
 /* Distance metric implementations */
 double cdbscan_euclidean_distance(const double *a, const double *b, int dims)
 {
@@ -111,736 +134,7658 @@ static double calculate_distance(const double *a, const double *b, int dims,
 	return -1.0;
 }
 
-/* KD-tree implementation for O(n log n) performance */
-typedef struct kdtree_node {
-	int point_idx; /* Index of point in original array */
-	struct kdtree_node *left;
-	struct kdtree_node *right;
-	int split_dim; /* Dimension used for splitting at this node */
-} kdtree_node_t;
+/* Thread pool
+ *
+ * Workers are started once and sleep on a condition variable between jobs.
+ * A job is a parallel loop over [0, n), cut into tasks of roughly equal
+ * estimated cost. Each worker starts with a contiguous block of tasks in
+ * its own deque, runs them front to back, and when it runs dry steals
+ * from the back of another worker's deque. The calling thread takes part
+ * as worker 0, so a pool of num_workers starts num_workers - 1 pthreads.
+ * Jobs must not be nested.
+ */
+typedef void (*pool_task_fn)(void *arg, int begin, int end, int worker);
+
+typedef struct thread_pool thread_pool_t;
+
+/* Tasks per worker a job is cut into; more tasks balance better */
+#define POOL_TASKS_PER_WORKER 16
 
 typedef struct {
-	kdtree_node_t *root;
-	const cdbscan_point_t *points; /* Reference to original points */
-	int num_points;
-	int dimensions;
-} kdtree_t;
+	int begin;
+	int end;
+} pool_task_t;
+
+/* Per-worker deque over a slice of the job's task array */
+typedef struct {
+	pthread_mutex_t lock;
+	int head; /* Next task for the owner */
+	int tail; /* One past the last task; thieves take tail - 1 */
+} pool_deque_t;
+
+/* Per-worker counters, cumulative until reset */
+typedef struct {
+	double busy_seconds;
+	unsigned long long tasks;
+	unsigned long long steals;
+	unsigned long long items;
+	char pad[32]; /* Keep workers' counters on separate cache lines */
+} pool_stats_t;
 
-/* Helper: Select median and partition array */
-static int partition(int *indices, const cdbscan_point_t *points, int left,
-		     int right, int dim)
+typedef struct {
+	thread_pool_t *pool;
+	int id;
+	int cpu; /* CPU the worker is pinned to, -1 if not pinned */
+	int node; /* NUMA node the worker runs on */
+} pool_worker_t;
+
+struct thread_pool {
+	int num_workers; /* Including the calling thread */
+	pthread_t *threads;
+	pool_worker_t *workers;
+	pool_deque_t *deques;
+	pool_stats_t *stats;
+	double wall_seconds; /* Time spent inside parallel jobs */
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	unsigned long generation; /* Bumped for every job */
+	int pending; /* Workers that have not finished the current job */
+	int shutdown;
+	int num_nodes;
+	int numa_flags; /* cdbscan_numa_flags_t currently applied */
+#ifdef __linux__
+	cpu_set_t affinity; /* Mask the workers started with */
+#endif
+
+	/* Current job */
+	pool_task_fn fn;
+	void *arg;
+	int no_steal; /* Each worker runs only its own tasks */
+	pool_task_t *tasks;
+	int task_capacity;
+};
+
+static double pool_now(void)
 {
-	int pivot_idx = (left + right) / 2;
-	int pivot_point = indices[pivot_idx];
-	double pivot_val = points[pivot_point].coords[dim];
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-	/* Move pivot to end */
-	int temp = indices[pivot_idx];
-	indices[pivot_idx] = indices[right];
-	indices[right] = temp;
+static int pool_deque_pop(pool_deque_t *dq)
+{
+	int task = -1;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail)
+		task = dq->head++;
+	pthread_mutex_unlock(&dq->lock);
+	return task;
+}
 
-	int store_idx = left;
-	for (int i = left; i < right; i++) {
-		if (points[indices[i]].coords[dim] < pivot_val) {
-			temp = indices[store_idx];
-			indices[store_idx] = indices[i];
-			indices[i] = temp;
-			store_idx++;
-		}
-	}
+static int pool_deque_steal(pool_deque_t *dq)
+{
+	int task = -1;
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail)
+		task = --dq->tail;
+	pthread_mutex_unlock(&dq->lock);
+	return task;
+}
 
-	/* Move pivot to its final place */
-	temp = indices[store_idx];
-	indices[store_idx] = indices[right];
-	indices[right] = temp;
+static void pool_run_task(thread_pool_t *pool, int worker, int task)
+{
+	pool_stats_t *stats = &pool->stats[worker];
+	const pool_task_t *t = &pool->tasks[task];
+	double start = pool_now();
+
+	pool->fn(pool->arg, t->begin, t->end, worker);
 
-	return store_idx;
+	stats->busy_seconds += pool_now() - start;
+	stats->tasks++;
+	stats->items += t->end - t->begin;
 }
 
-/* Helper: Perform nth_element partitioning (like C++ std::nth_element) */
-static void nth_element(int *indices, const cdbscan_point_t *points, int left,
-			int right, int n, int dim)
+static void pool_run_tasks(thread_pool_t *pool, int worker)
 {
-	while (left < right) {
-		int pivot_idx = partition(indices, points, left, right, dim);
+	int workers = pool->num_workers;
 
-		if (pivot_idx == n) {
-			return;
-		} else if (pivot_idx > n) {
-			right = pivot_idx - 1;
-		} else {
-			left = pivot_idx + 1;
+	for (;;) {
+		int task = pool_deque_pop(&pool->deques[worker]);
+		if (task >= 0) {
+			pool_run_task(pool, worker, task);
+			continue;
+		}
+
+		if (pool->no_steal)
+			break;
+
+		/* No new tasks appear during a job, so one empty sweep over
+		 * the other deques means this worker is done */
+		for (int i = 1; i < workers && task < 0; i++) {
+			int victim = (worker + i) % workers;
+			task = pool_deque_steal(&pool->deques[victim]);
 		}
+		if (task < 0)
+			break;
+		pool->stats[worker].steals++;
+		pool_run_task(pool, worker, task);
 	}
 }
 
-/* Build KD-tree recursively */
-static kdtree_node_t *kdtree_build_recursive(int *indices, int num_indices,
-					     const cdbscan_point_t *points,
-					     int depth, int dimensions)
+static void *pool_worker_main(void *data)
 {
-	if (num_indices <= 0)
-		return NULL;
+	pool_worker_t *self = (pool_worker_t *)data;
+	thread_pool_t *pool = self->pool;
+	unsigned long seen = 0;
+
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->shutdown && pool->generation == seen) {
+			pthread_cond_wait(&pool->wake, &pool->lock);
+		}
+		if (pool->shutdown)
+			break;
+		seen = pool->generation;
+		pthread_mutex_unlock(&pool->lock);
 
-	kdtree_node_t *node = (kdtree_node_t *)calloc(1, sizeof(kdtree_node_t));
-	if (!node)
-		return NULL;
+		pool_run_tasks(pool, self->id);
 
-	if (num_indices == 1) {
-		node->point_idx = indices[0];
-		node->split_dim = depth % dimensions;
-		return node;
+		pthread_mutex_lock(&pool->lock);
+		if (--pool->pending == 0)
+			pthread_cond_signal(&pool->done);
 	}
+	pthread_mutex_unlock(&pool->lock);
 
-	/* Choose splitting dimension (cycle through dimensions) */
-	int split_dim = depth % dimensions;
-	node->split_dim = split_dim;
-
-	/* Find median position */
-	int median_idx = num_indices / 2;
+	return NULL;
+}
 
-	/* Partition array so median is at correct position */
-	nth_element(indices, points, 0, num_indices - 1, median_idx, split_dim);
+static void pool_destroy(thread_pool_t *pool)
+{
+	if (!pool)
+		return;
 
-	node->point_idx = indices[median_idx];
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = 1;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
 
-	/* Recursively build left and right subtrees */
-	node->left = kdtree_build_recursive(indices, median_idx, points,
-					    depth + 1, dimensions);
-	node->right = kdtree_build_recursive(indices + median_idx + 1,
-					     num_indices - median_idx - 1,
-					     points, depth + 1, dimensions);
+	for (int i = 1; i < pool->num_workers; i++) {
+		pthread_join(pool->threads[i], NULL);
+	}
+	for (int i = 0; i < pool->num_workers; i++) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
+	}
 
-	return node;
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->wake);
+	pthread_cond_destroy(&pool->done);
+	free(pool->threads);
+	free(pool->workers);
+	free(pool->deques);
+	free(pool->stats);
+	free(pool->tasks);
+	free(pool);
 }
 
-/* Build KD-tree from points */
-static kdtree_t *kdtree_build(const cdbscan_point_t *points, int num_points)
+static thread_pool_t *pool_create(int num_workers)
 {
-	if (!points || num_points <= 0)
-		return NULL;
+	if (num_workers < 1)
+		num_workers = 1;
 
-	kdtree_t *tree = (kdtree_t *)calloc(1, sizeof(kdtree_t));
-	if (!tree)
+	thread_pool_t *pool = (thread_pool_t *)calloc(1, sizeof(thread_pool_t));
+	if (!pool)
 		return NULL;
 
-	/* Create array of indices */
-	int *indices = (int *)malloc(num_points * sizeof(int));
-	if (!indices) {
-		free(tree);
+	pool->threads = (pthread_t *)calloc(num_workers, sizeof(pthread_t));
+	pool->workers =
+		(pool_worker_t *)calloc(num_workers, sizeof(pool_worker_t));
+	pool->deques =
+		(pool_deque_t *)calloc(num_workers, sizeof(pool_deque_t));
+	pool->stats = (pool_stats_t *)calloc(num_workers, sizeof(pool_stats_t));
+	if (!pool->threads || !pool->workers || !pool->deques ||
+	    !pool->stats) {
+		free(pool->threads);
+		free(pool->workers);
+		free(pool->deques);
+		free(pool->stats);
+		free(pool);
 		return NULL;
 	}
 
-	for (int i = 0; i < num_points; i++) {
-		indices[i] = i;
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	pthread_cond_init(&pool->done, NULL);
+	for (int i = 0; i < num_workers; i++) {
+		pthread_mutex_init(&pool->deques[i].lock, NULL);
+		pool->workers[i].cpu = -1;
+	}
+	pool->num_nodes = 1;
+#ifdef __linux__
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &pool->affinity) != 0)
+		CPU_ZERO(&pool->affinity);
+#endif
+
+	/* Worker 0 is whichever thread submits a job */
+	pool->num_workers = 1;
+	for (int i = 1; i < num_workers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].id = i;
+		if (pthread_create(&pool->threads[i], NULL, pool_worker_main,
+				   &pool->workers[i]) != 0)
+			break; /* Run with the workers we got */
+		pool->num_workers++;
+	}
+	for (int i = pool->num_workers; i < num_workers; i++) {
+		pthread_mutex_destroy(&pool->deques[i].lock);
 	}
 
-	tree->points = points;
-	tree->num_points = num_points;
-	tree->dimensions = points[0].dimensions;
-	tree->root = kdtree_build_recursive(indices, num_points, points, 0,
-					    tree->dimensions);
-
-	free(indices);
-	return tree;
+	return pool;
 }
 
-/* Free KD-tree recursively */
-static void kdtree_free_recursive(kdtree_node_t *node)
+static int pool_num_workers(const thread_pool_t *pool)
 {
-	if (!node)
-		return;
-	kdtree_free_recursive(node->left);
-	kdtree_free_recursive(node->right);
-	free(node);
+	return pool ? pool->num_workers : 1;
 }
 
-/* Free KD-tree */
-static void kdtree_free(kdtree_t *tree)
+static int pool_reserve_tasks(thread_pool_t *pool, int count)
 {
-	if (!tree)
-		return;
-	kdtree_free_recursive(tree->root);
-	free(tree);
+	if (count <= pool->task_capacity)
+		return 1;
+
+	pool_task_t *tasks = (pool_task_t *)realloc(
+		pool->tasks, count * sizeof(pool_task_t));
+	if (!tasks)
+		return 0;
+	pool->tasks = tasks;
+	pool->task_capacity = count;
+	return 1;
 }
 
-/* Range query: find all points within eps distance */
-static void kdtree_range_query_recursive(const kdtree_node_t *node,
-					 const cdbscan_point_t *query_point,
-					 double eps, double eps_squared,
-					 const cdbscan_point_t *points,
-					 int *neighbors, int *count,
-					 int dimensions)
+/* Cut [0, n) into tasks: fixed-size chunks, or ranges of roughly equal
+ * total cost when a per-item cost estimate is given */
+static int pool_make_tasks(thread_pool_t *pool, int n, int grain,
+			   const float *cost)
 {
-	if (!node)
-		return;
-
-	const cdbscan_point_t *node_point = &points[node->point_idx];
+	int workers = pool->num_workers;
+	int count = 0;
 
-	/* Calculate actual Euclidean distance */
-	double dist = cdbscan_euclidean_distance(
-		query_point->coords, node_point->coords, dimensions);
+	if (!cost) {
+		if (grain <= 0) {
+			grain = n / (workers * POOL_TASKS_PER_WORKER);
+			if (grain < 1)
+				grain = 1;
+		}
+		if (!pool_reserve_tasks(pool, (n + grain - 1) / grain))
+			return 0;
+		for (int begin = 0; begin < n; begin += grain) {
+			int end = begin + grain < n ? begin + grain : n;
+			pool->tasks[count].begin = begin;
+			pool->tasks[count].end = end;
+			count++;
+		}
+		return count;
+	}
 
-	/* If within range, add to neighbors */
-	if (dist <= eps) {
-		neighbors[(*count)++] = node->point_idx;
+	double total = 0.0;
+	for (int i = 0; i < n; i++) {
+		total += cost[i];
 	}
+	double target = total / (workers * POOL_TASKS_PER_WORKER);
+
+	/* A task closes once it reaches the target, so there are at most
+	 * workers * POOL_TASKS_PER_WORKER + 1 of them */
+	if (!pool_reserve_tasks(pool, workers * POOL_TASKS_PER_WORKER + 1))
+		return 0;
 
-	/* Get splitting dimension and value */
-	int split_dim = node->split_dim;
-	double split_val = node_point->coords[split_dim];
-	double query_val = query_point->coords[split_dim];
-	double diff = query_val - split_val;
+	double acc = 0.0;
+	int begin = 0;
+	for (int i = 0; i < n; i++) {
+		acc += cost[i];
+		if (acc >= target || i == n - 1) {
+			pool->tasks[count].begin = begin;
+			pool->tasks[count].end = i + 1;
+			count++;
+			begin = i + 1;
+			acc = 0.0;
+		}
+	}
+	return count;
+}
 
-	/* Determine which subtree to search first */
-	kdtree_node_t *first_child = (diff < 0) ? node->left : node->right;
-	kdtree_node_t *second_child = (diff < 0) ? node->right : node->left;
+static void pool_run_job(thread_pool_t *pool, int num_tasks, int no_steal,
+			 pool_task_fn fn, void *arg);
 
-	/* Search the closer subtree first */
-	kdtree_range_query_recursive(first_child, query_point, eps, eps_squared,
-				     points, neighbors, count, dimensions);
+/* Run fn over [0, n) on all workers and wait for completion.
+ * grain: iterations per task when cost is NULL, 0 picks one
+ * cost: optional estimated cost of each iteration, used to size tasks
+ */
+static void pool_parallel_for_cost(thread_pool_t *pool, int n, int grain,
+				   const float *cost, pool_task_fn fn,
+				   void *arg)
+{
+	if (n <= 0)
+		return;
 
-	/* Only search the other subtree if it could contain points within eps */
-	if (fabs(diff) <= eps) {
-		kdtree_range_query_recursive(second_child, query_point, eps,
-					     eps_squared, points, neighbors,
-					     count, dimensions);
+	int workers = pool_num_workers(pool);
+	int num_tasks = workers > 1 && (cost || grain < n) ?
+				pool_make_tasks(pool, n, grain, cost) :
+				0;
+
+	if (num_tasks <= 1) {
+		double start = pool ? pool_now() : 0.0;
+		fn(arg, 0, n, 0);
+		if (pool) {
+			double elapsed = pool_now() - start;
+			pool->stats[0].busy_seconds += elapsed;
+			pool->stats[0].tasks++;
+			pool->stats[0].items += n;
+			pool->wall_seconds += elapsed;
+		}
+		return;
 	}
+
+	pool_run_job(pool, num_tasks, 0, fn, arg);
 }
 
-/* Helper: Compare function for sorting integers */
-static int compare_ints(const void *a, const void *b)
+static void pool_parallel_for(thread_pool_t *pool, int n, int grain,
+			      pool_task_fn fn, void *arg)
 {
-	return *(int *)a - *(int *)b;
+	pool_parallel_for_cost(pool, n, grain, NULL, fn, arg);
 }
 
-/* KD-tree range query */
-static int kdtree_range_query(const kdtree_t *tree, int query_idx, double eps,
-			      int *neighbors)
+/* Run fn over [0, n) with one contiguous slice per worker and no
+ * stealing, so worker w always gets the same part of the range. Used
+ * where placement matters more than balance. */
+static void pool_parallel_for_static(thread_pool_t *pool, int n,
+				     pool_task_fn fn, void *arg)
 {
-	if (!tree || !tree->root || !neighbors)
-		return 0;
+	int workers = pool_num_workers(pool);
+	if (workers == 1 || n < workers) {
+		pool_parallel_for_cost(pool, n, n, NULL, fn, arg);
+		return;
+	}
+	if (!pool_reserve_tasks(pool, workers)) {
+		pool_parallel_for(pool, n, 0, fn, arg);
+		return;
+	}
 
-	int count = 0;
-	double eps_squared = eps * eps;
-	const cdbscan_point_t *query_point = &tree->points[query_idx];
+	for (int w = 0; w < workers; w++) {
+		pool->tasks[w].begin = (int)((long long)n * w / workers);
+		pool->tasks[w].end = (int)((long long)n * (w + 1) / workers);
+	}
+	pool_run_job(pool, workers, 1, fn, arg);
+}
+
+/* Deal num_tasks prepared tasks to the workers and wait for them */
+static void pool_run_job(thread_pool_t *pool, int num_tasks, int no_steal,
+			 pool_task_fn fn, void *arg)
+{
+	int workers = pool->num_workers;
+
+	/* Deal contiguous blocks of tasks to the workers */
+	for (int w = 0; w < workers; w++) {
+		pool->deques[w].head =
+			(int)((long long)num_tasks * w / workers);
+		pool->deques[w].tail =
+			(int)((long long)num_tasks * (w + 1) / workers);
+	}
 
-	kdtree_range_query_recursive(tree->root, query_point, eps, eps_squared,
-				     tree->points, neighbors, &count,
-				     tree->dimensions);
+	double start = pool_now();
 
-	/* Sort neighbors to ensure consistent ordering */
-	if (count > 0) {
-		qsort(neighbors, count, sizeof(int), compare_ints);
+	pthread_mutex_lock(&pool->lock);
+	pool->fn = fn;
+	pool->arg = arg;
+	pool->no_steal = no_steal;
+	pool->pending = workers - 1;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->lock);
+
+	pool_run_tasks(pool, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	while (pool->pending > 0) {
+		pthread_cond_wait(&pool->done, &pool->lock);
 	}
+	pthread_mutex_unlock(&pool->lock);
 
-	return count;
+	pool->wall_seconds += pool_now() - start;
 }
 
-/* Data normalization functions */
-void cdbscan_normalize_minmax(cdbscan_point_t *points, int num_points)
-{
-	if (!points || num_points <= 0)
-		return;
+/* NUMA placement
+ *
+ * Nodes and their CPUs come from libnuma when built with
+ * CDBSCAN_USE_LIBNUMA, otherwise from /sys/devices/system/node; without
+ * either every CPU is on node 0. Workers are spread evenly over the CPUs
+ * the process may run on, node by node, and pin themselves with
+ * sched_setaffinity. The calling thread (worker 0) is never pinned and
+ * is counted on the node of the first CPU. Pinning needs Linux; other
+ * systems stay on a single node.
+ */
+#define NUMA_MAX_NODES 64
 
-	int dims = points[0].dimensions;
-	double *min_vals = (double *)calloc(dims, sizeof(double));
-	double *max_vals = (double *)calloc(dims, sizeof(double));
+#ifdef __linux__
 
-	if (!min_vals || !max_vals) {
-		free(min_vals);
-		free(max_vals);
-		return;
+/* Parse a sysfs cpulist such as "0-3,8-11" into cpu_node[] */
+static void numa_parse_cpulist(const char *list, int node, int *cpu_node)
+{
+	const char *p = list;
+
+	while (*p >= '0' && *p <= '9') {
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if (*end == '-')
+			last = strtol(end + 1, &end, 10);
+		if (last >= CPU_SETSIZE)
+			last = CPU_SETSIZE - 1;
+		for (long cpu = first; cpu <= last; cpu++) {
+			cpu_node[cpu] = node;
+		}
+		p = *end == ',' ? end + 1 : end;
 	}
+}
 
-	/* Initialize min/max */
-	for (int d = 0; d < dims; d++) {
-		min_vals[d] = DBL_MAX;
-		max_vals[d] = -DBL_MAX;
+/* Fill cpu_node[CPU_SETSIZE] (-1 for unknown CPUs), returns the number of
+ * nodes or 0 if the topology is unknown */
+static int numa_read_topology(int *cpu_node)
+{
+	int num_nodes = 0;
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		cpu_node[cpu] = -1;
 	}
 
-	/* Find min/max for each dimension */
-	for (int i = 0; i < num_points; i++) {
-		for (int d = 0; d < dims; d++) {
-			if (points[i].coords[d] < min_vals[d]) {
-				min_vals[d] = points[i].coords[d];
-			}
-			if (points[i].coords[d] > max_vals[d]) {
-				max_vals[d] = points[i].coords[d];
-			}
+#ifdef CDBSCAN_USE_LIBNUMA
+	if (numa_available() >= 0) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			cpu_node[cpu] = numa_node_of_cpu(cpu);
 		}
+		return numa_max_node() + 1;
 	}
-
-	/* Normalize to [0, 1] */
-	for (int i = 0; i < num_points; i++) {
-		for (int d = 0; d < dims; d++) {
-			double range = max_vals[d] - min_vals[d];
-			if (range > 0) {
-				points[i].coords[d] =
-					(points[i].coords[d] - min_vals[d]) /
-					range;
-			} else {
-				points[i].coords[d] = 0.0;
-			}
+#endif
+
+	for (int node = 0; node < NUMA_MAX_NODES; node++) {
+		char path[64], list[4096];
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+		FILE *f = fopen(path, "r");
+		if (!f)
+			continue; /* Node ids may have gaps */
+		if (fgets(list, sizeof(list), f)) {
+			numa_parse_cpulist(list, node, cpu_node);
+			num_nodes = node + 1;
 		}
+		fclose(f);
 	}
-
-	free(min_vals);
-	free(max_vals);
+	return num_nodes;
 }
 
-void cdbscan_normalize_zscore(cdbscan_point_t *points, int num_points)
+static void pool_pin_task(void *arg, int begin, int end, int worker)
 {
-	if (!points || num_points <= 0)
-		return;
-
-	int dims = points[0].dimensions;
-	double *means = (double *)calloc(dims, sizeof(double));
-	double *stdevs = (double *)calloc(dims, sizeof(double));
+	thread_pool_t *pool = (thread_pool_t *)arg;
+	int cpu = pool->workers[worker].cpu;
+	cpu_set_t set;
 
-	if (!means || !stdevs) {
-		free(means);
-		free(stdevs);
+	if (worker == 0)
 		return;
+	if (cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+	} else {
+		set = pool->affinity;
 	}
+	sched_setaffinity(0, sizeof(set), &set); /* Best effort */
+}
 
-	/* Calculate means */
-	for (int i = 0; i < num_points; i++) {
-		for (int d = 0; d < dims; d++) {
-			means[d] += points[i].coords[d];
+/* Apply cdbscan_numa_flags_t; 0 unpins the workers again */
+static int pool_set_numa(thread_pool_t *pool, int flags)
+{
+	int cpu_node[CPU_SETSIZE];
+	int cpus[CPU_SETSIZE];
+	int num_cpus = 0;
+	int num_nodes = numa_read_topology(cpu_node);
+
+	if (num_nodes <= 0) {
+		num_nodes = 1;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			cpu_node[cpu] = 0;
 		}
 	}
-	for (int d = 0; d < dims; d++) {
-		means[d] /= num_points;
-	}
 
-	/* Calculate standard deviations */
-	for (int i = 0; i < num_points; i++) {
-		for (int d = 0; d < dims; d++) {
-			double diff = points[i].coords[d] - means[d];
-			stdevs[d] += diff * diff;
+	/* Allowed CPUs, grouped by node */
+	for (int node = 0; node < num_nodes; node++) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (cpu_node[cpu] == node &&
+			    CPU_ISSET(cpu, &pool->affinity))
+				cpus[num_cpus++] = cpu;
 		}
 	}
-	for (int d = 0; d < dims; d++) {
-		stdevs[d] = sqrt(stdevs[d] / num_points);
-	}
+	if (flags && num_cpus == 0)
+		return -1;
 
-	/* Normalize using z-score */
-	for (int i = 0; i < num_points; i++) {
-		for (int d = 0; d < dims; d++) {
-			if (stdevs[d] > 0) {
-				points[i].coords[d] =
-					(points[i].coords[d] - means[d]) /
-					stdevs[d];
-			} else {
-				points[i].coords[d] = 0.0;
-			}
+	int workers = pool->num_workers;
+	for (int w = 0; w < workers; w++) {
+		pool_worker_t *worker = &pool->workers[w];
+		if (flags) {
+			int cpu = cpus[(long long)w * num_cpus / workers];
+			worker->cpu = w > 0 ? cpu : -1;
+			worker->node = cpu_node[cpu];
+		} else {
+			worker->cpu = -1;
+			worker->node = 0;
 		}
 	}
+	pool->num_nodes = flags ? num_nodes : 1;
+	pool->numa_flags = flags;
 
-	free(means);
-	free(stdevs);
+	pool_parallel_for_static(pool, workers, pool_pin_task, pool);
+	return 0;
+}
+#else
+static int pool_set_numa(thread_pool_t *pool, int flags)
+{
+	return flags ? -1 : 0;
 }
+#endif
 
-/* Parameter estimation - k-dist graph for eps selection */
-cdbscan_kdist_result_t *cdbscan_estimate_eps(const cdbscan_point_t *points,
-					     int num_points, int k)
+static int pool_worker_node(const thread_pool_t *pool, int worker)
 {
-	if (!points || num_points <= 0 || k <= 0 || k >= num_points) {
-		return NULL;
-	}
+	return pool ? pool->workers[worker].node : 0;
+}
 
-	cdbscan_kdist_result_t *result = (cdbscan_kdist_result_t *)malloc(
-		sizeof(cdbscan_kdist_result_t));
-	if (!result)
-		return NULL;
+/* Zero buf from the workers that will process each slice of it, so
+ * first touch places its pages on their nodes. No-op unless
+ * CDBSCAN_NUMA_FIRST_TOUCH is on. */
+typedef struct {
+	char *buf;
+	size_t elem_size;
+} touch_job_t;
 
-	result->distances = (double *)malloc(num_points * sizeof(double));
-	if (!result->distances) {
-		free(result);
-		return NULL;
-	}
+static void pool_touch_task(void *arg, int begin, int end, int worker)
+{
+	touch_job_t *job = (touch_job_t *)arg;
+	memset(job->buf + begin * job->elem_size, 0,
+	       (end - begin) * job->elem_size);
+}
 
-	result->k = k;
+static void pool_first_touch(thread_pool_t *pool, void *buf,
+			     size_t elem_size, int n)
+{
+	if (!pool || !(pool->numa_flags & CDBSCAN_NUMA_FIRST_TOUCH))
+		return;
 
-	/* For each point, find k-th nearest neighbor distance */
-	double *temp_dists = (double *)malloc(num_points * sizeof(double));
-	if (!temp_dists) {
-		free(result->distances);
-		free(result);
-		return NULL;
-	}
+	touch_job_t job = { (char *)buf, elem_size };
+	pool_parallel_for_static(pool, n, pool_touch_task, &job);
+}
 
-	for (int i = 0; i < num_points; i++) {
-		/* Calculate distances to all other points */
-		int dist_count = 0;
-		for (int j = 0; j < num_points; j++) {
-			if (i != j) {
-				temp_dists[dist_count++] =
-					cdbscan_euclidean_distance(
-						points[i].coords,
-						points[j].coords,
-						points[i].dimensions);
-			}
-		}
+/* Scratch memory reused across calls
+ *
+ * The working arrays of a clustering call come from numbered slots that
+ * keep their memory between calls, so a steady stream of similar calls
+ * stops allocating. Every context has its own slots; calls that run
+ * without one use a set private to the calling thread, freed when the
+ * thread exits. A scratch may instead hand out a caller's workspace,
+ * front to back, and then never touches the heap.
+ *
+ * A context's slots come from its allocator, and with huge pages on, the
+ * large ones are mapped in whole 2MB pages aligned to 2MB so that the
+ * kernel can back them with huge pages and tree walks over big inputs
+ * miss the TLB less.
+ *
+ * Under a memory limit, a call first frees the slots no call is using if
+ * what it is about to take would not fit next to them.
+ */
+enum {
+	SCRATCH_COORDS,
+	SCRATCH_LABELS,
+	SCRATCH_QUEUE,
+	SCRATCH_CORE,
+	SCRATCH_EST,
+	SCRATCH_COST,
+	SCRATCH_TREE_NODES,
+	SCRATCH_TREE_BOUNDS,
+	SCRATCH_TREE_PERM,
+	SCRATCH_PQ_TABLE,
+	SCRATCH_CURVE_KEYS,
+	SCRATCH_CURVE_RANK,
+	SCRATCH_CURVE_COORDS,
+	SCRATCH_CURVE_LABELS,
+	SCRATCH_TREE_OPEN,
+	SCRATCH_TREE_LEAF,
+	SCRATCH_TREE,
+	SCRATCH_SKETCH_TABLE,
+	SCRATCH_SKETCH_CELL,
+	SCRATCH_SPARSE,
+	SCRATCH_STATS,
+	SCRATCH_SLOTS
+};
+
+#define SCRATCH_ALIGN 64
+#define HUGE_PAGE_SIZE ((size_t)2 << 20)
+#if defined(MAP_HUGETLB) && !defined(MAP_HUGE_2MB)
+#define MAP_HUGE_2MB (21 << 26) /* Page size log2 << MAP_HUGE_SHIFT */
+#endif
+
+/* Bytes an arena spends on a request of size bytes */
+static inline size_t scratch_arena_size(size_t size)
+{
+	return (size + SCRATCH_ALIGN - 1) & ~(size_t)(SCRATCH_ALIGN - 1);
+}
 
-		/* Sort distances */
-		qsort(temp_dists, dist_count, sizeof(double), compare_doubles);
+/* Where a context's memory comes from */
+typedef struct {
+	cdbscan_allocator_t allocator; /* alloc NULL for malloc */
+	int huge_pages; /* Map blocks of HUGE_PAGE_SIZE and up */
+} scratch_mem_t;
 
-		/* Store k-th distance (k-1 because array is 0-indexed) */
-		result->distances[i] = temp_dists[k - 1];
-	}
+typedef struct {
+	void *ptr[SCRATCH_SLOTS];
+	size_t size[SCRATCH_SLOTS];
+	char *arena; /* Caller's workspace, or NULL for the heap */
+	size_t arena_size;
+	size_t arena_used;
+	const scratch_mem_t *mem; /* NULL for malloc */
+	size_t limit; /* Bytes a call may hold, 0 for no limit */
+	unsigned busy; /* Bit per slot handed out and not yet put back */
+} scratch_t;
+
+static inline size_t huge_page_round(size_t size)
+{
+	return (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
 
-	/* Sort k-distances in descending order for graph */
-	memcpy(temp_dists, result->distances, num_points * sizeof(double));
-	qsort(temp_dists, num_points, sizeof(double), compare_doubles);
+/* Anonymous memory aligned to HUGE_PAGE_SIZE, from the reserved huge page
+ * pool if there is one and else marked for transparent huge pages */
+static void *huge_page_alloc(size_t size)
+{
+	size = huge_page_round(size);
+#ifdef MAP_HUGETLB
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+				 MAP_HUGE_2MB,
+			 -1, 0);
+	if (ptr != MAP_FAILED)
+		return ptr;
+#endif
+
+	/* Over-map by a page to trim to an aligned start */
+	char *base = (char *)mmap(NULL, size + HUGE_PAGE_SIZE,
+				  PROT_READ | PROT_WRITE,
+				  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+	size_t head = (HUGE_PAGE_SIZE - (uintptr_t)base % HUGE_PAGE_SIZE) %
+		      HUGE_PAGE_SIZE;
+	if (head)
+		munmap(base, head);
+	munmap(base + head + size, HUGE_PAGE_SIZE - head);
+#ifdef MADV_HUGEPAGE
+	madvise(base + head, size, MADV_HUGEPAGE);
+#endif
+	return base + head;
+}
 
-	/* Find the "elbow" - simplified: use 95th percentile */
-	int elbow_idx = (int)(0.95 * num_points);
-	result->suggested_eps = temp_dists[elbow_idx];
+static inline int mem_huge(const scratch_mem_t *mem, size_t size)
+{
+	return mem && mem->huge_pages && size >= HUGE_PAGE_SIZE;
+}
 
-	free(temp_dists);
+/* Memory from a context's allocator, NULL mem for malloc */
+static void *mem_alloc(const scratch_mem_t *mem, size_t size)
+{
+	if (mem_huge(mem, size))
+		return huge_page_alloc(size);
+	if (!mem || !mem->allocator.alloc)
+		return malloc(size);
+
+	const cdbscan_allocator_t *a = &mem->allocator;
+	if (a->aligned_alloc)
+		return a->aligned_alloc(SCRATCH_ALIGN, size, a->user);
+	return a->alloc(size, a->user);
+}
 
-	return result;
+/* Free memory from mem_alloc() of the same size */
+static void mem_free(const scratch_mem_t *mem, void *ptr, size_t size)
+{
+	if (!ptr)
+		return;
+	if (mem_huge(mem, size))
+		munmap(ptr, huge_page_round(size));
+	else if (!mem || !mem->allocator.alloc)
+		free(ptr);
+	else
+		mem->allocator.free(ptr, size, mem->allocator.user);
 }
 
-void cdbscan_free_kdist_result(cdbscan_kdist_result_t *result)
+/* Memory for a slot, at least size bytes; contents are not kept. With no
+ * scratch this is a plain malloc. An arena gives out fresh memory on
+ * every call and takes none of it back. */
+static void *scratch_get(scratch_t *scratch, int slot, size_t size)
 {
-	if (result) {
-		free(result->distances);
-		free(result);
+	if (!scratch)
+		return malloc(size);
+
+	if (scratch->arena) {
+		uintptr_t base = (uintptr_t)scratch->arena;
+		size_t start = scratch_arena_size(base + scratch->arena_used) -
+			       base;
+		if (start > scratch->arena_size ||
+		    scratch->arena_size - start < size)
+			return NULL;
+		scratch->arena_used = start + scratch_arena_size(size);
+		return scratch->arena + start;
+	}
+
+	if (scratch->size[slot] < size) {
+		mem_free(scratch->mem, scratch->ptr[slot], scratch->size[slot]);
+		scratch->ptr[slot] = mem_alloc(scratch->mem, size);
+		scratch->size[slot] = scratch->ptr[slot] ? size : 0;
 	}
+	if (scratch->ptr[slot])
+		scratch->busy |= 1u << slot;
+	return scratch->ptr[slot];
 }
 
-/* Validation functions */
-int cdbscan_validate_params(const cdbscan_params_t *params)
+/* Give back memory from scratch_get */
+static void scratch_put(scratch_t *scratch, void *ptr)
 {
-	if (!params)
-		return 0;
-	if (params->eps <= 0)
-		return 0;
-	if (params->min_pts <= 0)
-		return 0;
+	if (!scratch) {
+		free(ptr);
+		return;
+	}
+	for (int slot = 0; ptr && slot < SCRATCH_SLOTS; slot++) {
+		if (scratch->ptr[slot] == ptr)
+			scratch->busy &= ~(1u << slot);
+	}
+}
 
-	if (params->dist_type == CDBSCAN_DIST_MINKOWSKI &&
-	    params->minkowski_p <= 0) {
-		return 0;
+/* Memory outside the slots, for one call: from the scratch's allocator
+ * but not kept. Free with scratch_free() and the same size. */
+static void *scratch_alloc(scratch_t *scratch, size_t size)
+{
+	return mem_alloc(scratch ? scratch->mem : NULL, size);
+}
+
+static void scratch_free(scratch_t *scratch, void *ptr, size_t size)
+{
+	mem_free(scratch ? scratch->mem : NULL, ptr, size);
+}
+
+/* Free the slots, all of them or only those not handed out */
+static void scratch_free_slots(scratch_t *scratch, int idle_only)
+{
+	for (int slot = 0; slot < SCRATCH_SLOTS; slot++) {
+		if (idle_only && (scratch->busy & (1u << slot)))
+			continue;
+		mem_free(scratch->mem, scratch->ptr[slot], scratch->size[slot]);
+		scratch->ptr[slot] = NULL;
+		scratch->size[slot] = 0;
 	}
+}
 
-	if (params->dist_type == CDBSCAN_DIST_CUSTOM && !params->custom_dist) {
-		return 0;
+/* Free the slots not handed out that are over keep bytes */
+static void scratch_trim(scratch_t *scratch, size_t keep)
+{
+	for (int slot = 0; slot < SCRATCH_SLOTS; slot++) {
+		if ((scratch->busy & (1u << slot)) ||
+		    scratch->size[slot] <= keep)
+			continue;
+		mem_free(scratch->mem, scratch->ptr[slot], scratch->size[slot]);
+		scratch->ptr[slot] = NULL;
+		scratch->size[slot] = 0;
 	}
+}
 
-	return 1;
+static void scratch_release(scratch_t *scratch)
+{
+	scratch_free_slots(scratch, 0);
+	scratch->busy = 0;
 }
 
-int cdbscan_validate_data(const cdbscan_point_t *points, int num_points)
+/* Bytes held in slots, all of them or only those handed out */
+static size_t scratch_held(const scratch_t *scratch, int busy_only)
 {
-	if (!points || num_points <= 0)
-		return 0;
+	size_t held = 0;
+	for (int slot = 0; slot < SCRATCH_SLOTS; slot++) {
+		if (!busy_only || (scratch->busy & (1u << slot)))
+			held += scratch->size[slot];
+	}
+	return held;
+}
 
-	int dims = points[0].dimensions;
-	if (dims <= 0)
+/* Bytes a call may still take under the limit, 0 if there is none */
+static size_t scratch_avail(const scratch_t *scratch)
+{
+	if (!scratch || !scratch->limit)
 		return 0;
+	size_t busy = scratch_held(scratch, 1);
+	return busy < scratch->limit ? scratch->limit - busy : 1;
+}
+
+/* Make room under the limit for size bytes more */
+static void scratch_reserve(scratch_t *scratch, size_t size)
+{
+	if (scratch && scratch->limit &&
+	    scratch_held(scratch, 0) + size > scratch->limit)
+		scratch_free_slots(scratch, 1);
+}
+
+/* Largest slot a thread keeps between calls without a context; bigger
+ * ones would otherwise stay allocated for as long as the thread lives */
+#define THREAD_SCRATCH_KEEP ((size_t)1 << 20)
+
+static pthread_key_t thread_scratch_key;
+static pthread_once_t thread_scratch_once = PTHREAD_ONCE_INIT;
+static int thread_scratch_ok;
+
+static void thread_scratch_destroy(void *data)
+{
+	scratch_release((scratch_t *)data);
+	free(data);
+}
+
+static void thread_scratch_init(void)
+{
+	thread_scratch_ok = pthread_key_create(&thread_scratch_key,
+					       thread_scratch_destroy) == 0;
+}
+
+/* The calling thread's scratch, or NULL to fall back to malloc */
+static scratch_t *thread_scratch(void)
+{
+	pthread_once(&thread_scratch_once, thread_scratch_init);
+	if (!thread_scratch_ok)
+		return NULL;
+
+	scratch_t *scratch =
+		(scratch_t *)pthread_getspecific(thread_scratch_key);
+	if (!scratch) {
+		scratch = (scratch_t *)calloc(1, sizeof(scratch_t));
+		if (scratch &&
+		    pthread_setspecific(thread_scratch_key, scratch) != 0) {
+			free(scratch);
+			scratch = NULL;
+		}
+	}
+	return scratch;
+}
+
+/* Execution context: owns the worker threads shared by every call */
+struct cdbscan_context {
+	thread_pool_t *pool;
+	pthread_mutex_t busy; /* Held by the call using the workers */
+	scratch_t scratch; /* Used by the call holding busy */
+	scratch_t *worker_scratch; /* Per worker, for batches */
+	scratch_mem_t mem; /* Source of the memory of both */
+	size_t memory_limit; /* Per call, 0 for none; read without busy */
+};
+
+/* Memory held for calls; it comes from the settings in ctx->mem */
+static void context_release_scratch(cdbscan_context_t *ctx)
+{
+	scratch_release(&ctx->scratch);
+	for (int w = 0; ctx->worker_scratch && w < pool_num_workers(ctx->pool);
+	     w++) {
+		scratch_release(&ctx->worker_scratch[w]);
+	}
+}
+
+cdbscan_context_t *cdbscan_context_create(int num_threads)
+{
+	if (num_threads < 0)
+		return NULL;
+	if (num_threads == 0) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = online > 0 ? (int)online : 1;
+	}
+
+	cdbscan_context_t *ctx =
+		(cdbscan_context_t *)calloc(1, sizeof(cdbscan_context_t));
+	if (!ctx)
+		return NULL;
+
+	ctx->pool = pool_create(num_threads);
+	if (!ctx->pool) {
+		free(ctx);
+		return NULL;
+	}
+	pthread_mutex_init(&ctx->busy, NULL);
+	ctx->scratch.mem = &ctx->mem;
+
+	return ctx;
+}
+
+void cdbscan_context_destroy(cdbscan_context_t *ctx)
+{
+	if (!ctx)
+		return;
+	context_release_scratch(ctx);
+	free(ctx->worker_scratch);
+	pool_destroy(ctx->pool);
+	pthread_mutex_destroy(&ctx->busy);
+	free(ctx);
+}
+
+int cdbscan_context_num_threads(const cdbscan_context_t *ctx)
+{
+	return ctx ? pool_num_workers(ctx->pool) : 1;
+}
+
+int cdbscan_context_set_numa(cdbscan_context_t *ctx, int flags)
+{
+	if (!ctx || flags < 0 ||
+	    (flags & ~(CDBSCAN_NUMA_PIN | CDBSCAN_NUMA_FIRST_TOUCH |
+		       CDBSCAN_NUMA_REPLICATE)))
+		return -1;
+
+	/* Placement only helps if threads stay where the data is */
+	if (flags)
+		flags |= CDBSCAN_NUMA_PIN;
+
+	pthread_mutex_lock(&ctx->busy);
+	int ret = pool_set_numa(ctx->pool, flags);
+	pthread_mutex_unlock(&ctx->busy);
+	return ret;
+}
+
+int cdbscan_context_set_allocator(cdbscan_context_t *ctx,
+				  const cdbscan_allocator_t *allocator)
+{
+	if (!ctx || (allocator && (!allocator->alloc || !allocator->free)))
+		return -1;
+
+	pthread_mutex_lock(&ctx->busy);
+	context_release_scratch(ctx);
+	if (allocator)
+		ctx->mem.allocator = *allocator;
+	else
+		memset(&ctx->mem.allocator, 0, sizeof(cdbscan_allocator_t));
+	pthread_mutex_unlock(&ctx->busy);
+	return 0;
+}
+
+int cdbscan_context_set_huge_pages(cdbscan_context_t *ctx, int enable)
+{
+	if (!ctx)
+		return -1;
+
+	pthread_mutex_lock(&ctx->busy);
+	context_release_scratch(ctx);
+	ctx->mem.huge_pages = enable != 0;
+	pthread_mutex_unlock(&ctx->busy);
+	return 0;
+}
+
+int cdbscan_context_set_memory_limit(cdbscan_context_t *ctx, size_t limit)
+{
+	if (!ctx)
+		return -1;
+
+	/* Memory held from before would not count against the limit */
+	pthread_mutex_lock(&ctx->busy);
+	context_release_scratch(ctx);
+	__atomic_store_n(&ctx->memory_limit, limit, __ATOMIC_RELAXED);
+	ctx->scratch.limit = limit;
+	pthread_mutex_unlock(&ctx->busy);
+	return 0;
+}
+
+int cdbscan_context_num_nodes(const cdbscan_context_t *ctx)
+{
+	return ctx ? ctx->pool->num_nodes : 1;
+}
+
+int cdbscan_context_thread_stats(const cdbscan_context_t *ctx,
+				 cdbscan_thread_stats_t *stats,
+				 int max_threads)
+{
+	if (!ctx || !stats || max_threads <= 0)
+		return 0;
+
+	const thread_pool_t *pool = ctx->pool;
+	int count = pool->num_workers < max_threads ? pool->num_workers :
+						      max_threads;
+	for (int i = 0; i < count; i++) {
+		stats[i].busy_seconds = pool->stats[i].busy_seconds;
+		stats[i].wall_seconds = pool->wall_seconds;
+		stats[i].tasks = pool->stats[i].tasks;
+		stats[i].steals = pool->stats[i].steals;
+		stats[i].items = pool->stats[i].items;
+		stats[i].node = pool->workers[i].node;
+	}
+	return count;
+}
+
+void cdbscan_context_reset_stats(cdbscan_context_t *ctx)
+{
+	if (!ctx)
+		return;
+	pthread_mutex_lock(&ctx->busy);
+	memset(ctx->pool->stats, 0,
+	       ctx->pool->num_workers * sizeof(pool_stats_t));
+	ctx->pool->wall_seconds = 0.0;
+	pthread_mutex_unlock(&ctx->busy);
+}
+
+/* Workers and scratch memory for one call */
+typedef struct {
+	thread_pool_t *pool; /* NULL runs serially */
+	scratch_t *scratch; /* NULL allocates from the heap */
+	cdbscan_context_t *ctx; /* Context whose workers are held */
+	int owned_pool;
+} call_env_t;
+
+/* Take the context's workers if they are free. A call that finds them
+ * busy with another call runs on its own thread instead of waiting.
+ * Without a context, params.num_threads > 1 starts a transient pool. */
+static void call_begin(call_env_t *env, cdbscan_context_t *ctx,
+		       int num_threads)
+{
+	memset(env, 0, sizeof(*env));
+	if (ctx && pthread_mutex_trylock(&ctx->busy) == 0) {
+		env->ctx = ctx;
+		env->pool = ctx->pool;
+		env->scratch = &ctx->scratch;
+		return;
+	}
+
+	/* The context's memory limit still holds on this thread */
+	size_t limit = ctx ? __atomic_load_n(&ctx->memory_limit,
+					     __ATOMIC_RELAXED) :
+			     0;
+	env->scratch = thread_scratch();
+	if (env->scratch)
+		env->scratch->limit = limit;
+	if (!ctx && num_threads > 1) {
+		env->pool = pool_create(num_threads);
+		env->owned_pool = env->pool != NULL;
+	}
+}
+
+static void call_end(call_env_t *env)
+{
+	if (env->ctx)
+		pthread_mutex_unlock(&env->ctx->busy);
+	else if (env->scratch)
+		scratch_trim(env->scratch, THREAD_SCRATCH_KEEP);
+	if (env->owned_pool)
+		pool_destroy(env->pool);
+}
+
+/* Copy point coordinates into one row-major array */
+typedef struct {
+	const cdbscan_point_t *points;
+	double *coords;
+	int dims;
+} pack_job_t;
+
+static void pack_task(void *arg, int begin, int end, int worker)
+{
+	pack_job_t *job = (pack_job_t *)arg;
+	for (int i = begin; i < end; i++) {
+		memcpy(job->coords + (size_t)i * job->dims,
+		       job->points[i].coords, job->dims * sizeof(double));
+	}
+}
+
+static double *pack_points(const cdbscan_point_t *points, int num_points,
+			   int dims, thread_pool_t *pool, scratch_t *scratch)
+{
+	double *coords = (double *)scratch_get(
+		scratch, SCRATCH_COORDS,
+		(size_t)num_points * dims * sizeof(double));
+	if (!coords)
+		return NULL;
+
+	/* Under first touch, each worker writes the rows it will query */
+	pack_job_t job = { points, coords, dims };
+	if (pool && (pool->numa_flags & CDBSCAN_NUMA_FIRST_TOUCH))
+		pool_parallel_for_static(pool, num_points, pack_task, &job);
+	else
+		pool_parallel_for(pool, num_points, 0, pack_task, &job);
+	return coords;
+}
+
+/* Squared Euclidean distance, summed in the same order as
+ * cdbscan_euclidean_distance() */
+static inline double dist2(const double *a, const double *b, int dims)
+{
+	double sum = 0.0;
+	for (int i = 0; i < dims; i++) {
+		double diff = a[i] - b[i];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+/* Exact "distance <= eps" on a squared distance. Matches the sqrt-based
+ * comparison used by the brute force path; sqrt is only taken within a
+ * few ulps of the boundary. Monotone in d2, so it is also a safe pruning
+ * test on lower bounds. */
+static inline int dist2_within(double d2, double eps, double eps2)
+{
+	if (d2 < eps2 * (1.0 - 4 * DBL_EPSILON))
+		return 1;
+	if (d2 > eps2 * (1.0 + 4 * DBL_EPSILON))
+		return 0;
+	return sqrt(d2) <= eps;
+}
+
+/* KD-tree implementation for O(n log n) performance
+ *
+ * Nodes live in one array and cover a contiguous range of perm[], the
+ * point indices in tree order. Internal nodes split their range at the
+ * median of the widest dimension of their bounding box; leaves hold up to
+ * KDTREE_LEAF_SIZE points. Queries prune by the distance to each node's
+ * bounding box.
+ *
+ * Over points already sorted along a Morton curve the tree can instead be
+ * read off the sorted keys, as in a linear BVH build: each node splits
+ * where the keys of its range first differ in a bit, which halves a grid
+ * cell, and boxes are merged bottom-up. No point moves and no coordinate
+ * is read above the leaves, so the build is linear in the number of
+ * points.
+ */
+#define KDTREE_LEAF_SIZE 8
+#define KDTREE_MAX_DEPTH 64
+
+typedef struct kdtree_node {
+	int lo; /* First position in perm covered by this subtree */
+	int hi; /* One past the last position */
+	int left; /* Child node indices, -1 for leaves */
+	int right;
+} kdtree_node_t;
+
+typedef struct {
+	kdtree_node_t *nodes;
+	double *bounds; /* Per node: dims minima followed by dims maxima */
+	int *perm; /* Point indices in tree order */
+	const double *coords; /* Row-major coordinates (not owned) */
+	const uint64_t *keys; /* Sorted Morton keys, NULL for median splits */
+	int num_nodes;
+	int max_nodes;
+	int num_points;
+	int dimensions;
+	scratch_t *scratch; /* Owner of the arrays, NULL for heap or clone */
+} kdtree_t;
+
+/* Leaves hold more than KDTREE_LEAF_SIZE / 2 points, which bounds the
+ * number of nodes a median-split tree can need */
+static int kdtree_max_nodes(int num_points)
+{
+	return 2 * (num_points / ((KDTREE_LEAF_SIZE + 1) / 2)) + 1;
+}
+
+/* Helper: Perform nth_element partitioning (like C++ std::nth_element)
+ * Three-way partitioning keeps runs of equal coordinates linear.
+ */
+static void nth_element(int *perm, const double *coords, int dims, int left,
+			int right, int n, int dim)
+{
+	while (left < right) {
+		double pivot =
+			coords[(size_t)perm[(left + right) / 2] * dims + dim];
+		int lt = left, i = left, gt = right;
+
+		while (i <= gt) {
+			double val = coords[(size_t)perm[i] * dims + dim];
+			int temp;
+			if (val < pivot) {
+				temp = perm[lt];
+				perm[lt++] = perm[i];
+				perm[i++] = temp;
+			} else if (val > pivot) {
+				temp = perm[gt];
+				perm[gt--] = perm[i];
+				perm[i] = temp;
+			} else {
+				i++;
+			}
+		}
+
+		/* [left, lt) < pivot, [lt, gt] == pivot, (gt, right] > pivot */
+		if (n < lt) {
+			right = lt - 1;
+		} else if (n > gt) {
+			left = gt + 1;
+		} else {
+			return;
+		}
+	}
+}
+
+/* Set a node's box to the bounding box of the points in its range */
+static void kdtree_range_bounds(kdtree_t *tree, int node)
+{
+	const kdtree_node_t *nd = &tree->nodes[node];
+	int dims = tree->dimensions;
+	double *min = tree->bounds + (size_t)node * 2 * dims;
+	double *max = min + dims;
+
+	const double *first = tree->coords + (size_t)tree->perm[nd->lo] * dims;
+	for (int d = 0; d < dims; d++) {
+		min[d] = first[d];
+		max[d] = first[d];
+	}
+	for (int i = nd->lo + 1; i < nd->hi; i++) {
+		const double *p = tree->coords + (size_t)tree->perm[i] * dims;
+		for (int d = 0; d < dims; d++) {
+			if (p[d] < min[d])
+				min[d] = p[d];
+			if (p[d] > max[d])
+				max[d] = p[d];
+		}
+	}
+}
+
+/* Give a node two children covering [lo, mid) and [mid, hi) */
+static void kdtree_add_children(kdtree_t *tree, int node, int mid)
+{
+	kdtree_node_t *nd = &tree->nodes[node];
+
+	/* Siblings are allocated together so they share a cache line */
+	int child = __atomic_fetch_add(&tree->num_nodes, 2, __ATOMIC_RELAXED);
+	tree->nodes[child].lo = nd->lo;
+	tree->nodes[child].hi = mid;
+	tree->nodes[child + 1].lo = mid;
+	tree->nodes[child + 1].hi = nd->hi;
+	nd->left = child;
+	nd->right = child + 1;
+}
+
+/* Set an internal node's box to the union of its children's boxes */
+static void kdtree_merge_bounds(kdtree_t *tree, int node)
+{
+	const kdtree_node_t *nd = &tree->nodes[node];
+	int dims = tree->dimensions;
+	double *box = tree->bounds + (size_t)node * 2 * dims;
+	const double *l = tree->bounds + (size_t)nd->left * 2 * dims;
+	const double *r = tree->bounds + (size_t)nd->right * 2 * dims;
+
+	for (int d = 0; d < dims; d++) {
+		box[d] = fmin(l[d], r[d]);
+		box[dims + d] = fmax(l[dims + d], r[dims + d]);
+	}
+}
+
+/* Compute the bounding box of a node and split it at the median of its
+ * widest dimension when it is too large for a leaf.
+ * Returns 1 when two children were created.
+ */
+static int kdtree_split_node(kdtree_t *tree, int node)
+{
+	kdtree_node_t *nd = &tree->nodes[node];
+	int dims = tree->dimensions;
+	int lo = nd->lo, hi = nd->hi;
+	double *min = tree->bounds + (size_t)node * 2 * dims;
+	double *max = min + dims;
+
+	nd->left = -1;
+	nd->right = -1;
+	kdtree_range_bounds(tree, node);
+
+	if (hi - lo <= KDTREE_LEAF_SIZE)
+		return 0;
+
+	int split_dim = 0;
+	for (int d = 1; d < dims; d++) {
+		if (max[d] - min[d] > max[split_dim] - min[split_dim])
+			split_dim = d;
+	}
+	if (max[split_dim] - min[split_dim] <= 0)
+		return 0; /* All points coincide */
+
+	int mid = lo + (hi - lo) / 2;
+	nth_element(tree->perm, tree->coords, dims, lo, hi - 1, mid,
+		    split_dim);
+	kdtree_add_children(tree, node, mid);
+	return 1;
+}
+
+/* Split a node of a Morton-sorted tree at the first key with the highest
+ * bit that differs across its range. The split is moved so that each
+ * child keeps at least half a leaf, which bounds the node count as for
+ * median splits, and nodes below half the depth limit split in the middle
+ * so that runs of equal keys cannot overflow the query stack. Bounds are
+ * only computed here for leaves.
+ */
+static int kdtree_split_keyed(kdtree_t *tree, int node, int depth)
+{
+	kdtree_node_t *nd = &tree->nodes[node];
+	const uint64_t *keys = tree->keys;
+	int lo = nd->lo, hi = nd->hi;
+
+	nd->left = -1;
+	nd->right = -1;
+	if (hi - lo <= KDTREE_LEAF_SIZE) {
+		kdtree_range_bounds(tree, node);
+		return 0;
+	}
+
+	int mid = lo + (hi - lo) / 2;
+	uint64_t diff = keys[lo] ^ keys[hi - 1];
+	if (diff && depth < KDTREE_MAX_DEPTH / 2) {
+		uint64_t bit = (uint64_t)1 << (63 - __builtin_clzll(diff));
+		int a = lo, b = hi - 1; /* keys[b] has the bit set */
+		while (a < b) {
+			int m = a + (b - a) / 2;
+			if (keys[m] & bit)
+				b = m;
+			else
+				a = m + 1;
+		}
+		int min_leaf = (KDTREE_LEAF_SIZE + 1) / 2;
+		mid = a < lo + min_leaf ? lo + min_leaf :
+		      a > hi - min_leaf ? hi - min_leaf :
+					  a;
+	}
+	kdtree_add_children(tree, node, mid);
+	return 1;
+}
+
+static int kdtree_split(kdtree_t *tree, int node, int depth)
+{
+	if (tree->keys)
+		return kdtree_split_keyed(tree, node, depth);
+	return kdtree_split_node(tree, node);
+}
+
+static void kdtree_build_subtree(kdtree_t *tree, int node, int depth)
+{
+	if (!kdtree_split(tree, node, depth))
+		return;
+	kdtree_build_subtree(tree, tree->nodes[node].left, depth + 1);
+	kdtree_build_subtree(tree, tree->nodes[node].right, depth + 1);
+	if (tree->keys)
+		kdtree_merge_bounds(tree, node);
+}
+
+typedef struct {
+	kdtree_t *tree;
+	const int *subtrees;
+	int depth; /* Of every subtree root */
+} kdtree_build_job_t;
+
+static void kdtree_build_task(void *arg, int begin, int end, int worker)
+{
+	kdtree_build_job_t *job = (kdtree_build_job_t *)arg;
+	for (int i = begin; i < end; i++) {
+		kdtree_build_subtree(job->tree, job->subtrees[i], job->depth);
+	}
+}
+
+static void kdtree_free(kdtree_t *tree)
+{
+	if (!tree)
+		return;
+	scratch_put(tree->scratch, tree->nodes);
+	scratch_put(tree->scratch, tree->bounds);
+	scratch_put(tree->scratch, tree->perm);
+	scratch_put(tree->scratch, tree);
+}
+
+/* Recompute the bounding boxes for moved points, keeping the tree's
+ * shape. Children always come after their parent in nodes[], so one
+ * backward sweep sees both children before the parent. Queries stay
+ * exact; only pruning weakens as the boxes loosen. */
+static void kdtree_refit(kdtree_t *tree, const double *coords)
+{
+	tree->coords = coords;
+	for (int node = tree->num_nodes - 1; node >= 0; node--) {
+		if (tree->nodes[node].left < 0)
+			kdtree_range_bounds(tree, node);
+		else
+			kdtree_merge_bounds(tree, node);
+	}
+}
+
+/* Summed extents of the leaf boxes; grows as a refitted tree loosens */
+static double kdtree_leaf_extent(const kdtree_t *tree)
+{
+	int dims = tree->dimensions;
+	double extent = 0.0;
+
+	for (int node = 0; node < tree->num_nodes; node++) {
+		if (tree->nodes[node].left >= 0)
+			continue;
+		const double *min = tree->bounds + (size_t)node * 2 * dims;
+		for (int d = 0; d < dims; d++) {
+			extent += min[dims + d] - min[d];
+		}
+	}
+	return extent;
+}
+
+/* Bytes of a clone of src: the tree and its arrays in one block */
+static size_t kdtree_clone_size(const kdtree_t *src)
+{
+	return scratch_arena_size(sizeof(kdtree_t)) +
+	       (size_t)src->num_nodes * sizeof(kdtree_node_t) +
+	       (size_t)src->num_nodes * 2 * src->dimensions * sizeof(double) +
+	       (size_t)src->num_points * sizeof(int);
+}
+
+/* Copy of a built tree over a copy of its coordinates, from scratch's
+ * allocator. Free with scratch_free() and kdtree_clone_size(). */
+static kdtree_t *kdtree_clone(const kdtree_t *src, const double *coords,
+			      scratch_t *scratch)
+{
+	char *block = (char *)scratch_alloc(scratch, kdtree_clone_size(src));
+	if (!block)
+		return NULL;
+
+	kdtree_t *tree = (kdtree_t *)block;
+	size_t nodes = (size_t)src->num_nodes * sizeof(kdtree_node_t);
+	size_t bounds =
+		(size_t)src->num_nodes * 2 * src->dimensions * sizeof(double);
+	*tree = *src;
+	tree->scratch = NULL;
+	tree->coords = coords;
+	tree->max_nodes = src->num_nodes;
+	tree->nodes = (kdtree_node_t *)(block +
+					scratch_arena_size(sizeof(kdtree_t)));
+	tree->bounds = (double *)((char *)tree->nodes + nodes);
+	tree->perm = (int *)((char *)tree->bounds + bounds);
+
+	memcpy(tree->nodes, src->nodes, nodes);
+	memcpy(tree->bounds, src->bounds, bounds);
+	memcpy(tree->perm, src->perm, src->num_points * sizeof(int));
+	return tree;
+}
+
+/* Build KD-tree over row-major coordinates, split at the Morton keys if
+ * the points are sorted along the curve and keys is given. The top levels
+ * are split serially until there are enough independent subtrees to keep
+ * every worker busy; those subtrees are then built in parallel.
+ */
+static kdtree_t *kdtree_build(const double *coords, const uint64_t *keys,
+			      int num_points, int dims, thread_pool_t *pool,
+			      scratch_t *scratch)
+{
+	if (!coords || num_points <= 0 || dims <= 0)
+		return NULL;
+
+	kdtree_t *tree = (kdtree_t *)scratch_get(scratch, SCRATCH_TREE,
+						 sizeof(kdtree_t));
+	if (!tree)
+		return NULL;
+
+	memset(tree, 0, sizeof(kdtree_t));
+	tree->coords = coords;
+	tree->keys = keys;
+	tree->num_points = num_points;
+	tree->dimensions = dims;
+	tree->max_nodes = kdtree_max_nodes(num_points);
+	tree->scratch = scratch;
+	tree->nodes = (kdtree_node_t *)scratch_get(
+		scratch, SCRATCH_TREE_NODES,
+		tree->max_nodes * sizeof(kdtree_node_t));
+	tree->bounds = (double *)scratch_get(
+		scratch, SCRATCH_TREE_BOUNDS,
+		(size_t)tree->max_nodes * 2 * dims * sizeof(double));
+	tree->perm = (int *)scratch_get(scratch, SCRATCH_TREE_PERM,
+					num_points * sizeof(int));
+	if (!tree->nodes || !tree->bounds || !tree->perm) {
+		kdtree_free(tree);
+		return NULL;
+	}
+
+	for (int i = 0; i < num_points; i++) {
+		tree->perm[i] = i;
+	}
+
+	tree->num_nodes = 1;
+	tree->nodes[0].lo = 0;
+	tree->nodes[0].hi = num_points;
+
+	int workers = pool_num_workers(pool);
+	if (workers <= 1) {
+		kdtree_build_subtree(tree, 0, 0);
+		return tree;
+	}
+
+	int target = 8 * workers;
+	int *level = (int *)scratch_alloc(scratch, 4 * target * sizeof(int));
+	if (!level) {
+		kdtree_build_subtree(tree, 0, 0);
+		return tree;
+	}
+
+	int *current = level, *next = level + 2 * target;
+	int count = 1, depth = 0;
+	current[0] = 0;
+	while (count > 0 && count < target) {
+		int next_count = 0;
+		for (int i = 0; i < count; i++) {
+			if (kdtree_split(tree, current[i], depth)) {
+				next[next_count++] =
+					tree->nodes[current[i]].left;
+				next[next_count++] =
+					tree->nodes[current[i]].right;
+			}
+		}
+		int *temp = current;
+		current = next;
+		next = temp;
+		count = next_count;
+		depth++;
+	}
+	int top_nodes = tree->num_nodes;
+
+	/* Subtrees differ in size, so size the tasks by point count */
+	float *cost = (float *)scratch_alloc(scratch, count * sizeof(float));
+	if (cost) {
+		for (int i = 0; i < count; i++) {
+			const kdtree_node_t *nd = &tree->nodes[current[i]];
+			cost[i] = (float)(nd->hi - nd->lo);
+		}
+	}
+
+	kdtree_build_job_t job = { tree, current, depth };
+	pool_parallel_for_cost(pool, count, 1, cost, kdtree_build_task, &job);
+
+	/* The serial levels come first in nodes[]; merge their boxes last */
+	for (int node = top_nodes - 1; tree->keys && node >= 0; node--) {
+		if (tree->nodes[node].left >= 0)
+			kdtree_merge_bounds(tree, node);
+	}
+
+	scratch_free(scratch, cost, count * sizeof(float));
+	scratch_free(scratch, level, 4 * target * sizeof(int));
+	return tree;
+}
+
+/* Squared distance from a query to a node's bounding box */
+static inline double kdtree_min_dist2(const kdtree_t *tree, int node,
+				      const double *query)
+{
+	int dims = tree->dimensions;
+	const double *min = tree->bounds + (size_t)node * 2 * dims;
+	const double *max = min + dims;
+	double sum = 0.0;
+
+	for (int d = 0; d < dims; d++) {
+		double diff = 0.0;
+		if (query[d] < min[d])
+			diff = min[d] - query[d];
+		else if (query[d] > max[d])
+			diff = query[d] - max[d];
+		sum += diff * diff;
+	}
+	return sum;
+}
+
+/* Estimated eps-neighbor count of every point, from the density of the
+ * leaf holding it (points per unit volume of its bounding box) times the
+ * volume of the eps box. Only meant to be roughly proportional to the
+ * real count, for sizing parallel tasks.
+ */
+typedef struct {
+	const kdtree_t *tree;
+	double eps;
+	float *est;
+} kdtree_est_job_t;
+
+static void kdtree_estimate_task(void *arg, int begin, int end, int worker)
+{
+	kdtree_est_job_t *job = (kdtree_est_job_t *)arg;
+	const kdtree_t *tree = job->tree;
+	int dims = tree->dimensions;
+	double side = 2.0 * job->eps;
+	double max_log = log((double)tree->num_points);
+
+	for (int node = begin; node < end; node++) {
+		const kdtree_node_t *nd = &tree->nodes[node];
+		if (nd->left >= 0)
+			continue;
+
+		const double *min = tree->bounds + (size_t)node * 2 * dims;
+		const double *max = min + dims;
+		double log_est = log((double)(nd->hi - nd->lo));
+		for (int d = 0; d < dims; d++) {
+			double extent = max[d] - min[d];
+			if (extent < side * 1e-3)
+				extent = side * 1e-3;
+			log_est += log(side / extent);
+		}
+		if (log_est > max_log)
+			log_est = max_log;
+
+		float est = (float)exp(log_est);
+		for (int i = nd->lo; i < nd->hi; i++) {
+			job->est[tree->perm[i]] = est;
+		}
+	}
+}
+
+static void kdtree_estimate_neighbors(const kdtree_t *tree, double eps,
+				      float *est, thread_pool_t *pool)
+{
+	kdtree_est_job_t job = { tree, eps, est };
+	pool_parallel_for(pool, tree->num_nodes, 0, kdtree_estimate_task, &job);
+}
+
+/* Visitor called for each neighbor found; nonzero return stops the query */
+typedef int (*visit_fn_t)(void *arg, int idx);
+
+/* Visitor for packets of queries, told which query of the packet found the
+ * neighbor; nonzero return stops that query only */
+typedef int (*packet_fn_t)(void *arg, int slot, int idx);
+
+/* Most queries in one packet; slots are bits of an unsigned mask */
+#define QUERY_PACKET 8
+
+/* Range query: call fn for every point within eps of query.
+ * Returns 1 if the visitor stopped the traversal early.
+ */
+static int kdtree_visit(const kdtree_t *tree, const double *query, double eps,
+			visit_fn_t fn, void *arg)
+{
+	int dims = tree->dimensions;
+	double eps2 = eps * eps;
+	int stack[KDTREE_MAX_DEPTH];
+	int top = 0;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		if (!dist2_within(kdtree_min_dist2(tree, node, query), eps,
+				  eps2))
+			continue;
+
+		const kdtree_node_t *nd = &tree->nodes[node];
+		if (nd->left < 0) {
+			for (int i = nd->lo; i < nd->hi; i++) {
+				int idx = tree->perm[i];
+				double d2 = dist2(query,
+						  tree->coords +
+							  (size_t)idx * dims,
+						  dims);
+				if (dist2_within(d2, eps, eps2) &&
+				    fn(arg, idx))
+					return 1;
+			}
+			continue;
+		}
+
+		stack[top++] = nd->right;
+		stack[top++] = nd->left;
+	}
+
+	return 0;
+}
+
+/* Range queries for a packet of up to QUERY_PACKET nearby points. The
+ * queries descend together with their coordinates transposed, so every
+ * box and leaf point is loaded once and compared against the whole packet
+ * in fixed-length loops the compiler turns into SIMD. Each stack entry
+ * carries the mask of queries whose eps-ball may reach the node. Sums run
+ * in the same order as dist2(), so results match single queries exactly.
+ * Packets of more than PACKET_MAX_DIMS dimensions are queried one by one.
+ *
+ * Below PACKET_MIN_DIMS the leaf scans dominate, which packets do not
+ * shorten, and cutting off a count at min_pts saves more than sharing the
+ * traversal; callers then query one by one.
+ */
+#define PACKET_MIN_DIMS 4
+#define PACKET_MAX_DIMS 16
+
+typedef struct {
+	packet_fn_t fn;
+	void *arg;
+	int slot;
+} slot_arg_t;
+
+static int slot_visit(void *arg, int idx)
+{
+	slot_arg_t *s = (slot_arg_t *)arg;
+	return s->fn(s->arg, s->slot, idx);
+}
+
+/* Bit q set if d2[q] is within eps */
+static inline unsigned int packet_within(const double *d2, double eps,
+					 double eps2)
+{
+	double inner = eps2 * (1.0 - 4 * DBL_EPSILON);
+	double outer = eps2 * (1.0 + 4 * DBL_EPSILON);
+	unsigned int in = 0, near = 0;
+
+	for (int q = 0; q < QUERY_PACKET; q++) {
+		in |= (unsigned int)(d2[q] < inner) << q;
+		near |= (unsigned int)(d2[q] <= outer) << q;
+	}
+	for (unsigned int m = near & ~in; m; m &= m - 1) {
+		int q = __builtin_ctz(m);
+		in |= (unsigned int)(sqrt(d2[q]) <= eps) << q;
+	}
+	return in;
+}
+
+static void kdtree_visit_packet(const kdtree_t *tree,
+				const double *const *query, int count,
+				double eps, packet_fn_t fn, void *arg)
+{
+	int dims = tree->dimensions;
+
+	if (dims > PACKET_MAX_DIMS) {
+		for (int q = 0; q < count; q++) {
+			slot_arg_t s = { fn, arg, q };
+			kdtree_visit(tree, query[q], eps, slot_visit, &s);
+		}
+		return;
+	}
+
+	/* Unused slots repeat the first query and are masked off */
+	double qs[PACKET_MAX_DIMS][QUERY_PACKET];
+	for (int d = 0; d < dims; d++) {
+		for (int q = 0; q < QUERY_PACKET; q++) {
+			qs[d][q] = query[q < count ? q : 0][d];
+		}
+	}
+
+	double eps2 = eps * eps;
+	int stack[KDTREE_MAX_DEPTH];
+	unsigned int masks[KDTREE_MAX_DEPTH];
+	unsigned int live = (1u << count) - 1;
+	int top = 0;
+
+	stack[top] = 0;
+	masks[top++] = live;
+	while (top > 0) {
+		top--;
+		int node = stack[top];
+		unsigned int mask = masks[top] & live;
+		if (!mask)
+			continue;
+
+		const double *min = tree->bounds + (size_t)node * 2 * dims;
+		const double *max = min + dims;
+		double d2[QUERY_PACKET] = { 0 };
+		for (int d = 0; d < dims; d++) {
+			for (int q = 0; q < QUERY_PACKET; q++) {
+				double below = min[d] - qs[d][q];
+				double above = qs[d][q] - max[d];
+				below = below > 0.0 ? below : 0.0;
+				above = above > 0.0 ? above : 0.0;
+				d2[q] += (below + above) * (below + above);
+			}
+		}
+		mask &= packet_within(d2, eps, eps2);
+		if (!mask)
+			continue;
+
+		const kdtree_node_t *nd = &tree->nodes[node];
+		if (nd->left >= 0) {
+			stack[top] = nd->right;
+			masks[top++] = mask;
+			stack[top] = nd->left;
+			masks[top++] = mask;
+			continue;
+		}
+
+		for (int i = nd->lo; i < nd->hi && mask; i++) {
+			int idx = tree->perm[i];
+			const double *p = tree->coords + (size_t)idx * dims;
+			for (int q = 0; q < QUERY_PACKET; q++) {
+				d2[q] = 0.0;
+			}
+			for (int d = 0; d < dims; d++) {
+				for (int q = 0; q < QUERY_PACKET; q++) {
+					double diff = qs[d][q] - p[d];
+					d2[q] += diff * diff;
+				}
+			}
+
+			unsigned int hit = mask & packet_within(d2, eps, eps2);
+			for (; hit; hit &= hit - 1) {
+				int q = __builtin_ctz(hit);
+				if (fn(arg, q, idx)) {
+					mask &= ~(1u << q);
+					live &= ~(1u << q);
+				}
+			}
+		}
+	}
+}
+
+/* Claimed subtrees
+ *
+ * During expansion a query only acts on neighbors that no cluster has
+ * claimed yet, so subtrees whose points are all claimed can be skipped.
+ * Leaves count their unclaimed points and drop by one per claim. An
+ * internal node is marked closed, count 0, by the first query that finds
+ * both its children closed, so closing costs O(1) per claim and spreads
+ * up the tree as queries pass. Claims are never undone within a run.
+ */
+typedef struct {
+	int *count; /* Per node: unclaimed points, or nonzero if unknown */
+	int *leaf; /* Per point: the leaf holding it */
+	scratch_t *scratch;
+} kdtree_open_t;
+
+static void kdtree_open_free(kdtree_open_t *open)
+{
+	scratch_put(open->scratch, open->count);
+	scratch_put(open->scratch, open->leaf);
+}
+
+/* Every point starts unclaimed. Returns 0 if out of memory. */
+static int kdtree_open_init(kdtree_open_t *open, const kdtree_t *tree,
+			    scratch_t *scratch)
+{
+	open->scratch = scratch;
+	open->count = (int *)scratch_get(scratch, SCRATCH_TREE_OPEN,
+					 tree->num_nodes * sizeof(int));
+	open->leaf = (int *)scratch_get(scratch, SCRATCH_TREE_LEAF,
+					tree->num_points * sizeof(int));
+	if (!open->count || !open->leaf) {
+		kdtree_open_free(open);
+		return 0;
+	}
+
+	for (int node = 0; node < tree->num_nodes; node++) {
+		const kdtree_node_t *nd = &tree->nodes[node];
+		open->count[node] = nd->hi - nd->lo;
+		for (int i = nd->lo; nd->left < 0 && i < nd->hi; i++) {
+			open->leaf[tree->perm[i]] = node;
+		}
+	}
+	return 1;
+}
+
+/* Record that point idx was claimed; atomic during parallel expansion */
+static void kdtree_open_close(kdtree_open_t *open, int idx, int atomic)
+{
+	int *count = &open->count[open->leaf[idx]];
+	if (atomic)
+		__atomic_fetch_sub(count, 1, __ATOMIC_RELAXED);
+	else
+		(*count)--;
+}
+
+/* kdtree_visit() skipping closed subtrees */
+static int kdtree_visit_open(const kdtree_t *tree, kdtree_open_t *open,
+			     const double *query, double eps, visit_fn_t fn,
+			     void *arg)
+{
+	int dims = tree->dimensions;
+	double eps2 = eps * eps;
+	int *count = open->count;
+	int stack[KDTREE_MAX_DEPTH];
+	int top = 0;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		if (!__atomic_load_n(&count[node], __ATOMIC_RELAXED))
+			continue;
+
+		const kdtree_node_t *nd = &tree->nodes[node];
+		if (nd->left >= 0 &&
+		    !__atomic_load_n(&count[nd->left], __ATOMIC_RELAXED) &&
+		    !__atomic_load_n(&count[nd->right], __ATOMIC_RELAXED)) {
+			__atomic_store_n(&count[node], 0, __ATOMIC_RELAXED);
+			continue;
+		}
+		if (!dist2_within(kdtree_min_dist2(tree, node, query), eps,
+				  eps2))
+			continue;
+
+		if (nd->left < 0) {
+			for (int i = nd->lo; i < nd->hi; i++) {
+				int idx = tree->perm[i];
+				double d2 = dist2(query,
+						  tree->coords +
+							  (size_t)idx * dims,
+						  dims);
+				if (dist2_within(d2, eps, eps2) &&
+				    fn(arg, idx))
+					return 1;
+			}
+			continue;
+		}
+
+		stack[top++] = nd->right;
+		stack[top++] = nd->left;
+	}
+
+	return 0;
+}
+
+/* Insert a distance into a bounded max-heap holding the k smallest seen */
+static void knn_heap_push(double *heap, int *size, int k, double dist)
+{
+	int i;
+
+	if (*size < k) {
+		i = (*size)++;
+		heap[i] = dist;
+		while (i > 0) {
+			int parent = (i - 1) / 2;
+			if (heap[parent] >= heap[i])
+				break;
+			double temp = heap[parent];
+			heap[parent] = heap[i];
+			heap[i] = temp;
+			i = parent;
+		}
+		return;
+	}
+
+	if (dist >= heap[0])
+		return;
+
+	/* Replace the current maximum and sift down */
+	heap[0] = dist;
+	i = 0;
+	for (;;) {
+		int left = 2 * i + 1;
+		int right = left + 1;
+		int largest = i;
+		if (left < k && heap[left] > heap[largest])
+			largest = left;
+		if (right < k && heap[right] > heap[largest])
+			largest = right;
+		if (largest == i)
+			break;
+		double temp = heap[largest];
+		heap[largest] = heap[i];
+		heap[i] = temp;
+		i = largest;
+	}
+}
+
+/* k-nearest-neighbor search, skipping the point `exclude` */
+static void kdtree_knn_node(const kdtree_t *tree, int node,
+			    const double *query, int exclude, double *heap,
+			    int *size, int k)
+{
+	const kdtree_node_t *nd = &tree->nodes[node];
+	int dims = tree->dimensions;
+
+	if (nd->left < 0) {
+		for (int i = nd->lo; i < nd->hi; i++) {
+			int idx = tree->perm[i];
+			if (idx == exclude)
+				continue;
+			double d2 = dist2(query,
+					  tree->coords + (size_t)idx * dims,
+					  dims);
+			knn_heap_push(heap, size, k, sqrt(d2));
+		}
+		return;
+	}
+
+	/* Descend into the nearer child first; the other one only helps
+	 * while the heap is not full or its box is within the k-th distance */
+	double dl = kdtree_min_dist2(tree, nd->left, query);
+	double dr = kdtree_min_dist2(tree, nd->right, query);
+	int first = dl <= dr ? nd->left : nd->right;
+	int second = dl <= dr ? nd->right : nd->left;
+	double d_first = dl <= dr ? dl : dr;
+	double d_second = dl <= dr ? dr : dl;
+
+	if (*size < k || sqrt(d_first) <= heap[0])
+		kdtree_knn_node(tree, first, query, exclude, heap, size, k);
+	if (*size < k || sqrt(d_second) <= heap[0])
+		kdtree_knn_node(tree, second, query, exclude, heap, size, k);
+}
+
+/* Distance from a point to its k-th nearest neighbor (excluding itself).
+ * heap: scratch array of at least k doubles; on return it holds the k
+ * nearest distances as a max-heap.
+ * Requires k < number of points in the tree.
+ */
+static double kdtree_knn_distance(const kdtree_t *tree, int query_idx, int k,
+				  double *heap)
+{
+	int size = 0;
+
+	kdtree_knn_node(tree, 0,
+			tree->coords + (size_t)query_idx * tree->dimensions,
+			query_idx, heap, &size, k);
+
+	return size == k ? heap[0] : -1.0;
+}
+
+/* Input statistics
+ *
+ * One parallel pass over the input checks every coordinate, copies point
+ * structs to a row-major array if asked, and collects the minima, maxima
+ * and sums of the leading stat_dims dimensions. Clustering takes its
+ * validation, packing and the box of the space-filling curve from a
+ * single read of the data, normalization its statistics. Statistics are
+ * accumulated per fixed-size chunk of points and combined in chunk order,
+ * so the result does not depend on the number of threads.
+ */
+#define STATS_CHUNK 4096
+
+typedef struct {
+	const cdbscan_point_t *points; /* Input rows, or NULL for coords */
+	const double *coords;
+	double *packed; /* Receives a copy of the rows if not NULL */
+	int num_points;
+	int dims;
+	int stat_dims; /* Leading dimensions with statistics */
+	int check; /* Validate every point */
+	int invalid; /* Set by a chunk with an invalid point */
+	const double *center; /* Sums are of squares about it if not NULL */
+	double *low; /* Per chunk: stat_dims minima, or NULL */
+	double *high; /* Per chunk: stat_dims maxima, or NULL */
+	double *sum; /* Per chunk: stat_dims sums, or NULL */
+} stats_job_t;
+
+static void stats_chunk_task(void *arg, int begin, int end, int worker)
+{
+	stats_job_t *job = (stats_job_t *)arg;
+	int dims = job->dims, stat_dims = job->stat_dims;
+
+	for (int c = begin; c < end; c++) {
+		size_t at = (size_t)c * stat_dims;
+		double *low = job->low ? job->low + at : NULL;
+		double *high = job->high ? job->high + at : NULL;
+		double *sum = job->sum ? job->sum + at : NULL;
+		int first = c * STATS_CHUNK;
+		int last = first + STATS_CHUNK;
+		if (last > job->num_points)
+			last = job->num_points;
+
+		for (int d = 0; d < stat_dims; d++) {
+			if (low)
+				low[d] = DBL_MAX;
+			if (high)
+				high[d] = -DBL_MAX;
+			if (sum)
+				sum[d] = 0.0;
+		}
+
+		int invalid = 0;
+		for (int i = first; i < last; i++) {
+			const double *p =
+				job->points ? job->points[i].coords :
+					      job->coords + (size_t)i * dims;
+			if (job->points && job->check &&
+			    (!p || job->points[i].dimensions != dims)) {
+				invalid = 1;
+				continue;
+			}
+			if (job->check) {
+				for (int d = 0; d < dims; d++) {
+					invalid |= !isfinite(p[d]);
+				}
+			}
+			if (job->packed)
+				memcpy(job->packed + (size_t)i * dims, p,
+				       dims * sizeof(double));
+
+			for (int d = 0; d < stat_dims; d++) {
+				if (low && p[d] < low[d])
+					low[d] = p[d];
+				if (high && p[d] > high[d])
+					high[d] = p[d];
+				if (sum && job->center) {
+					double diff = p[d] - job->center[d];
+					sum[d] += diff * diff;
+				} else if (sum) {
+					sum[d] += p[d];
+				}
+			}
+		}
+		if (invalid)
+			__atomic_store_n(&job->invalid, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/* Run job over the input and combine its chunks into low, high and sum,
+ * stat_dims values each or NULL to skip. Chunk statistics come from
+ * scratch. Returns 1 if the input is valid, 0 if not, -1 if out of
+ * memory. */
+static int stats_pass(stats_job_t *job, thread_pool_t *pool,
+		      scratch_t *scratch, double *low, double *high,
+		      double *sum)
+{
+	int stat_dims = job->stat_dims;
+	int num_chunks = (job->num_points + STATS_CHUNK - 1) / STATS_CHUNK;
+	size_t size = (size_t)num_chunks * stat_dims;
+	double *partial = NULL;
+	if (size) {
+		partial = (double *)scratch_get(scratch, SCRATCH_STATS,
+						3 * size * sizeof(double));
+		if (!partial)
+			return -1;
+	}
+	job->low = low ? partial : NULL;
+	job->high = high ? partial + size : NULL;
+	job->sum = sum ? partial + 2 * size : NULL;
+	job->invalid = 0;
+
+	/* Under first touch, each worker writes the rows it will query */
+	if (job->packed && pool &&
+	    (pool->numa_flags & CDBSCAN_NUMA_FIRST_TOUCH))
+		pool_parallel_for_static(pool, num_chunks, stats_chunk_task,
+					 job);
+	else
+		pool_parallel_for(pool, num_chunks, 1, stats_chunk_task, job);
+
+	for (int d = 0; d < stat_dims; d++) {
+		if (low)
+			low[d] = DBL_MAX;
+		if (high)
+			high[d] = -DBL_MAX;
+		if (sum)
+			sum[d] = 0.0;
+		for (int c = 0; c < num_chunks; c++) {
+			size_t at = (size_t)c * stat_dims + d;
+			if (low && job->low[at] < low[d])
+				low[d] = job->low[at];
+			if (high && job->high[at] > high[d])
+				high[d] = job->high[at];
+			if (sum)
+				sum[d] += job->sum[at];
+		}
+	}
+	scratch_put(scratch, partial);
+	return !job->invalid;
+}
+
+/* Data normalization functions */
+typedef struct {
+	cdbscan_point_t *points;
+	int dims;
+	const double *offset; /* Subtracted from each coordinate */
+	const double *scale; /* Divides each coordinate, 0 maps to 0.0 */
+} normalize_job_t;
+
+static void normalize_apply_task(void *arg, int begin, int end, int worker)
+{
+	normalize_job_t *job = (normalize_job_t *)arg;
+
+	for (int i = begin; i < end; i++) {
+		double *p = job->points[i].coords;
+		for (int d = 0; d < job->dims; d++) {
+			if (job->scale[d] > 0) {
+				p[d] = (p[d] - job->offset[d]) / job->scale[d];
+			} else {
+				p[d] = 0.0;
+			}
+		}
+	}
+}
+
+void cdbscan_normalize_minmax_ctx(cdbscan_context_t *ctx,
+				  cdbscan_point_t *points, int num_points)
+{
+	if (!points || num_points <= 0)
+		return;
+
+	int dims = points[0].dimensions;
+	double *min_vals = (double *)calloc(dims, sizeof(double));
+	double *range = (double *)calloc(dims, sizeof(double));
+	if (!min_vals || !range) {
+		free(min_vals);
+		free(range);
+		return;
+	}
+
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	thread_pool_t *pool = env.pool;
+
+	/* Find min/max for each dimension */
+	stats_job_t stats = { .points = points,
+			      .num_points = num_points,
+			      .dims = dims,
+			      .stat_dims = dims };
+	if (stats_pass(&stats, pool, env.scratch, min_vals, range, NULL) >=
+	    0) {
+		for (int d = 0; d < dims; d++) {
+			range[d] -= min_vals[d];
+		}
+
+		/* Normalize to [0, 1] */
+		normalize_job_t job = { points, dims, min_vals, range };
+		pool_parallel_for(pool, num_points, 0, normalize_apply_task,
+				  &job);
+	}
+	call_end(&env);
+
+	free(min_vals);
+	free(range);
+}
+
+void cdbscan_normalize_minmax(cdbscan_point_t *points, int num_points)
+{
+	cdbscan_normalize_minmax_ctx(NULL, points, num_points);
+}
+
+void cdbscan_normalize_zscore_ctx(cdbscan_context_t *ctx,
+				  cdbscan_point_t *points, int num_points)
+{
+	if (!points || num_points <= 0)
+		return;
+
+	int dims = points[0].dimensions;
+	double *means = (double *)calloc(dims, sizeof(double));
+	double *stdevs = (double *)calloc(dims, sizeof(double));
+	if (!means || !stdevs) {
+		free(means);
+		free(stdevs);
+		return;
+	}
+
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	thread_pool_t *pool = env.pool;
+
+	/* Calculate means, then standard deviations */
+	stats_job_t stats = { .points = points,
+			      .num_points = num_points,
+			      .dims = dims,
+			      .stat_dims = dims };
+	int ok = stats_pass(&stats, pool, env.scratch, NULL, NULL, means) >= 0;
+	for (int d = 0; ok && d < dims; d++) {
+		means[d] /= num_points;
+	}
+	stats.center = means;
+	ok = ok && stats_pass(&stats, pool, env.scratch, NULL, NULL,
+			      stdevs) >= 0;
+
+	/* Normalize using z-score */
+	if (ok) {
+		for (int d = 0; d < dims; d++) {
+			stdevs[d] = sqrt(stdevs[d] / num_points);
+		}
+		normalize_job_t job = { points, dims, means, stdevs };
+		pool_parallel_for(pool, num_points, 0, normalize_apply_task,
+				  &job);
+	}
+	call_end(&env);
+
+	free(means);
+	free(stdevs);
+}
+
+void cdbscan_normalize_zscore(cdbscan_point_t *points, int num_points)
+{
+	cdbscan_normalize_zscore_ctx(NULL, points, num_points);
+}
+
+/* Knee of an ascending k-distance curve (Kneedle, offline form).
+ * Both axes are scaled to [0, 1]; for an increasing convex curve the knee
+ * is the point furthest below the chord, i.e. the maximum of x - y.
+ * Returns -1 when the curve has no knee (flat or not convex).
+ */
+static int kdist_find_knee(const double *sorted, int count)
+{
+	if (count < 3)
+		return -1;
+
+	double y_min = sorted[0];
+	double y_range = sorted[count - 1] - y_min;
+	if (y_range <= 0)
+		return -1;
+
+	int knee = -1;
+	double best = 0.0;
+	for (int i = 0; i < count; i++) {
+		double x = (double)i / (count - 1);
+		double y = (sorted[i] - y_min) / y_range;
+		if (x - y > best) {
+			best = x - y;
+			knee = i;
+		}
+	}
+	return knee;
+}
+
+/* Pick eps from an ascending k-distance curve: the knee when there is one,
+ * otherwise the 95th percentile */
+static double kdist_suggest_eps(const double *sorted, int count)
+{
+	int elbow_idx = kdist_find_knee(sorted, count);
+	if (elbow_idx < 0)
+		elbow_idx = (int)(0.95 * count);
+	if (elbow_idx >= count)
+		elbow_idx = count - 1;
+	return sorted[elbow_idx];
+}
+
+/* Parallel kNN sweep: k-th distance per point, or all k distances */
+typedef struct {
+	const kdtree_t *tree;
+	int k;
+	int all_k; /* Store every distance 1..k, curve-major */
+	double *heaps; /* k doubles per worker */
+	double *out;
+} knn_job_t;
+
+static void knn_sweep_task(void *arg, int begin, int end, int worker)
+{
+	knn_job_t *job = (knn_job_t *)arg;
+	double *heap = job->heaps + (size_t)worker * job->k;
+	int num_points = job->tree->num_points;
+
+	for (int i = begin; i < end; i++) {
+		double kdist = kdtree_knn_distance(job->tree, i, job->k, heap);
+		if (!job->all_k) {
+			job->out[i] = kdist;
+			continue;
+		}
+		qsort(heap, job->k, sizeof(double), compare_doubles);
+		for (int k = 0; k < job->k; k++) {
+			job->out[(size_t)k * num_points + i] = heap[k];
+		}
+	}
+}
+
+/* Pack points, index them and run the kNN sweep into out */
+static int knn_sweep(const cdbscan_point_t *points, int num_points, int k,
+		     int all_k, double *out, thread_pool_t *pool)
+{
+	int dims = points[0].dimensions;
+	double *coords = pack_points(points, num_points, dims, pool, NULL);
+	kdtree_t *tree = coords ? kdtree_build(coords, NULL, num_points, dims,
+					       pool, NULL) :
+				  NULL;
+	double *heaps = (double *)malloc((size_t)pool_num_workers(pool) * k *
+					 sizeof(double));
+
+	if (!coords || !tree || !heaps) {
+		free(coords);
+		kdtree_free(tree);
+		free(heaps);
+		return 0;
+	}
+
+	knn_job_t job = { tree, k, all_k, heaps, out };
+	pool_parallel_for(pool, num_points, 0, knn_sweep_task, &job);
+
+	free(coords);
+	kdtree_free(tree);
+	free(heaps);
+	return 1;
+}
+
+/* Parameter estimation - k-dist graph for eps selection */
+cdbscan_kdist_result_t *cdbscan_estimate_eps_ctx(cdbscan_context_t *ctx,
+						 const cdbscan_point_t *points,
+						 int num_points, int k)
+{
+	if (!points || num_points <= 0 || k <= 0 || k >= num_points) {
+		return NULL;
+	}
+
+	cdbscan_kdist_result_t *result = (cdbscan_kdist_result_t *)malloc(
+		sizeof(cdbscan_kdist_result_t));
+	if (!result)
+		return NULL;
+
+	result->distances = (double *)malloc(num_points * sizeof(double));
+	if (!result->distances) {
+		free(result);
+		return NULL;
+	}
+
+	result->k = k;
+
+	/* For each point, find k-th nearest neighbor distance */
+	double *temp_dists = (double *)malloc(num_points * sizeof(double));
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	int ok = temp_dists && knn_sweep(points, num_points, k, 0,
+					 result->distances, env.pool);
+	call_end(&env);
+	if (!ok) {
+		free(temp_dists);
+		cdbscan_free_kdist_result(result);
+		return NULL;
+	}
+
+	/* Sort k-distances in ascending order for graph */
+	memcpy(temp_dists, result->distances, num_points * sizeof(double));
+	qsort(temp_dists, num_points, sizeof(double), compare_doubles);
+
+	/* Find the "elbow" of the sorted curve */
+	result->suggested_eps = kdist_suggest_eps(temp_dists, num_points);
+
+	free(temp_dists);
+
+	return result;
+}
+
+cdbscan_kdist_result_t *cdbscan_estimate_eps(const cdbscan_point_t *points,
+					     int num_points, int k)
+{
+	return cdbscan_estimate_eps_ctx(NULL, points, num_points, k);
+}
+
+void cdbscan_free_kdist_result(cdbscan_kdist_result_t *result)
+{
+	if (result) {
+		free(result->distances);
+		free(result);
+	}
+}
+
+/* k-distance curves for every k in 1..max_k from one kNN sweep */
+cdbscan_kdist_curves_t *
+cdbscan_estimate_eps_multi_ctx(cdbscan_context_t *ctx,
+			       const cdbscan_point_t *points, int num_points,
+			       int max_k)
+{
+	if (!points || num_points <= 0 || max_k <= 0 || max_k >= num_points) {
+		return NULL;
+	}
+
+	cdbscan_kdist_curves_t *curves = (cdbscan_kdist_curves_t *)calloc(
+		1, sizeof(cdbscan_kdist_curves_t));
+	if (!curves)
+		return NULL;
+
+	curves->max_k = max_k;
+	curves->num_points = num_points;
+	curves->distances =
+		(double *)malloc((size_t)max_k * num_points * sizeof(double));
+	curves->suggested_eps = (double *)malloc(max_k * sizeof(double));
+	curves->knee_index = (int *)malloc(max_k * sizeof(int));
+
+	if (!curves->distances || !curves->suggested_eps ||
+	    !curves->knee_index) {
+		cdbscan_free_kdist_curves(curves);
+		return NULL;
+	}
+
+	/* One max_k-NN query per point yields the 1st..max_k-th distances */
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	int ok = knn_sweep(points, num_points, max_k, 1, curves->distances,
+			   env.pool);
+	call_end(&env);
+	if (!ok) {
+		cdbscan_free_kdist_curves(curves);
+		return NULL;
+	}
+
+	for (int k = 0; k < max_k; k++) {
+		double *curve = curves->distances + (size_t)k * num_points;
+		qsort(curve, num_points, sizeof(double), compare_doubles);
+
+		curves->knee_index[k] = kdist_find_knee(curve, num_points);
+		curves->suggested_eps[k] = kdist_suggest_eps(curve, num_points);
+	}
+
+	return curves;
+}
+
+cdbscan_kdist_curves_t *
+cdbscan_estimate_eps_multi(const cdbscan_point_t *points, int num_points,
+			   int max_k)
+{
+	return cdbscan_estimate_eps_multi_ctx(NULL, points, num_points, max_k);
+}
+
+void cdbscan_free_kdist_curves(cdbscan_kdist_curves_t *curves)
+{
+	if (curves) {
+		free(curves->distances);
+		free(curves->suggested_eps);
+		free(curves->knee_index);
+		free(curves);
+	}
+}
+
+/* Percentile bootstrap confidence interval for kdist_suggest_eps().
+ * sorted: ascending k-distances of the m sampled points
+ * resample: scratch array of m doubles, boot: scratch of num_boot doubles
+ */
+static void kdist_bootstrap_ci(const double *sorted, int m, int num_boot,
+			       double confidence, uint64_t *rng,
+			       double *resample, double *boot, double *ci_low,
+			       double *ci_high)
+{
+	for (int b = 0; b < num_boot; b++) {
+		for (int i = 0; i < m; i++) {
+			resample[i] = sorted[rng_next(rng) % (uint64_t)m];
+		}
+		qsort(resample, m, sizeof(double), compare_doubles);
+		boot[b] = kdist_suggest_eps(resample, m);
+	}
+	qsort(boot, num_boot, sizeof(double), compare_doubles);
+
+	double alpha = 1.0 - confidence;
+	int lo = (int)(0.5 * alpha * num_boot);
+	int hi = (int)((1.0 - 0.5 * alpha) * num_boot);
+	if (hi >= num_boot)
+		hi = num_boot - 1;
+	*ci_low = boot[lo];
+	*ci_high = boot[hi];
+}
+
+typedef struct {
+	const kdtree_t *tree;
+	const int *order; /* Sampled points, from first on */
+	double *samples; /* Their k-distances, from first on */
+	double *heaps; /* k doubles per worker */
+	int first;
+	int k;
+} sample_job_t;
+
+static void sample_knn_task(void *arg, int begin, int end, int worker)
+{
+	sample_job_t *job = (sample_job_t *)arg;
+	double *heap = job->heaps + (size_t)worker * job->k;
+
+	for (int i = job->first + begin; i < job->first + end; i++) {
+		job->samples[i] = kdtree_knn_distance(job->tree, job->order[i],
+						      job->k, heap);
+	}
+}
+
+/* Sampled eps estimation: k-distances of m random points against a KD-tree
+ * over the full dataset, with a bootstrap interval on the suggested eps */
+cdbscan_eps_sample_result_t *
+cdbscan_estimate_eps_sampled_ctx(cdbscan_context_t *ctx,
+				 const cdbscan_point_t *points, int num_points,
+				 int k, const cdbscan_sample_opts_t *opts)
+{
+	if (!points || num_points <= 0 || k <= 0 || k >= num_points) {
+		return NULL;
+	}
+
+	/* Resolve options */
+	int num_samples = 1000;
+	int max_samples = 0;
+	int num_boot = 200;
+	double target_width = 0.0;
+	double confidence = 0.95;
+	uint64_t rng = 0;
+	if (opts) {
+		if (opts->num_samples > 0)
+			num_samples = opts->num_samples;
+		if (opts->max_samples > 0)
+			max_samples = opts->max_samples;
+		if (opts->num_bootstrap > 0)
+			num_boot = opts->num_bootstrap;
+		if (opts->target_width > 0)
+			target_width = opts->target_width;
+		if (opts->confidence > 0 && opts->confidence < 1)
+			confidence = opts->confidence;
+		rng = opts->seed;
+	}
+	if (max_samples <= 0)
+		max_samples = target_width > 0 ? 16 * num_samples : num_samples;
+	if (max_samples < num_samples)
+		max_samples = num_samples;
+	if (max_samples > num_points)
+		max_samples = num_points;
+	if (num_samples > max_samples)
+		num_samples = max_samples;
+
+	cdbscan_eps_sample_result_t *result =
+		(cdbscan_eps_sample_result_t *)calloc(
+			1, sizeof(cdbscan_eps_sample_result_t));
+	int dims = points[0].dimensions;
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	thread_pool_t *pool = env.pool;
+	double *coords = pack_points(points, num_points, dims, pool, NULL);
+	kdtree_t *tree = coords ? kdtree_build(coords, NULL, num_points, dims,
+					       pool, NULL) :
+				  NULL;
+	int *order = (int *)malloc(num_points * sizeof(int));
+	double *heap = (double *)malloc((size_t)pool_num_workers(pool) * k *
+					sizeof(double));
+	double *samples = (double *)malloc(max_samples * sizeof(double));
+	double *resample = (double *)malloc(max_samples * sizeof(double));
+	double *boot = (double *)malloc(num_boot * sizeof(double));
+	if (result)
+		result->distances =
+			(double *)malloc(max_samples * sizeof(double));
+
+	if (!result || !result->distances || !tree || !order || !heap ||
+	    !samples || !resample || !boot) {
+		cdbscan_free_eps_sample_result(result);
+		kdtree_free(tree);
+		free(coords);
+		free(order);
+		free(heap);
+		free(samples);
+		free(resample);
+		free(boot);
+		call_end(&env);
+		return NULL;
+	}
+
+	for (int i = 0; i < num_points; i++) {
+		order[i] = i;
+	}
+	sample_job_t job = { tree, order, samples, heap, 0, k };
+
+	/* Draw points without replacement (partial Fisher-Yates), growing the
+	 * sample until the interval is narrow enough or max_samples is hit */
+	int drawn = 0;
+	int m = num_samples;
+	for (;;) {
+		for (int i = drawn; i < m; i++) {
+			int j = i + (int)(rng_next(&rng) %
+					  (uint64_t)(num_points - i));
+			int temp = order[i];
+			order[i] = order[j];
+			order[j] = temp;
+		}
+		job.first = drawn;
+		pool_parallel_for(pool, m - drawn, 0, sample_knn_task, &job);
+		drawn = m;
+
+		memcpy(result->distances, samples, m * sizeof(double));
+		qsort(result->distances, m, sizeof(double), compare_doubles);
+		kdist_bootstrap_ci(result->distances, m, num_boot, confidence,
+				   &rng, resample, boot, &result->ci_low,
+				   &result->ci_high);
+
+		if (target_width <= 0 ||
+		    result->ci_high - result->ci_low <= target_width ||
+		    m >= max_samples)
+			break;
+
+		m = (2 * m < max_samples) ? 2 * m : max_samples;
+	}
+
+	result->num_samples = m;
+	result->k = k;
+	result->suggested_eps = kdist_suggest_eps(result->distances, m);
+	call_end(&env);
+
+	kdtree_free(tree);
+	free(coords);
+	free(order);
+	free(heap);
+	free(samples);
+	free(resample);
+	free(boot);
+
+	return result;
+}
+
+cdbscan_eps_sample_result_t *
+cdbscan_estimate_eps_sampled(const cdbscan_point_t *points, int num_points,
+			     int k, const cdbscan_sample_opts_t *opts)
+{
+	return cdbscan_estimate_eps_sampled_ctx(NULL, points, num_points, k,
+						opts);
+}
+
+void cdbscan_free_eps_sample_result(cdbscan_eps_sample_result_t *result)
+{
+	if (result) {
+		free(result->distances);
+		free(result);
+	}
+}
+
+/* Validation functions */
+int cdbscan_validate_params(const cdbscan_params_t *params)
+{
+	if (!params)
+		return 0;
+	if (params->eps <= 0)
+		return 0;
+	if (params->min_pts <= 0)
+		return 0;
+	if (params->num_threads < 0)
+		return 0;
+
+	if (params->dist_type == CDBSCAN_DIST_MINKOWSKI &&
+	    params->minkowski_p <= 0) {
+		return 0;
+	}
+
+	if (params->dist_type == CDBSCAN_DIST_CUSTOM && !params->custom_dist) {
+		return 0;
+	}
+
+	return 1;
+}
+
+int cdbscan_validate_data(const cdbscan_point_t *points, int num_points)
+{
+	if (!points || num_points <= 0)
+		return 0;
+
+	int dims = points[0].dimensions;
+	if (dims <= 0)
+		return 0;
+
+	for (int i = 0; i < num_points; i++) {
+		if (!points[i].coords)
+			return 0;
+		if (points[i].dimensions != dims)
+			return 0;
+
+		/* Check for NaN or Inf */
+		for (int d = 0; d < dims; d++) {
+			if (isnan(points[i].coords[d]) ||
+			    isinf(points[i].coords[d])) {
+				return 0;
+			}
+		}
+	}
+
+	return 1;
+}
+
+/* Region query implementations */
+int cdbscan_region_query(const cdbscan_point_t *points, int num_points,
+			 int point_idx, double eps, int *neighbors)
+{
+	if (!points || !neighbors || point_idx < 0 || point_idx >= num_points) {
+		return 0;
+	}
+
+	int neighbor_count = 0;
+	const cdbscan_point_t *query_point = &points[point_idx];
+
+	for (int i = 0; i < num_points; i++) {
+		double dist = cdbscan_euclidean_distance(
+			query_point->coords, points[i].coords,
+			query_point->dimensions);
+		if (dist >= 0 && dist <= eps) {
+			neighbors[neighbor_count++] = i;
+		}
+	}
+
+	return neighbor_count;
+}
+
+int cdbscan_region_query_custom(const cdbscan_point_t *points, int num_points,
+				int point_idx, const cdbscan_params_t *params,
+				int *neighbors)
+{
+	if (!points || !neighbors || !params || point_idx < 0 ||
+	    point_idx >= num_points) {
+		return 0;
+	}
+
+	int neighbor_count = 0;
+	const cdbscan_point_t *query_point = &points[point_idx];
+
+	for (int i = 0; i < num_points; i++) {
+		double dist = calculate_distance(query_point->coords,
+						 points[i].coords,
+						 query_point->dimensions,
+						 params);
+		if (dist >= 0 && dist <= params->eps) {
+			neighbors[neighbor_count++] = i;
+		}
+	}
+
+	return neighbor_count;
+}
+
+/* Neighborhood source used by the clustering engine */
+typedef struct nbr_index {
+	/* Call fn for every point within eps of point idx (idx included);
+	 * returns 1 if fn stopped the query early */
+	int (*visit)(const struct nbr_index *index, int idx, visit_fn_t fn,
+		     void *arg);
+	/* Optional: rough neighbor count of every point, for scheduling */
+	void (*estimate)(const struct nbr_index *index, float *est,
+			 thread_pool_t *pool);
+	/* Optional: visit for up to QUERY_PACKET points at once, with fn
+	 * told the slot in idx of the query. Only set when consecutive
+	 * points are close, so that packets share most of their nodes. */
+	void (*visit_packet)(const struct nbr_index *index, const int *idx,
+			     int count, packet_fn_t fn, void *arg);
+	/* Optional: visit that may skip neighbors already claimed by a
+	 * cluster, given that close() is called for every claim */
+	int (*visit_open)(const struct nbr_index *index, int idx,
+			  visit_fn_t fn, void *arg);
+	void (*close)(const struct nbr_index *index, int idx, int atomic);
+	void *open; /* Claim state for visit_open, shared by replicas */
+	/* Optional: nonzero for points known to have fewer than
+	 * params->min_pts neighbors, which are not queried for core */
+	const unsigned char *sparse;
+	const void *impl; /* Index structure, e.g. a kdtree_t */
+	thread_pool_t *pool; /* Workers that query it, for replicas */
+	const double *coords; /* Row-major coordinates */
+	int num_points;
+	int dims;
+	const cdbscan_params_t *params;
+} nbr_index_t;
+
+static int brute_index_visit(const nbr_index_t *index, int idx,
+			     visit_fn_t fn, void *arg)
+{
+	int dims = index->dims;
+	const double *query = index->coords + (size_t)idx * dims;
+
+	for (int i = 0; i < index->num_points; i++) {
+		const double *p = index->coords + (size_t)i * dims;
+		double dist = calculate_distance(query, p, dims, index->params);
+		if (dist >= 0 && dist <= index->params->eps && fn(arg, i))
+			return 1;
+	}
+	return 0;
+}
+
+static int kdtree_index_visit(const nbr_index_t *index, int idx,
+			      visit_fn_t fn, void *arg)
+{
+	return kdtree_visit((const kdtree_t *)index->impl,
+			    index->coords + (size_t)idx * index->dims,
+			    index->params->eps, fn, arg);
+}
+
+static void kdtree_index_visit_packet(const nbr_index_t *index,
+				      const int *idx, int count,
+				      packet_fn_t fn, void *arg)
+{
+	const double *query[QUERY_PACKET];
+
+	for (int q = 0; q < count; q++) {
+		query[q] = index->coords + (size_t)idx[q] * index->dims;
+	}
+	kdtree_visit_packet((const kdtree_t *)index->impl, query, count,
+			    index->params->eps, fn, arg);
+}
+
+static int kdtree_index_visit_open(const nbr_index_t *index, int idx,
+				   visit_fn_t fn, void *arg)
+{
+	return kdtree_visit_open((const kdtree_t *)index->impl,
+				 (kdtree_open_t *)index->open,
+				 index->coords + (size_t)idx * index->dims,
+				 index->params->eps, fn, arg);
+}
+
+static void kdtree_index_close(const nbr_index_t *index, int idx,
+			       int atomic)
+{
+	kdtree_open_close((kdtree_open_t *)index->open, idx, atomic);
+}
+
+static void kdtree_index_estimate(const nbr_index_t *index, float *est,
+				  thread_pool_t *pool)
+{
+	kdtree_estimate_neighbors((const kdtree_t *)index->impl,
+				  index->params->eps, est, pool);
+}
+
+/* Dense adjacency matrix
+ *
+ * Without a tree, medium-sized inputs are clustered over an n x n bit
+ * matrix of the eps-neighborhoods. The matrix is built in tiles of 64 x 64
+ * points over a transposed copy of the coordinates, so that the inner
+ * loops run down contiguous memory and vectorize; other metrics call
+ * calculate_distance(), so the neighborhoods are exactly those of the
+ * brute-force path. The built-in metrics are symmetric bit for bit, so
+ * only the tiles on and above the diagonal are computed and the others are
+ * their transposes. Custom metrics get every tile. Queries then walk the set
+ * bits of a row, and expansion ANDs each row with the bitset of points no
+ * cluster has claimed yet. Calls without a memory limit build matrices of
+ * up to BITMAT_DEFAULT_BYTES only; a limit lets the plan decide.
+ */
+#define BITMAT_MAX_POINTS 65536 /* 512MB of matrix */
+#define BITMAT_DEFAULT_BYTES ((size_t)64 << 20) /* Most without a limit */
+#define BITMAT_LANES 8 /* Columns summed together in registers */
+
+typedef struct {
+	uint64_t *rows; /* Row i: bit j set if j is within eps of i */
+	uint64_t *open; /* Bit i set while point i is unclassified or noise */
+	size_t stride; /* Words per row */
+	int num_points;
+	scratch_t *scratch; /* Source of rows and open */
+} bitmat_t;
+
+typedef struct {
+	bitmat_t *bits;
+	const double *coords;
+	const double *cols; /* Transposed, padded to whole words */
+	int mirror; /* Distances are symmetric */
+	int dims;
+	const cdbscan_params_t *params;
+} bitmat_job_t;
+
+/* Squared Euclidean or Manhattan distances from query to the 64 columns
+ * from base */
+static void bitmat_sums(const bitmat_job_t *job, const double *query,
+			int base, double *sum)
+{
+	size_t width = job->bits->stride * 64;
+	int manhattan = job->params->dist_type == CDBSCAN_DIST_MANHATTAN;
+
+	for (int g = 0; g < 64; g += BITMAT_LANES) {
+		const double *col = job->cols + base + g;
+		double acc[BITMAT_LANES] = { 0 };
+		for (int d = 0; d < job->dims; d++, col += width) {
+			double q = query[d];
+			if (manhattan) {
+				for (int k = 0; k < BITMAT_LANES; k++) {
+					acc[k] += fabs(q - col[k]);
+				}
+			} else {
+				for (int k = 0; k < BITMAT_LANES; k++) {
+					double diff = q - col[k];
+					acc[k] += diff * diff;
+				}
+			}
+		}
+		memcpy(sum + g, acc, sizeof(acc));
+	}
+}
+
+/* Bits of row i for the 64 columns from base, garbage past the last point */
+static uint64_t bitmat_word(const bitmat_job_t *job, int i, int base)
+{
+	const cdbscan_params_t *params = job->params;
+	const double *query = job->coords + (size_t)i * job->dims;
+	double eps = params->eps, eps2 = eps * eps;
+	double sum[64];
+	uint64_t word = 0;
+
+	if (!job->cols) {
+		int count = job->bits->num_points - base;
+		for (int b = 0; b < 64 && b < count; b++) {
+			const double *p =
+				job->coords + (size_t)(base + b) * job->dims;
+			double dist = calculate_distance(query, p, job->dims,
+							 params);
+			word |= (uint64_t)(dist >= 0 && dist <= eps) << b;
+		}
+		return word;
+	}
+
+	bitmat_sums(job, query, base, sum);
+	if (params->dist_type == CDBSCAN_DIST_MANHATTAN) {
+		for (int b = 0; b < 64; b++) {
+			word |= (uint64_t)(sum[b] <= eps) << b;
+		}
+		return word;
+	}
+
+	/* Same decision as dist2_within(), with sqrt only near eps */
+	double inner = eps2 * (1.0 - 4 * DBL_EPSILON);
+	double outer = eps2 * (1.0 + 4 * DBL_EPSILON);
+	uint64_t band = 0;
+	for (int b = 0; b < 64; b++) {
+		word |= (uint64_t)(sum[b] < inner) << b;
+		band |= (uint64_t)(sum[b] <= outer) << b;
+	}
+	for (band &= ~word; band; band &= band - 1) {
+		int b = __builtin_ctzll(band);
+		word |= (uint64_t)(sqrt(sum[b]) <= eps) << b;
+	}
+	return word;
+}
+
+/* Transpose a 64 x 64 bit matrix, bit j of word i being entry (i, j) */
+static void bitmat_transpose(uint64_t *m)
+{
+	uint64_t mask = 0x00000000ffffffffULL;
+
+	for (int j = 32; j; j >>= 1, mask ^= mask << j) {
+		for (int k = 0; k < 64; k = (k + j + 1) & ~j) {
+			uint64_t t = ((m[k] >> j) ^ m[k + j]) & mask;
+			m[k] ^= t << j;
+			m[k + j] ^= t;
+		}
+	}
+}
+
+/* Row block r: tiles right of the diagonal, mirrored below it */
+static void bitmat_block_task(void *arg, int begin, int end, int worker)
+{
+	const bitmat_job_t *job = (const bitmat_job_t *)arg;
+	bitmat_t *bits = job->bits;
+	int n = bits->num_points;
+	int mirror = job->mirror;
+	uint64_t tile[64];
+
+	for (int r = begin; r < end; r++) {
+		int row_end = r * 64 + 64 < n ? r * 64 + 64 : n;
+		for (size_t c = mirror ? r : 0; c < bits->stride; c++) {
+			memset(tile, 0, sizeof(tile));
+			for (int i = r * 64; i < row_end; i++) {
+				tile[i - r * 64] = bitmat_word(job, i, c * 64);
+				bits->rows[i * bits->stride + c] =
+					tile[i - r * 64];
+			}
+			if (!mirror || c == (size_t)r)
+				continue;
+
+			/* Rows of block c are full unless it is the last */
+			bitmat_transpose(tile);
+			for (int k = 0; k < 64 && c * 64 + k < (size_t)n; k++) {
+				bits->rows[(c * 64 + k) * bits->stride + r] =
+					tile[k];
+			}
+		}
+		for (int i = r * 64; i < row_end && n % 64; i++) {
+			bits->rows[i * bits->stride + bits->stride - 1] &=
+				~0ULL >> (64 - n % 64);
+		}
+	}
+}
+
+static void bitmat_free(bitmat_t *bits)
+{
+	if (!bits)
+		return;
+	scratch_free(bits->scratch, bits->rows,
+		     bits->stride * bits->num_points * sizeof(uint64_t));
+	scratch_free(bits->scratch, bits->open,
+		     bits->stride * sizeof(uint64_t));
+	scratch_free(bits->scratch, bits, sizeof(bitmat_t));
+}
+
+/* Returns NULL if num_points is too large or out of memory */
+static bitmat_t *bitmat_build(const double *coords, int num_points,
+			      int dims, const cdbscan_params_t *params,
+			      thread_pool_t *pool, scratch_t *scratch)
+{
+	if (num_points > BITMAT_MAX_POINTS)
+		return NULL;
+
+	bitmat_t *bits = (bitmat_t *)scratch_alloc(scratch, sizeof(bitmat_t));
+	if (!bits)
+		return NULL;
+	memset(bits, 0, sizeof(bitmat_t));
+	bits->num_points = num_points;
+	bits->stride = ((size_t)num_points + 63) / 64;
+	bits->scratch = scratch;
+	bits->rows = (uint64_t *)scratch_alloc(
+		scratch, bits->stride * num_points * sizeof(uint64_t));
+	bits->open = (uint64_t *)scratch_alloc(
+		scratch, bits->stride * sizeof(uint64_t));
+
+	/* Columns are padded with zeros to whole words */
+	size_t width = bits->stride * 64;
+	int fast = params->dist_type == CDBSCAN_DIST_EUCLIDEAN ||
+		   params->dist_type == CDBSCAN_DIST_MANHATTAN;
+	size_t cols_size = fast ? width * dims * sizeof(double) : 0;
+	double *cols =
+		fast ? (double *)scratch_alloc(scratch, cols_size) : NULL;
+	if (!bits->rows || !bits->open || (fast && !cols)) {
+		scratch_free(scratch, cols, cols_size);
+		bitmat_free(bits);
+		return NULL;
+	}
+	if (cols)
+		memset(cols, 0, cols_size);
+
+	for (int i = 0; fast && i < num_points; i++) {
+		for (int d = 0; d < dims; d++) {
+			cols[d * width + i] = coords[(size_t)i * dims + d];
+		}
+	}
+	/* Blocks near the top have the most tiles, one block per task */
+	int mirror = params->dist_type != CDBSCAN_DIST_CUSTOM;
+	bitmat_job_t job = { bits, coords, cols, mirror, dims, params };
+	pool_parallel_for(pool, (int)bits->stride, 1, bitmat_block_task,
+			  &job);
+	scratch_free(scratch, cols, cols_size);
+
+	/* Every point starts unclassified */
+	memset(bits->open, 0xff, bits->stride * sizeof(uint64_t));
+	if (num_points % 64)
+		bits->open[bits->stride - 1] = ~0ULL >> (64 - num_points % 64);
+	return bits;
+}
+
+/* Call fn for the set bits of row idx, masked by open if given */
+static int bitmat_visit_row(const bitmat_t *bits, int idx,
+			    const uint64_t *open, visit_fn_t fn, void *arg)
+{
+	const uint64_t *row = bits->rows + (size_t)idx * bits->stride;
+
+	for (size_t w = 0; w < bits->stride; w++) {
+		uint64_t word = row[w];
+		if (open)
+			word &= __atomic_load_n(&open[w], __ATOMIC_RELAXED);
+		for (; word; word &= word - 1) {
+			if (fn(arg, (int)(w * 64 + __builtin_ctzll(word))))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+static int bitmat_index_visit(const nbr_index_t *index, int idx,
+			      visit_fn_t fn, void *arg)
+{
+	return bitmat_visit_row((const bitmat_t *)index->impl, idx, NULL, fn,
+				arg);
+}
+
+static int bitmat_index_visit_open(const nbr_index_t *index, int idx,
+				   visit_fn_t fn, void *arg)
+{
+	return bitmat_visit_row((const bitmat_t *)index->impl, idx,
+				(const uint64_t *)index->open, fn, arg);
+}
+
+static void bitmat_index_close(const nbr_index_t *index, int idx,
+			       int atomic)
+{
+	uint64_t *word = (uint64_t *)index->open + idx / 64;
+	uint64_t mask = ~(1ULL << (idx % 64));
+
+	if (atomic)
+		__atomic_fetch_and(word, mask, __ATOMIC_RELAXED);
+	else
+		*word &= mask;
+}
+
+typedef struct {
+	const bitmat_t *bits;
+	float *est;
+} bitmat_count_job_t;
+
+static void bitmat_count_task(void *arg, int begin, int end, int worker)
+{
+	bitmat_count_job_t *job = (bitmat_count_job_t *)arg;
+	size_t stride = job->bits->stride;
+
+	for (int i = begin; i < end; i++) {
+		const uint64_t *row = job->bits->rows + (size_t)i * stride;
+		int count = 0;
+		for (size_t w = 0; w < stride; w++) {
+			count += __builtin_popcountll(row[w]);
+		}
+		job->est[i] = (float)count;
+	}
+}
+
+/* Neighbor counts are exact: one popcount per row */
+static void bitmat_index_estimate(const nbr_index_t *index, float *est,
+				  thread_pool_t *pool)
+{
+	bitmat_count_job_t job = { (const bitmat_t *)index->impl, est };
+	pool_parallel_for(pool, index->num_points, 0, bitmat_count_task, &job);
+}
+
+/* Per-node copies of a read-only index
+ *
+ * With CDBSCAN_NUMA_REPLICATE, the first worker on every node other than
+ * worker 0's copies the coordinates (and KD-tree) itself, so the copy is
+ * placed on its node by first touch. Nodes without a copy share the
+ * original.
+ */
+typedef struct {
+	const nbr_index_t *index;
+	nbr_index_t *node_index; /* One entry per node */
+	scratch_t *scratch; /* Allocator of the copies */
+} replica_job_t;
+
+static void index_replica_task(void *arg, int begin, int end, int worker)
+{
+	replica_job_t *job = (replica_job_t *)arg;
+	const nbr_index_t *index = job->index;
+	thread_pool_t *pool = index->pool;
+	int node = pool_worker_node(pool, worker);
+
+	if (node == pool_worker_node(pool, 0))
+		return;
+	for (int w = 0; w < worker; w++) {
+		if (pool_worker_node(pool, w) == node)
+			return; /* Another worker on this node copies it */
+	}
+
+	size_t size = (size_t)index->num_points * index->dims * sizeof(double);
+	double *coords = (double *)scratch_alloc(job->scratch, size);
+	if (!coords)
+		return;
+	memcpy(coords, index->coords, size);
+
+	kdtree_t *tree = NULL;
+	if (index->impl) {
+		tree = kdtree_clone((const kdtree_t *)index->impl, coords,
+				    job->scratch);
+		if (!tree) {
+			scratch_free(job->scratch, coords, size);
+			return;
+		}
+	}
+
+	job->node_index[node].coords = coords;
+	job->node_index[node].impl = tree;
+}
+
+/* Returns one index per node, or NULL when replication is off */
+static nbr_index_t *index_replicate(const nbr_index_t *index,
+				    scratch_t *scratch)
+{
+	thread_pool_t *pool = index->pool;
+	if (!pool || !(pool->numa_flags & CDBSCAN_NUMA_REPLICATE) ||
+	    pool->num_nodes < 2)
+		return NULL;
+
+	nbr_index_t *node_index = (nbr_index_t *)scratch_alloc(
+		scratch, pool->num_nodes * sizeof(nbr_index_t));
+	if (!node_index)
+		return NULL;
+	for (int node = 0; node < pool->num_nodes; node++) {
+		node_index[node] = *index;
+	}
+
+	replica_job_t job = { index, node_index, scratch };
+	pool_parallel_for_static(pool, pool->num_workers, index_replica_task,
+				 &job);
+	return node_index;
+}
+
+static void index_replicas_free(nbr_index_t *node_index,
+				const nbr_index_t *index, scratch_t *scratch)
+{
+	if (!node_index)
+		return;
+
+	int num_nodes = index->pool->num_nodes;
+	for (int node = 0; node < num_nodes; node++) {
+		const kdtree_t *tree = (const kdtree_t *)node_index[node].impl;
+		if (node_index[node].coords == index->coords)
+			continue;
+		if (tree)
+			scratch_free(scratch, (void *)tree,
+				     kdtree_clone_size(tree));
+		scratch_free(scratch, (double *)node_index[node].coords,
+			     (size_t)index->num_points * index->dims *
+				     sizeof(double));
+	}
+	scratch_free(scratch, node_index, num_nodes * sizeof(nbr_index_t));
+}
+
+/* Clustering engine
+ *
+ * Phase 1 finds the core points with one (early-terminating) neighbor
+ * count per point, in parallel. Phase 2 walks the points in input order
+ * and expands a cluster from every unclassified core point. Only core
+ * points are queried during expansion: a non-core seed can never extend
+ * a cluster, so the labels match the classic seed-list formulation.
+ *
+ * With more than one worker a cluster grows level by level: all core
+ * points of the current frontier are queried concurrently and claim
+ * their neighbors with a compare-and-swap on the label. Which thread
+ * wins a point does not matter, every claim writes the same cluster id,
+ * so the labels are the same as a serial run.
+ */
+
+/* Smallest frontier worth handing to the pool */
+#define ENGINE_PARALLEL_FRONTIER 64
+
+typedef struct {
+	const nbr_index_t *index;
+	int num_points;
+	int min_pts;
+	int *labels;
+	unsigned char *core;
+	int *queue; /* Core points waiting to be expanded */
+	int queue_size;
+	int level; /* Queue slot of the first frontier point */
+	int start; /* Core point the current cluster grows from */
+	int cluster_id;
+	float *est; /* Estimated neighbor counts, NULL if unknown */
+	float *cost; /* Scratch for task costs, num_points entries */
+	const nbr_index_t *node_index; /* Per-node replicas, NULL if shared */
+	int keep_labels; /* Never relabel points that are already claimed */
+	const int *order; /* Points in the order clusters are seeded, or NULL
+			     for index order */
+	thread_pool_t *pool;
+	scratch_t *scratch;
+} dbscan_engine_t;
+
+/* Index copy closest to the given worker */
+static const nbr_index_t *engine_index(const dbscan_engine_t *e, int worker)
+{
+	if (!e->node_index)
+		return e->index;
+	return &e->node_index[pool_worker_node(e->pool, worker)];
+}
+
+typedef struct {
+	int count;
+	int limit;
+} count_arg_t;
+
+static int count_visit(void *arg, int idx)
+{
+	count_arg_t *c = (count_arg_t *)arg;
+	return ++c->count >= c->limit;
+}
+
+typedef struct {
+	int count[QUERY_PACKET];
+	int limit;
+} packet_count_arg_t;
+
+static int packet_count_visit(void *arg, int slot, int idx)
+{
+	packet_count_arg_t *c = (packet_count_arg_t *)arg;
+	return ++c->count[slot] >= c->limit;
+}
+
+/* Indexes with packet traversal hold curve-sorted points, so consecutive
+ * points are close together and are queried as one packet */
+static void engine_core_task(void *arg, int begin, int end, int worker)
+{
+	dbscan_engine_t *e = (dbscan_engine_t *)arg;
+	const nbr_index_t *index = engine_index(e, worker);
+
+	const unsigned char *sparse = index->sparse;
+
+	if (!index->visit_packet) {
+		for (int i = begin; i < end; i++) {
+			count_arg_t c = { 0, e->min_pts };
+			if (!sparse || !sparse[i])
+				index->visit(index, i, count_visit, &c);
+			e->core[i] = c.count >= e->min_pts;
+		}
+		return;
+	}
+
+	int idx[QUERY_PACKET];
+	for (int i = begin; i < end;) {
+		int count = 0;
+		for (; i < end && count < QUERY_PACKET; i++) {
+			e->core[i] = 0;
+			if (!sparse || !sparse[i])
+				idx[count++] = i;
+		}
+		if (!count)
+			break;
+
+		packet_count_arg_t c = { { 0 }, e->min_pts };
+		index->visit_packet(index, idx, count, packet_count_visit, &c);
+		for (int q = 0; q < count; q++) {
+			e->core[idx[q]] = c.count[q] >= e->min_pts;
+		}
+	}
+}
+
+/* Tell the index that an unclassified or noise point joined a cluster */
+static inline void engine_close(const dbscan_engine_t *e, int idx,
+				int atomic)
+{
+	if (e->index->close)
+		e->index->close(e->index, idx, atomic);
+}
+
+/* Neighbors of the starting core point join the cluster unconditionally,
+ * as in the paper's ExpandCluster */
+static int engine_claim(void *arg, int idx);
+
+static int engine_claim_start(void *arg, int idx)
+{
+	dbscan_engine_t *e = (dbscan_engine_t *)arg;
+	int label = e->labels[idx];
+
+	if (e->keep_labels)
+		return engine_claim(arg, idx);
+	if (idx != e->start && e->core[idx] && label != e->cluster_id)
+		e->queue[e->queue_size++] = idx;
+	if (label == CDBSCAN_UNCLASSIFIED || label == CDBSCAN_NOISE)
+		engine_close(e, idx, 0);
+	e->labels[idx] = e->cluster_id;
+	return 0;
+}
+
+/* Later neighbors are claimed only if unclassified or noise */
+static int engine_claim(void *arg, int idx)
+{
+	dbscan_engine_t *e = (dbscan_engine_t *)arg;
+	int label = e->labels[idx];
+
+	if (label == CDBSCAN_UNCLASSIFIED) {
+		if (e->core[idx])
+			e->queue[e->queue_size++] = idx;
+		e->labels[idx] = e->cluster_id;
+		engine_close(e, idx, 0);
+	} else if (label == CDBSCAN_NOISE) {
+		e->labels[idx] = e->cluster_id;
+		engine_close(e, idx, 0);
+	}
+	return 0;
+}
+
+/* engine_claim for concurrent frontier queries. Core points are never
+ * noise, so only the thread that claims an unclassified core point queues
+ * it, and every core point is queued at most once. */
+static int engine_claim_atomic(void *arg, int idx)
+{
+	dbscan_engine_t *e = (dbscan_engine_t *)arg;
+	int label = __atomic_load_n(&e->labels[idx], __ATOMIC_RELAXED);
+
+	if (label != CDBSCAN_UNCLASSIFIED && label != CDBSCAN_NOISE)
+		return 0;
+	if (!__atomic_compare_exchange_n(&e->labels[idx], &label,
+					 e->cluster_id, 0, __ATOMIC_RELAXED,
+					 __ATOMIC_RELAXED))
+		return 0; /* Claimed by another thread */
+
+	engine_close(e, idx, 1);
+	if (label == CDBSCAN_UNCLASSIFIED && e->core[idx]) {
+		int slot = __atomic_fetch_add(&e->queue_size, 1,
+					      __ATOMIC_RELAXED);
+		e->queue[slot] = idx;
+	}
+	return 0;
+}
+
+static void engine_frontier_task(void *arg, int begin, int end, int worker)
+{
+	dbscan_engine_t *e = (dbscan_engine_t *)arg;
+	const nbr_index_t *index = engine_index(e, worker);
+
+	for (int i = begin; i < end; i++) {
+		int idx = e->queue[e->level + i];
+		if (index->visit_open)
+			index->visit_open(index, idx, engine_claim_atomic, e);
+		else
+			index->visit(index, idx, engine_claim_atomic, e);
+	}
+}
+
+static void engine_expand(dbscan_engine_t *e, int start)
+{
+	e->start = start;
+	e->queue_size = 0;
+	e->labels[start] = e->cluster_id;
+	engine_close(e, start, 0);
+	e->index->visit(e->index, start, engine_claim_start, e);
+
+	int head = 0;
+	if (pool_num_workers(e->pool) > 1) {
+		/* Level-synchronous: the next frontier is appended to the
+		 * queue while the current one is expanded */
+		while (e->queue_size - head >= ENGINE_PARALLEL_FRONTIER) {
+			int size = e->queue_size - head;
+			float *cost = NULL;
+			if (e->est) {
+				cost = e->cost;
+				const int *frontier = e->queue + head;
+				for (int i = 0; i < size; i++) {
+					cost[i] = 1.0f + e->est[frontier[i]];
+				}
+			}
+
+			e->level = head;
+			pool_parallel_for_cost(e->pool, size, 0, cost,
+					       engine_frontier_task, e);
+			head += size;
+		}
+	}
+
+	/* Small frontiers are not worth the synchronization */
+	const nbr_index_t *index = e->index;
+	for (; head < e->queue_size; head++) {
+		if (index->visit_open)
+			index->visit_open(index, e->queue[head], engine_claim,
+					  e);
+		else
+			index->visit(index, e->queue[head], engine_claim, e);
+	}
+}
+
+/* Dense regions make for slow queries: when the index can tell, size
+ * the parallel tasks by expected work rather than by count */
+static void engine_estimate_cost(dbscan_engine_t *e)
+{
+	e->est = NULL;
+	e->cost = NULL;
+	if (pool_num_workers(e->pool) <= 1 || !e->index->estimate)
+		return;
+
+	size_t size = e->num_points * sizeof(float);
+	e->est = (float *)scratch_get(e->scratch, SCRATCH_EST, size);
+	e->cost = (float *)scratch_get(e->scratch, SCRATCH_COST, size);
+	if (!e->est || !e->cost) {
+		scratch_put(e->scratch, e->est);
+		scratch_put(e->scratch, e->cost);
+		e->est = NULL;
+		e->cost = NULL;
+		return;
+	}
+
+	e->index->estimate(e->index, e->est, e->pool);
+
+	/* A core query stops after min_pts neighbors, sparse points are
+	 * not queried at all */
+	const unsigned char *sparse = e->index->sparse;
+	for (int i = 0; i < e->num_points; i++) {
+		float c = e->est[i] < e->min_pts ? e->est[i] : e->min_pts;
+		e->cost[i] = sparse && sparse[i] ? 1.0f : 1.0f + c;
+	}
+}
+
+/* Phase 2: expand a cluster from every unclassified core point, numbering
+ * new clusters from e->cluster_id */
+static void engine_expand_all(dbscan_engine_t *e)
+{
+	for (int k = 0; k < e->num_points; k++) {
+		int i = e->order ? e->order[k] : k;
+		if (e->labels[i] != CDBSCAN_UNCLASSIFIED) {
+			continue; /* Already processed */
+		}
+
+		if (!e->core[i]) {
+			/* Mark as noise (may be changed later if it's a border point) */
+			e->labels[i] = CDBSCAN_NOISE;
+			continue;
+		}
+
+		/* Core point - start a new cluster */
+		engine_expand(e, i);
+		e->cluster_id++;
+	}
+}
+
+/* Returns the number of clusters found */
+static int engine_run(dbscan_engine_t *e)
+{
+	for (int i = 0; i < e->num_points; i++) {
+		e->labels[i] = CDBSCAN_UNCLASSIFIED;
+	}
+
+	engine_estimate_cost(e);
+	pool_parallel_for_cost(e->pool, e->num_points, 0, e->cost,
+			       engine_core_task, e);
+
+	e->cluster_id = 0;
+	engine_expand_all(e);
+
+	scratch_put(e->scratch, e->est);
+	scratch_put(e->scratch, e->cost);
+	return e->cluster_id;
+}
+
+/* Run the engine over a built index into labels, with per-node copies of
+ * the index if replicate is set and clusters seeded in the given order
+ * (NULL for index order). Returns the number of clusters, -1 if out
+ * of memory. */
+static int cluster_index(const nbr_index_t *index, int min_pts,
+			 int replicate, const int *order, scratch_t *scratch,
+			 int *labels)
+{
+	int num_points = index->num_points;
+	thread_pool_t *pool = index->pool;
+	int *queue = (int *)scratch_get(scratch, SCRATCH_QUEUE,
+					num_points * sizeof(int));
+	unsigned char *core =
+		(unsigned char *)scratch_get(scratch, SCRATCH_CORE, num_points);
+	if (!queue || !core) {
+		scratch_put(scratch, queue);
+		scratch_put(scratch, core);
+		return -1;
+	}
+	pool_first_touch(pool, labels, sizeof(int), num_points);
+	pool_first_touch(pool, core, 1, num_points);
+
+	nbr_index_t *node_index =
+		replicate ? index_replicate(index, scratch) : NULL;
+
+	dbscan_engine_t engine = { .index = index,
+				   .node_index = node_index,
+				   .num_points = num_points,
+				   .min_pts = min_pts,
+				   .labels = labels,
+				   .core = core,
+				   .queue = queue,
+				   .order = order,
+				   .pool = pool,
+				   .scratch = scratch };
+	int num_clusters = engine_run(&engine);
+
+	index_replicas_free(node_index, index, scratch);
+	scratch_put(scratch, queue);
+	scratch_put(scratch, core);
+	return num_clusters;
+}
+
+/* Grid density sketch
+ *
+ * Before any query, points are binned into a grid of cells slightly wider
+ * than eps. Every metric but cosine and custom ones is at least the
+ * largest coordinate difference, so all neighbors of a point lie in its
+ * own cell or the 3^dims cells around it, and the points in those cells
+ * bound its neighbor count from above. Points whose bound is below
+ * min_pts cannot be core and are marked sparse: they are never queried,
+ * yet still join a cluster as border points when a core point reaches
+ * them. Cells live in a hash table keyed by their packed coordinates.
+ */
+#define SKETCH_MAX_DIMS 3
+#define SKETCH_MAX_BITS 30 /* Cells per dimension, well inside precision */
+#define SKETCH_EMPTY UINT64_MAX
+
+typedef struct {
+	uint64_t key; /* Packed cell coordinates, SKETCH_EMPTY if unused */
+	int count; /* Points in the cell */
+	int sparse; /* Cells around it hold fewer than min_pts points */
+} sketch_cell_t;
+
+typedef struct {
+	sketch_cell_t *cells;
+	int hash_bits;
+	int64_t step[27]; /* Key offsets of the cells around a cell */
+	int num_steps;
+	int min_pts;
+} sketch_t;
+
+static inline uint32_t sketch_hash(const sketch_t *sk, uint64_t key)
+{
+	uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(h >> (64 - sk->hash_bits));
+}
+
+/* Slot of the cell with the given key, or the empty slot for it */
+static size_t sketch_find(const sketch_t *sk, uint64_t key)
+{
+	size_t mask = ((size_t)1 << sk->hash_bits) - 1;
+	size_t h = sketch_hash(sk, key);
+
+	while (sk->cells[h].key != key && sk->cells[h].key != SKETCH_EMPTY) {
+		h = (h + 1) & mask;
+	}
+	return h;
+}
+
+static void sketch_bound_task(void *arg, int begin, int end, int worker)
+{
+	sketch_t *sk = (sketch_t *)arg;
+
+	for (int h = begin; h < end; h++) {
+		sketch_cell_t *cell = &sk->cells[h];
+		if (cell->key == SKETCH_EMPTY)
+			continue;
+		int bound = 0;
+		for (int k = 0; k < sk->num_steps && bound < sk->min_pts; k++) {
+			size_t slot = sketch_find(sk, cell->key + sk->step[k]);
+			if (sk->cells[slot].key != SKETCH_EMPTY)
+				bound += sk->cells[slot].count;
+		}
+		cell->sparse = bound < sk->min_pts;
+	}
+}
+
+static int sketch_wanted(const cdbscan_params_t *params, int num_points,
+			 int dims)
+{
+	return dims <= SKETCH_MAX_DIMS && params->min_pts > 1 &&
+	       num_points <= INT_MAX / 4 &&
+	       params->dist_type != CDBSCAN_DIST_COSINE &&
+	       params->dist_type != CDBSCAN_DIST_CUSTOM;
+}
+
+static size_t sketch_table_size(int num_points)
+{
+	size_t size = 2;
+	while (size < 2 * (size_t)num_points) {
+		size *= 2;
+	}
+	return size;
+}
+
+/* Flags of the points that cannot be core, from scratch; NULL if the
+ * metric or the extent of the data rules out a sketch, or if no point
+ * is sparse */
+static unsigned char *sketch_sparse(const double *coords, int num_points,
+				    int dims, const cdbscan_params_t *params,
+				    thread_pool_t *pool, scratch_t *scratch)
+{
+	if (!sketch_wanted(params, num_points, dims))
+		return NULL;
+
+	/* Cells a little wider than eps absorb rounding in the cell index,
+	 * which stays below 2^SKETCH_MAX_BITS so that error is tiny */
+	double side = params->eps * (1.0 + 1e-5);
+	int bits = 63 / dims < SKETCH_MAX_BITS ? 63 / dims : SKETCH_MAX_BITS;
+	double low[SKETCH_MAX_DIMS];
+	for (int d = 0; d < dims; d++) {
+		double lo = coords[d], hi = coords[d];
+		for (int i = 1; i < num_points; i++) {
+			double x = coords[(size_t)i * dims + d];
+			lo = x < lo ? x : lo;
+			hi = x > hi ? x : hi;
+		}
+		/* A spare cell on each side for the neighbors */
+		if (!(side > 0) || (hi - lo) / side + 3 >= (double)(1 << bits))
+			return NULL;
+		low[d] = lo - side;
+	}
+
+	sketch_t sk = { .min_pts = params->min_pts, .hash_bits = 1 };
+	size_t size = sketch_table_size(num_points);
+	while (((size_t)1 << sk.hash_bits) < size) {
+		sk.hash_bits++;
+	}
+	sk.cells = (sketch_cell_t *)scratch_get(
+		scratch, SCRATCH_SKETCH_TABLE, size * sizeof(sketch_cell_t));
+	int *slot = (int *)scratch_get(scratch, SCRATCH_SKETCH_CELL,
+				       num_points * sizeof(int));
+	unsigned char *sparse = (unsigned char *)scratch_get(
+		scratch, SCRATCH_SPARSE, num_points);
+	if (!sk.cells || !slot || !sparse) {
+		scratch_put(scratch, sk.cells);
+		scratch_put(scratch, slot);
+		scratch_put(scratch, sparse);
+		return NULL;
+	}
+
+	sk.num_steps = 1;
+	sk.step[0] = 0;
+	for (int d = 0; d < dims; d++) {
+		int64_t unit = (int64_t)1 << (d * bits);
+		for (int k = 0; k < sk.num_steps; k++) {
+			sk.step[sk.num_steps + k] = sk.step[k] - unit;
+			sk.step[2 * sk.num_steps + k] = sk.step[k] + unit;
+		}
+		sk.num_steps *= 3;
+	}
+
+	for (size_t h = 0; h < size; h++) {
+		sk.cells[h].key = SKETCH_EMPTY;
+	}
+	for (int i = 0; i < num_points; i++) {
+		uint64_t key = 0;
+		for (int d = 0; d < dims; d++) {
+			double x = coords[(size_t)i * dims + d];
+			key |= (uint64_t)((x - low[d]) / side) << (d * bits);
+		}
+		size_t h = sketch_find(&sk, key);
+		if (sk.cells[h].key == SKETCH_EMPTY) {
+			sk.cells[h].key = key;
+			sk.cells[h].count = 0;
+		}
+		sk.cells[h].count++;
+		slot[i] = (int)h;
+	}
+
+	pool_parallel_for(pool, (int)size, 0, sketch_bound_task, &sk);
+
+	int found = 0;
+	for (int i = 0; i < num_points; i++) {
+		sparse[i] = (unsigned char)sk.cells[slot[i]].sparse;
+		found |= sparse[i];
+	}
+	scratch_put(scratch, sk.cells);
+	scratch_put(scratch, slot);
+	if (!found) {
+		scratch_put(scratch, sparse);
+		return NULL;
+	}
+	return sparse;
+}
+
+/* Memory plan
+ *
+ * Beyond its labels, queue and core flags, everything a clustering call
+ * builds only makes it faster: per-node copies of the data, the neighbor
+ * bit matrix, per-point cost estimates for scheduling, the curve-ordered
+ * copy of the points, the density sketch and the KD-tree. Under a memory
+ * limit they are given up in that order, most memory for the least speed
+ * first, until the peak of the call fits; the labels stay the same.
+ * Region queries hand neighbors to the engine one at a time and never
+ * store them, so with none of these a call needs 5 bytes per point
+ * besides its labels.
+ */
+enum {
+	PLAN_REPLICA = 1 << 0,
+	PLAN_BITMAT = 1 << 1,
+	PLAN_COST = 1 << 2,
+	PLAN_CURVE = 1 << 3,
+	PLAN_SKETCH = 1 << 4,
+	PLAN_TREE = 1 << 5,
+	PLAN_ALL = (1 << 6) - 1
+};
+
+static int curve_box_dims(const cdbscan_params_t *params, int num_points,
+			  int dims);
+
+/* Nodes holding a copy of the index */
+static int plan_replicas(const thread_pool_t *pool)
+{
+	if (!pool || !(pool->numa_flags & CDBSCAN_NUMA_REPLICATE))
+		return 1;
+	return pool->num_nodes;
+}
+
+/* Peak bytes a cluster_packed() call takes besides its labels, building
+ * what plan allows on workers threads. Arrays are counted as an arena
+ * spends them; keep in step with the allocations of the call. */
+static size_t plan_bytes(int num_points, int dims,
+			 const cdbscan_params_t *params, int plan,
+			 int workers, int replicas)
+{
+	size_t n = num_points, size = 0, tree_size = 0;
+	int tree = (plan & PLAN_TREE) && params->use_kdtree &&
+		   params->dist_type == CDBSCAN_DIST_EUCLIDEAN;
+	int bits = !tree && (plan & PLAN_BITMAT) &&
+		   num_points <= BITMAT_MAX_POINTS;
+
+	/* The box is measured even if the curve is given up */
+	int box_dims = curve_box_dims(params, num_points, dims);
+	size_t chunks = (n + STATS_CHUNK - 1) / STATS_CHUNK;
+	size += scratch_arena_size(3 * chunks * box_dims * sizeof(double));
+	if ((plan & PLAN_CURVE) && box_dims) {
+		size += scratch_arena_size(2 * n * sizeof(uint64_t));
+		size += scratch_arena_size(3 * n * sizeof(int));
+		size += scratch_arena_size(n * dims * sizeof(double));
+		size += scratch_arena_size(n * sizeof(int));
+	}
+	if (tree) {
+		size_t nodes = kdtree_max_nodes(num_points);
+		tree_size += scratch_arena_size(sizeof(kdtree_t));
+		tree_size += scratch_arena_size(nodes * sizeof(kdtree_node_t));
+		tree_size += scratch_arena_size(nodes * 2 * dims *
+						sizeof(double));
+		tree_size += scratch_arena_size(n * sizeof(int));
+		size += tree_size;
+		size += scratch_arena_size(nodes * sizeof(int));
+		size += scratch_arena_size(n * sizeof(int));
+		/* Node lists and costs of the parallel build */
+		if (workers > 1)
+			size += 6 * 8 * (size_t)workers * sizeof(int);
+	}
+	if (bits) {
+		size_t stride = (n + 63) / 64;
+		size += sizeof(bitmat_t);
+		size += (n + 1) * stride * sizeof(uint64_t);
+		size += stride * 64 * dims * sizeof(double);
+	}
+	if ((plan & PLAN_SKETCH) && sketch_wanted(params, num_points, dims)) {
+		size += scratch_arena_size(sketch_table_size(num_points) *
+					   sizeof(sketch_cell_t));
+		size += scratch_arena_size(n * sizeof(int));
+		size += scratch_arena_size(n);
+	}
+	if ((plan & PLAN_COST) && workers > 1 && (tree || bits))
+		size += 2 * scratch_arena_size(n * sizeof(float));
+	if ((plan & PLAN_REPLICA) && replicas > 1 && !bits) {
+		size += replicas * sizeof(nbr_index_t);
+		size += (replicas - 1) * (n * dims * sizeof(double) +
+					  tree_size);
+	}
+	size += scratch_arena_size(n * sizeof(int));
+	size += scratch_arena_size(n);
+	return size;
+}
+
+/* Whether the least a call can do fits next to size bytes it holds */
+static int plan_fits(const scratch_t *scratch, int num_points, int dims,
+		     const cdbscan_params_t *params, size_t size)
+{
+	size_t limit = scratch_avail(scratch);
+	size_t least = plan_bytes(num_points, dims, params, 0, 1, 1);
+	return !limit || (size <= limit && least <= limit - size);
+}
+
+/* The most plan_bytes() allows within limit (0 for no limit), written to
+ * size. Returns the plan, -1 if even the smallest does not fit. */
+static int plan_choose(int num_points, int dims,
+		       const cdbscan_params_t *params, int workers,
+		       int replicas, size_t limit, size_t *size)
+{
+	int plan = PLAN_ALL;
+	size_t matrix = (size_t)num_points * (((size_t)num_points + 63) / 64) *
+			sizeof(uint64_t);
+	if (!limit && matrix > BITMAT_DEFAULT_BYTES)
+		plan &= ~PLAN_BITMAT;
+	*size = plan_bytes(num_points, dims, params, plan, workers, replicas);
+	for (int bit = 1; limit && *size > limit && plan; bit <<= 1) {
+		plan &= ~bit;
+		*size = plan_bytes(num_points, dims, params, plan, workers,
+				   replicas);
+	}
+	return limit && *size > limit ? -1 : plan;
+}
+
+/* Cluster row-major coordinates with seeds taken in the given order,
+ * building what plan allows. keys are the Morton keys of curve-sorted
+ * coordinates, or NULL. */
+static int cluster_coords(const double *coords, int num_points, int dims,
+			  const cdbscan_params_t *params, int plan,
+			  const int *order, const uint64_t *keys,
+			  thread_pool_t *pool, scratch_t *scratch,
+			  int *labels)
+{
+	nbr_index_t index = { .visit = brute_index_visit,
+			      .pool = pool,
+			      .coords = coords,
+			      .num_points = num_points,
+			      .dims = dims,
+			      .params = params };
+
+	/* Build KD-tree if requested and using Euclidean distance */
+	kdtree_t *tree = NULL;
+	if ((plan & PLAN_TREE) && params->use_kdtree &&
+	    params->dist_type == CDBSCAN_DIST_EUCLIDEAN) {
+		tree = kdtree_build(coords, keys, num_points, dims, pool,
+				    scratch);
+		if (tree) {
+			index.visit = kdtree_index_visit;
+			index.estimate = kdtree_index_estimate;
+			index.impl = tree;
+		}
+		/* Otherwise fall back to brute force */
+	}
+	if (tree && order && dims >= PACKET_MIN_DIMS &&
+	    dims <= PACKET_MAX_DIMS)
+		index.visit_packet = kdtree_index_visit_packet;
+
+	/* Expansion skips subtrees that clusters have claimed */
+	kdtree_open_t open = { NULL, NULL, NULL };
+	if (tree && kdtree_open_init(&open, tree, scratch)) {
+		index.visit_open = kdtree_index_visit_open;
+		index.close = kdtree_index_close;
+		index.open = &open;
+	}
+
+	/* Otherwise the neighborhoods may fit a bit matrix, which is not
+	 * worth copying per node and too big for a workspace */
+	bitmat_t *bits = NULL;
+	if (!tree && (plan & PLAN_BITMAT) && !(scratch && scratch->arena))
+		bits = bitmat_build(coords, num_points, dims, params, pool,
+				    scratch);
+	if (bits) {
+		index.visit = bitmat_index_visit;
+		index.visit_open = bitmat_index_visit_open;
+		index.close = bitmat_index_close;
+		index.estimate = bitmat_index_estimate;
+		index.open = bits->open;
+		index.impl = bits;
+	}
+
+	/* Isolated points are settled without a query */
+	unsigned char *sparse = NULL;
+	if (plan & PLAN_SKETCH)
+		sparse = sketch_sparse(coords, num_points, dims, params, pool,
+				       scratch);
+	index.sparse = sparse;
+	if (!(plan & PLAN_COST))
+		index.estimate = NULL;
+
+	int num_clusters = cluster_index(&index, params->min_pts,
+					 !bits && (plan & PLAN_REPLICA), order,
+					 scratch, labels);
+	if (tree && index.open)
+		kdtree_open_free(&open);
+	kdtree_free(tree);
+	bitmat_free(bits);
+	scratch_put(scratch, sparse);
+	return num_clusters;
+}
+
+/* Space-filling curve order
+ *
+ * Points are sorted along a Morton (Z-order) curve over a grid spanning
+ * the data before clustering, so points close in space are close in
+ * memory and the neighbors of a query share cache lines. Clusters are
+ * still seeded in input order, which keeps the labels identical to an
+ * unsorted run, and labels are mapped back to input order at the end.
+ */
+#define CURVE_MAX_DIMS 8
+#define CURVE_MIN_POINTS 4096
+#define CURVE_KEY_BITS 64
+#define CURVE_MAX_BITS 16 /* Per dimension; finer grids add no locality */
+#define CURVE_KEY_BYTES (CURVE_KEY_BITS / 8) /* Radix sort passes */
+
+static int curve_wanted(const cdbscan_params_t *params, int num_points,
+			int dims)
+{
+	if (params->curve_order)
+		return params->curve_order > 0;
+	return dims <= CURVE_MAX_DIMS && num_points >= CURVE_MIN_POINTS;
+}
+
+typedef struct {
+	const double *coords;
+	int dims;
+	int curve_dims; /* Leading dimensions interleaved into the key */
+	int bits; /* Key bits per dimension */
+	const double *low;
+	const double *scale; /* Grid cells per unit, per dimension */
+	uint64_t *keys;
+	int *perm;
+	int passes; /* Key bytes the sort looks at */
+	size_t (*count)[256]; /* Per key byte, keys with each value */
+} curve_job_t;
+
+/* Keys of a range of points, and the histograms of their bytes so that
+ * the sort need not read the keys once more per pass to count them */
+static void curve_key_task(void *arg, int begin, int end, int worker)
+{
+	curve_job_t *job = (curve_job_t *)arg;
+	uint64_t top = ((uint64_t)1 << job->bits) - 1;
+	uint64_t cell[CURVE_KEY_BITS];
+	size_t count[CURVE_KEY_BYTES][256];
+	memset(count, 0, job->passes * sizeof(count[0]));
+
+	for (int i = begin; i < end; i++) {
+		const double *x = job->coords + (size_t)i * job->dims;
+		for (int d = 0; d < job->curve_dims; d++) {
+			double c = (x[d] - job->low[d]) * job->scale[d];
+			cell[d] = c <= 0 ? 0 : c >= top ? top : (uint64_t)c;
+		}
+
+		uint64_t key = 0;
+		for (int b = job->bits - 1; b >= 0; b--) {
+			for (int d = 0; d < job->curve_dims; d++) {
+				key = key << 1 | ((cell[d] >> b) & 1);
+			}
+		}
+		job->keys[i] = key;
+		job->perm[i] = i;
+		for (int p = 0; p < job->passes; p++) {
+			count[p][(key >> (8 * p)) & 0xff]++;
+		}
+	}
+
+	for (int p = 0; p < job->passes; p++) {
+		for (int b = 0; b < 256; b++) {
+			if (count[p][b])
+				__atomic_fetch_add(&job->count[p][b],
+						   count[p][b],
+						   __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/* Stable LSD radix sort of (keys, perm) on their low passes bytes, using
+ * the second halves of both arrays as buffers. count[p] is the histogram
+ * of byte p of the keys; a byte that is the same in every key leaves the
+ * order as it is and is skipped. */
+static void curve_radix_sort(uint64_t *keys, int *perm, int n, int passes,
+			     size_t (*count)[256])
+{
+	uint64_t *key_tmp = keys + n;
+	int *perm_tmp = perm + n;
+	int swapped = 0;
+
+	for (int p = 0; p < passes; p++) {
+		int shift = 8 * p;
+		size_t *pos = count[p];
+		if (pos[(keys[0] >> shift) & 0xff] == (size_t)n)
+			continue;
+		size_t start = 0;
+		for (int b = 0; b < 256; b++) {
+			size_t c = pos[b];
+			pos[b] = start;
+			start += c;
+		}
+		for (int i = 0; i < n; i++) {
+			size_t at = pos[(keys[i] >> shift) & 0xff]++;
+			key_tmp[at] = keys[i];
+			perm_tmp[at] = perm[i];
+		}
+
+		uint64_t *kt = keys;
+		keys = key_tmp;
+		key_tmp = kt;
+		int *pt = perm;
+		perm = perm_tmp;
+		perm_tmp = pt;
+		swapped ^= 1;
+	}
+
+	/* An odd number of passes leaves the result in the buffers */
+	if (swapped) {
+		memcpy(key_tmp, keys, n * sizeof(uint64_t));
+		memcpy(perm_tmp, perm, n * sizeof(int));
+	}
+}
+
+typedef struct {
+	const double *coords;
+	double *sorted;
+	const int *perm;
+	int dims;
+} curve_copy_job_t;
+
+static void curve_copy_task(void *arg, int begin, int end, int worker)
+{
+	curve_copy_job_t *job = (curve_copy_job_t *)arg;
+	size_t row = job->dims * sizeof(double);
+
+	for (int k = begin; k < end; k++) {
+		memcpy(job->sorted + (size_t)k * job->dims,
+		       job->coords + (size_t)job->perm[k] * job->dims, row);
+	}
+}
+
+/* Leading dimensions whose box the curve needs, 0 for no curve */
+static int curve_box_dims(const cdbscan_params_t *params, int num_points,
+			  int dims)
+{
+	if (!curve_wanted(params, num_points, dims))
+		return 0;
+	return dims < CURVE_KEY_BITS ? dims : CURVE_KEY_BITS;
+}
+
+/* Cluster packed coordinates into labels. box holds the minima, then at
+ * box + CURVE_KEY_BITS the maxima, of the curve_box_dims() leading
+ * dimensions, or is NULL to measure them here. Runs on pool if given,
+ * with working memory from scratch. Returns the number of clusters, -1 if
+ * out of memory or over the scratch's limit. */
+static int cluster_packed(const double *coords, int num_points, int dims,
+			  const cdbscan_params_t *params, const double *box,
+			  thread_pool_t *pool, scratch_t *scratch, int *labels)
+{
+	size_t size;
+	int plan = plan_choose(num_points, dims, params, pool_num_workers(pool),
+			       plan_replicas(pool), scratch_avail(scratch),
+			       &size);
+	if (plan < 0)
+		return -1;
+	scratch_reserve(scratch, size);
+
+	if (!(plan & PLAN_CURVE) || !curve_wanted(params, num_points, dims))
+		return cluster_coords(coords, num_points, dims, params, plan,
+				      NULL, NULL, pool, scratch, labels);
+
+	int curve_dims = dims < CURVE_KEY_BITS ? dims : CURVE_KEY_BITS;
+	int bits = CURVE_KEY_BITS / curve_dims;
+	bits = bits < CURVE_MAX_BITS ? bits : CURVE_MAX_BITS;
+	uint64_t *keys = (uint64_t *)scratch_get(
+		scratch, SCRATCH_CURVE_KEYS, 2 * (size_t)num_points *
+						     sizeof(uint64_t));
+	int *perm = (int *)scratch_get(scratch, SCRATCH_CURVE_RANK,
+				       3 * (size_t)num_points * sizeof(int));
+	double *sorted = (double *)scratch_get(
+		scratch, SCRATCH_CURVE_COORDS,
+		(size_t)num_points * dims * sizeof(double));
+	int *sorted_labels = (int *)scratch_get(
+		scratch, SCRATCH_CURVE_LABELS, num_points * sizeof(int));
+	if (!keys || !perm || !sorted || !sorted_labels) {
+		scratch_put(scratch, keys);
+		scratch_put(scratch, perm);
+		scratch_put(scratch, sorted);
+		scratch_put(scratch, sorted_labels);
+		return cluster_coords(coords, num_points, dims, params, plan,
+				      NULL, NULL, pool, scratch, labels);
+	}
+
+	double measured[2 * CURVE_KEY_BITS], scale[CURVE_KEY_BITS];
+	stats_job_t stats = { .coords = coords,
+			      .num_points = num_points,
+			      .dims = dims,
+			      .stat_dims = curve_dims };
+	if (!box && stats_pass(&stats, pool, scratch, measured,
+			       measured + CURVE_KEY_BITS, NULL) >= 0)
+		box = measured;
+	if (!box) {
+		scratch_put(scratch, keys);
+		scratch_put(scratch, perm);
+		scratch_put(scratch, sorted);
+		scratch_put(scratch, sorted_labels);
+		return cluster_coords(coords, num_points, dims, params, plan,
+				      NULL, NULL, pool, scratch, labels);
+	}
+	for (int d = 0; d < curve_dims; d++) {
+		double lo = box[d], hi = box[CURVE_KEY_BITS + d];
+		scale[d] = hi > lo ? ldexp(1.0, bits) / (hi - lo) : 0.0;
+	}
+
+	size_t count[CURVE_KEY_BYTES][256];
+	int passes = (bits * curve_dims + 7) / 8;
+	memset(count, 0, sizeof(count));
+	curve_job_t job = { coords, dims, curve_dims, bits, box,
+			    scale, keys, perm, passes, count };
+	pool_parallel_for(pool, num_points, 0, curve_key_task, &job);
+	curve_radix_sort(keys, perm, num_points, passes, count);
+
+	/* rank[i]: position of input point i along the curve */
+	int *rank = perm + 2 * (size_t)num_points;
+	for (int k = 0; k < num_points; k++) {
+		rank[perm[k]] = k;
+	}
+	curve_copy_job_t copy = { coords, sorted, perm, dims };
+	pool_parallel_for(pool, num_points, 0, curve_copy_task, &copy);
+
+	/* Keys of many dimensions hold too few bits per dimension to split
+	 * the tree on */
+	int num_clusters = cluster_coords(
+		sorted, num_points, dims, params, plan, rank,
+		dims <= CURVE_MAX_DIMS ? keys : NULL, pool, scratch,
+		sorted_labels);
+	for (int i = 0; num_clusters >= 0 && i < num_points; i++) {
+		labels[i] = sorted_labels[rank[i]];
+	}
+
+	scratch_put(scratch, keys);
+	scratch_put(scratch, perm);
+	scratch_put(scratch, sorted);
+	scratch_put(scratch, sorted_labels);
+	return num_clusters;
+}
+
+/* Main DBSCAN clustering algorithm */
+int cdbscan_cluster_ctx(cdbscan_context_t *ctx, cdbscan_point_t *points,
+			int num_points, cdbscan_params_t params)
+{
+	/* Validate inputs; every point is checked while packing */
+	if (!cdbscan_validate_params(&params))
+		return -1;
+	if (!points || num_points <= 0 || points[0].dimensions <= 0)
+		return -1;
+
+	int dims = points[0].dimensions;
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+	thread_pool_t *pool = env.pool;
+	scratch_t *scratch = env.scratch;
+
+	/* Fail before packing if the points will not fit */
+	size_t size = scratch_arena_size((size_t)num_points * dims *
+					 sizeof(double)) +
+		      scratch_arena_size(num_points * sizeof(int));
+	if (!plan_fits(scratch, num_points, dims, &params, size)) {
+		call_end(&env);
+		return -1;
+	}
+	scratch_reserve(scratch, size);
+
+	/* Allocate working arrays */
+	double *coords = (double *)scratch_get(
+		scratch, SCRATCH_COORDS,
+		(size_t)num_points * dims * sizeof(double));
+	int *labels = (int *)scratch_get(scratch, SCRATCH_LABELS,
+					 num_points * sizeof(int));
+
+	/* Check, pack and measure the points in one pass */
+	double box[2 * CURVE_KEY_BITS];
+	stats_job_t stats = {
+		.points = points,
+		.packed = coords,
+		.num_points = num_points,
+		.dims = dims,
+		.stat_dims = curve_box_dims(&params, num_points, dims),
+		.check = 1
+	};
+	int num_clusters = -1;
+	if (coords && labels &&
+	    stats_pass(&stats, pool, scratch, box, box + CURVE_KEY_BITS,
+		       NULL) > 0) {
+		num_clusters = cluster_packed(coords, num_points, dims, &params,
+					      box, pool, scratch, labels);
+	}
+
+	if (num_clusters >= 0) {
+		for (int i = 0; i < num_points; i++) {
+			points[i].cluster_id = labels[i];
+			points[i].index = i;
+		}
+	}
+
+	/* Clean up */
+	scratch_put(scratch, coords);
+	scratch_put(scratch, labels);
+	call_end(&env);
+
+	return num_clusters; /* Return number of clusters found */
+}
+
+int cdbscan_cluster(cdbscan_point_t *points, int num_points,
+		    cdbscan_params_t params)
+{
+	return cdbscan_cluster_ctx(NULL, points, num_points, params);
+}
+
+static int dataset_shape_valid(const cdbscan_dataset_t *data)
+{
+	return data && data->coords && data->num_points > 0 &&
+	       data->dimensions > 0;
+}
+
+static int dataset_valid(const cdbscan_dataset_t *data)
+{
+	if (!dataset_shape_valid(data))
+		return 0;
+
+	size_t count = (size_t)data->num_points * data->dimensions;
+	for (size_t i = 0; i < count; i++) {
+		if (!isfinite(data->coords[i]))
+			return 0;
+	}
+	return 1;
+}
+
+/* Clustering straight from a row-major array, without packing */
+int cdbscan_cluster_dataset(cdbscan_context_t *ctx,
+			    const cdbscan_dataset_t *data,
+			    cdbscan_params_t params, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !dataset_shape_valid(data) ||
+	    !labels)
+		return -1;
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+
+	/* Check the coordinates and measure them in one pass */
+	int num_points = data->num_points, dims = data->dimensions;
+	double box[2 * CURVE_KEY_BITS];
+	stats_job_t stats = {
+		.coords = data->coords,
+		.num_points = num_points,
+		.dims = dims,
+		.stat_dims = curve_box_dims(&params, num_points, dims),
+		.check = 1
+	};
+	int num_clusters = -1;
+	if (plan_fits(env.scratch, num_points, dims, &params, 0) &&
+	    stats_pass(&stats, env.pool, env.scratch, box,
+		       box + CURVE_KEY_BITS, NULL) > 0)
+		num_clusters = cluster_packed(data->coords, num_points, dims,
+					      &params, box, env.pool,
+					      env.scratch, labels);
+	call_end(&env);
+	return num_clusters;
+}
+
+/* A serial cluster_packed() call in an arena, which builds no bit matrix,
+ * plus alignment of the workspace */
+size_t cdbscan_workspace_size(int num_points, int dims,
+			      cdbscan_params_t params)
+{
+	if (!cdbscan_validate_params(&params) || num_points <= 0 || dims <= 0)
+		return 0;
+
+	return SCRATCH_ALIGN + plan_bytes(num_points, dims, &params,
+					  PLAN_ALL & ~PLAN_BITMAT, 1, 1);
+}
+
+size_t cdbscan_memory_estimate(const cdbscan_context_t *ctx, int num_points,
+			       int dims, cdbscan_params_t params)
+{
+	if (!cdbscan_validate_params(&params) || num_points <= 0 || dims <= 0)
+		return 0;
+
+	int workers = params.num_threads > 1 ? params.num_threads : 1;
+	int replicas = 1;
+	size_t limit = 0, size;
+	if (ctx) {
+		workers = pool_num_workers(ctx->pool);
+		replicas = plan_replicas(ctx->pool);
+		limit = __atomic_load_n(&ctx->memory_limit, __ATOMIC_RELAXED);
+	}
+	plan_choose(num_points, dims, &params, workers, replicas, limit,
+		    &size);
+	return size;
+}
+
+int cdbscan_cluster_workspace(const cdbscan_dataset_t *data,
+			      cdbscan_params_t params, void *workspace,
+			      size_t workspace_size, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !dataset_valid(data) ||
+	    !labels || !workspace)
+		return -1;
+	if (workspace_size < cdbscan_workspace_size(data->num_points,
+						    data->dimensions, params))
+		return -1;
+
+	scratch_t scratch = { .arena = (char *)workspace,
+			      .arena_size = workspace_size };
+	return cluster_packed(data->coords, data->num_points,
+			      data->dimensions, &params, NULL, NULL, &scratch,
+			      labels);
+}
+
+/* Lattice clustering
+ *
+ * On an integer lattice the offsets within eps of a point are the same
+ * for every point, so they are enumerated once as a stencil. Cells are
+ * numbered row-major in the bounding box padded by the stencil radius on
+ * every side; an offset is then one fixed difference of cell numbers and
+ * never leaves the box. Occupied cells are found in a dense array when
+ * the box has few cells per point and in a hash table otherwise. Points
+ * sharing a cell are chained in index order. No distances are computed
+ * after the stencil is built.
+ */
+#define LATTICE_MAX_STENCIL (1 << 20)
+#define LATTICE_DENSE_CELLS 4 /* Dense lookup up to this many cells/point */
+#define LATTICE_MAX_CELLS ((uint64_t)1 << 62)
+
+typedef struct {
+	int radius; /* Largest coordinate offset in the stencil */
+	int64_t *stride; /* Cell number step per dimension */
+	uint64_t volume; /* Cells in the padded box */
+	int64_t *stencil; /* Cell number differences of all offsets */
+	int stencil_size;
+	uint64_t *cell; /* Cell number of each point */
+	int *next; /* Next point in the same cell, -1 at the end */
+	int *head; /* Dense lookup: first point of each cell, -1 if empty */
+	uint64_t *keys; /* Hash lookup: cell numbers, open addressing */
+	int *slots; /* Hash lookup: first point of keys[i], -1 if empty */
+	int hash_bits;
+} lattice_t;
+
+static void lattice_free(lattice_t *lat)
+{
+	free(lat->stride);
+	free(lat->stencil);
+	free(lat->cell);
+	free(lat->next);
+	free(lat->head);
+	free(lat->keys);
+	free(lat->slots);
+}
+
+/* Size the padded box for the given extents (cells per dimension) and
+ * enumerate the stencil for params->eps. Returns 0 if the metric is not
+ * translation invariant or the stencil or box is too large. */
+static int lattice_init(lattice_t *lat, const int64_t *extent, int dims,
+			const cdbscan_params_t *params)
+{
+	memset(lat, 0, sizeof(*lat));
+	if (params->dist_type != CDBSCAN_DIST_EUCLIDEAN &&
+	    params->dist_type != CDBSCAN_DIST_MANHATTAN &&
+	    params->dist_type != CDBSCAN_DIST_MINKOWSKI)
+		return 0;
+
+	/* Every Lp distance is at least the largest coordinate difference */
+	if (params->eps >= LATTICE_MAX_STENCIL)
+		return 0;
+	int radius = (int)floor(params->eps);
+	int width = 2 * radius + 1;
+	uint64_t candidates = 1;
+	for (int d = 0; d < dims; d++) {
+		candidates *= width;
+		if (candidates > LATTICE_MAX_STENCIL)
+			return 0;
+	}
+
+	lat->radius = radius;
+	lat->stride = (int64_t *)malloc(dims * sizeof(int64_t));
+	lat->stencil = (int64_t *)malloc(candidates * sizeof(int64_t));
+	int *offset = (int *)malloc(dims * sizeof(int));
+	double *zero = (double *)calloc(dims, sizeof(double));
+	double *delta = (double *)malloc(dims * sizeof(double));
+	int ok = lat->stride && lat->stencil && offset && zero && delta;
+
+	uint64_t volume = 1;
+	for (int d = dims - 1; ok && d >= 0; d--) {
+		uint64_t size = (uint64_t)extent[d] + 2 * radius;
+		lat->stride[d] = (int64_t)volume;
+		if (size > LATTICE_MAX_CELLS / volume)
+			ok = 0;
+		else
+			volume *= size;
+	}
+	lat->volume = volume;
+
+	for (int d = 0; ok && d < dims; d++) {
+		offset[d] = -radius;
+	}
+	for (uint64_t c = 0; ok && c < candidates; c++) {
+		int64_t diff = 0;
+		for (int d = 0; d < dims; d++) {
+			delta[d] = offset[d];
+			diff += offset[d] * lat->stride[d];
+		}
+		/* Same computation as a distance between two lattice points */
+		double dist = calculate_distance(zero, delta, dims, params);
+		if (dist >= 0 && dist <= params->eps)
+			lat->stencil[lat->stencil_size++] = diff;
+
+		for (int d = dims - 1; d >= 0 && ++offset[d] > radius; d--) {
+			offset[d] = -radius;
+		}
+	}
+
+	free(offset);
+	free(zero);
+	free(delta);
+	if (!ok)
+		lattice_free(lat);
+	return ok;
+}
+
+static inline uint32_t lattice_hash(const lattice_t *lat, uint64_t key)
+{
+	uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+	return (uint32_t)(h >> (64 - lat->hash_bits));
+}
+
+/* First point in a cell, -1 if empty */
+static inline int lattice_find(const lattice_t *lat, uint64_t key)
+{
+	if (lat->head)
+		return lat->head[key];
+
+	size_t mask = ((size_t)1 << lat->hash_bits) - 1;
+	for (size_t h = lattice_hash(lat, key);; h = (h + 1) & mask) {
+		if (lat->slots[h] < 0 || lat->keys[h] == key)
+			return lat->slots[h];
+	}
+}
+
+/* Index lat->cell[0 .. num_points) for lookup */
+static int lattice_index_cells(lattice_t *lat, int num_points)
+{
+	lat->next = (int *)malloc(num_points * sizeof(int));
+	if (!lat->next)
+		return 0;
+
+	if (lat->volume <= (uint64_t)LATTICE_DENSE_CELLS * num_points) {
+		lat->head = (int *)malloc(lat->volume * sizeof(int));
+		if (!lat->head)
+			return 0;
+		memset(lat->head, 0xff, lat->volume * sizeof(int));
+		for (int i = num_points - 1; i >= 0; i--) {
+			lat->next[i] = lat->head[lat->cell[i]];
+			lat->head[lat->cell[i]] = i;
+		}
+		return 1;
+	}
+
+	/* At most half full */
+	lat->hash_bits = 1;
+	while (((size_t)1 << lat->hash_bits) < 2 * (size_t)num_points) {
+		lat->hash_bits++;
+	}
+	size_t size = (size_t)1 << lat->hash_bits;
+	lat->keys = (uint64_t *)malloc(size * sizeof(uint64_t));
+	lat->slots = (int *)malloc(size * sizeof(int));
+	if (!lat->keys || !lat->slots)
+		return 0;
+	memset(lat->slots, 0xff, size * sizeof(int));
+
+	size_t mask = size - 1;
+	for (int i = num_points - 1; i >= 0; i--) {
+		uint64_t key = lat->cell[i];
+		size_t h = lattice_hash(lat, key);
+		while (lat->slots[h] >= 0 && lat->keys[h] != key) {
+			h = (h + 1) & mask;
+		}
+		lat->next[i] = lat->slots[h];
+		lat->keys[h] = key;
+		lat->slots[h] = i;
+	}
+	return 1;
+}
+
+static int lattice_index_visit(const nbr_index_t *index, int idx,
+			       visit_fn_t fn, void *arg)
+{
+	const lattice_t *lat = (const lattice_t *)index->impl;
+	uint64_t cell = lat->cell[idx];
+
+	for (int s = 0; s < lat->stencil_size; s++) {
+		int p = lattice_find(lat, cell + (uint64_t)lat->stencil[s]);
+		for (; p >= 0; p = lat->next[p]) {
+			if (fn(arg, p))
+				return 1;
+		}
+	}
+	return 0;
+}
+
+/* Index the cells set up by the caller and run the engine */
+static int cluster_lattice(lattice_t *lat, int num_points,
+			   const cdbscan_params_t *params, thread_pool_t *pool,
+			   scratch_t *scratch, int *labels)
+{
+	if (!lattice_index_cells(lat, num_points))
+		return -1;
+
+	nbr_index_t index = { .visit = lattice_index_visit,
+			      .impl = lat,
+			      .pool = pool,
+			      .num_points = num_points,
+			      .params = params };
+	return cluster_index(&index, params->min_pts, 0, NULL, scratch, labels);
+}
+
+int cdbscan_cluster_lattice(cdbscan_context_t *ctx,
+			    const cdbscan_int_dataset_t *data,
+			    cdbscan_params_t params, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !data || !data->coords ||
+	    data->num_points <= 0 || data->dimensions <= 0 || !labels)
+		return -1;
+
+	int num_points = data->num_points;
+	int dims = data->dimensions;
+	const int32_t *coords = data->coords;
+
+	int64_t *low = (int64_t *)malloc(dims * sizeof(int64_t));
+	int64_t *extent = (int64_t *)malloc(dims * sizeof(int64_t));
+	if (!low || !extent) {
+		free(low);
+		free(extent);
+		return -1;
+	}
+	for (int d = 0; d < dims; d++) {
+		int64_t lo = coords[d], hi = coords[d];
+		for (int i = 1; i < num_points; i++) {
+			int64_t c = coords[(size_t)i * dims + d];
+			lo = c < lo ? c : lo;
+			hi = c > hi ? c : hi;
+		}
+		low[d] = lo;
+		extent[d] = hi - lo + 1;
+	}
+
+	lattice_t lat;
+	int num_clusters = -1;
+	if (lattice_init(&lat, extent, dims, &params)) {
+		lat.cell = (uint64_t *)malloc(num_points * sizeof(uint64_t));
+		if (lat.cell) {
+			for (int i = 0; i < num_points; i++) {
+				const int32_t *c = coords + (size_t)i * dims;
+				uint64_t cell = 0;
+				for (int d = 0; d < dims; d++) {
+					cell += (uint64_t)(c[d] - low[d] +
+							   lat.radius) *
+						lat.stride[d];
+				}
+				lat.cell[i] = cell;
+			}
+
+			call_env_t env;
+			call_begin(&env, ctx, params.num_threads);
+			num_clusters = cluster_lattice(&lat, num_points,
+						       &params, env.pool,
+						       env.scratch, labels);
+			call_end(&env);
+		}
+		lattice_free(&lat);
+	}
+
+	free(low);
+	free(extent);
+	return num_clusters;
+}
+
+int cdbscan_cluster_raster(cdbscan_context_t *ctx,
+			   const unsigned char *occupied, const int *shape,
+			   int dims, cdbscan_params_t params, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !occupied || !shape ||
+	    dims <= 0 || !labels)
+		return -1;
+
+	int64_t *extent = (int64_t *)malloc(dims * sizeof(int64_t));
+	int *pos = (int *)calloc(dims, sizeof(int));
+	if (!extent || !pos) {
+		free(extent);
+		free(pos);
+		return -1;
+	}
+
+	size_t num_cells = 1;
+	int ok = 1;
+	for (int d = 0; d < dims; d++) {
+		if (shape[d] <= 0 || (size_t)shape[d] > SIZE_MAX / num_cells)
+			ok = 0;
+		else
+			num_cells *= shape[d];
+		extent[d] = shape[d];
+	}
+
+	size_t num_points = 0;
+	for (size_t i = 0; ok && i < num_cells; i++) {
+		num_points += occupied[i] != 0;
+	}
+	if (num_points == 0 || num_points > INT_MAX)
+		ok = 0;
+
+	lattice_t lat;
+	int num_clusters = -1;
+	if (ok && lattice_init(&lat, extent, dims, &params)) {
+		/* Points are the occupied cells in raster order */
+		lat.cell = (uint64_t *)malloc(num_points * sizeof(uint64_t));
+		int *point_labels = (int *)malloc(num_points * sizeof(int));
+		if (lat.cell && point_labels) {
+			uint64_t origin = 0;
+			for (int d = 0; d < dims; d++) {
+				origin += (uint64_t)lat.radius * lat.stride[d];
+			}
+
+			size_t n = 0;
+			uint64_t cell = origin;
+			for (size_t i = 0; i < num_cells; i++) {
+				if (occupied[i])
+					lat.cell[n++] = cell;
+				/* Step to the next raster cell */
+				for (int d = dims - 1; d >= 0; d--) {
+					cell += lat.stride[d];
+					if (++pos[d] < shape[d])
+						break;
+					pos[d] = 0;
+					cell -= (uint64_t)shape[d] *
+						lat.stride[d];
+				}
+			}
+
+			call_env_t env;
+			call_begin(&env, ctx, params.num_threads);
+			num_clusters = cluster_lattice(&lat, (int)num_points,
+						       &params, env.pool,
+						       env.scratch,
+						       point_labels);
+			call_end(&env);
+
+			for (size_t i = 0, p = 0;
+			     num_clusters >= 0 && i < num_cells; i++) {
+				labels[i] = occupied[i] ? point_labels[p++] :
+							  CDBSCAN_UNCLASSIFIED;
+			}
+		}
+		free(point_labels);
+		lattice_free(&lat);
+	}
+
+	free(extent);
+	free(pos);
+	return num_clusters;
+}
+
+/* Integer coordinates
+ *
+ * Euclidean and Manhattan distances between int32 points are computed
+ * exactly in 64-bit integers and compared with eps^2 (or eps) rounded
+ * down to an integer, which is exact because the distances are integers.
+ * Each axis difference is clamped to the smallest integer above eps
+ * before it is squared: a clamped axis alone puts the pair out of range,
+ * and the clamp keeps the sum from overflowing, without a branch per
+ * axis. The KD-tree over integer points keeps integer bounds and prunes
+ * with the same exact test.
+ */
+typedef struct {
+	int64_t limit; /* Axis differences are clamped to this */
+	uint64_t max; /* Largest in-range sum */
+	int squared; /* Sum squares (Euclidean) or values (Manhattan) */
+} int_metric_t;
+
+/* Largest integer not above eps^2, exactly */
+static uint64_t int_floor_square(double eps)
+{
+	int exp;
+	double frac = frexp(eps, &exp);
+	uint64_t mant = (uint64_t)ldexp(frac, 53);
+	unsigned __int128 square = (unsigned __int128)mant * mant;
+
+	/* eps^2 = square / 2^shift, and eps < 2^31 makes shift at least 44 */
+	int shift = 106 - 2 * exp;
+	return shift >= 128 ? 0 : (uint64_t)(square >> shift);
+}
+
+/* Returns 0 if the metric has no exact integer form or eps is too large
+ * for the sums to fit in 64 bits */
+static int int_metric_init(int_metric_t *m, const cdbscan_params_t *params,
+			   int dims)
+{
+	if (params->dist_type != CDBSCAN_DIST_EUCLIDEAN &&
+	    params->dist_type != CDBSCAN_DIST_MANHATTAN)
+		return 0;
+	if (!(params->eps < INT32_MAX))
+		return 0;
+
+	m->limit = (int64_t)floor(params->eps) + 1;
+	m->squared = params->dist_type == CDBSCAN_DIST_EUCLIDEAN;
+	if (m->squared) {
+		uint64_t limit2 = (uint64_t)m->limit * m->limit;
+		if ((uint64_t)dims > UINT64_MAX / limit2)
+			return 0;
+		m->max = int_floor_square(params->eps);
+	} else {
+		m->max = (uint64_t)floor(params->eps);
+	}
+	return 1;
+}
+
+static inline uint64_t int_dist(const int_metric_t *m, const int32_t *a,
+				const int32_t *b, int dims)
+{
+	uint64_t sum = 0;
+
+	if (m->squared) {
+		for (int d = 0; d < dims; d++) {
+			int64_t diff = (int64_t)a[d] - b[d];
+			diff = diff < 0 ? -diff : diff;
+			diff = diff < m->limit ? diff : m->limit;
+			sum += (uint64_t)(diff * diff);
+		}
+	} else {
+		for (int d = 0; d < dims; d++) {
+			int64_t diff = (int64_t)a[d] - b[d];
+			diff = diff < 0 ? -diff : diff;
+			sum += (uint64_t)(diff < m->limit ? diff : m->limit);
+		}
+	}
+	return sum;
+}
+
+typedef struct {
+	kdtree_node_t *nodes;
+	int32_t *bounds; /* Per node: dims minima followed by dims maxima */
+	int *perm; /* Point indices in tree order */
+	const int32_t *coords;
+	int num_nodes;
+	int num_points;
+	int dimensions;
+	scratch_t *scratch;
+} int_kdtree_t;
+
+static void int_nth_element(int *perm, const int32_t *coords, int dims,
+			    int left, int right, int n, int dim)
+{
+	while (left < right) {
+		int32_t pivot =
+			coords[(size_t)perm[(left + right) / 2] * dims + dim];
+		int lt = left, i = left, gt = right;
+
+		while (i <= gt) {
+			int32_t val = coords[(size_t)perm[i] * dims + dim];
+			int temp;
+			if (val < pivot) {
+				temp = perm[lt];
+				perm[lt++] = perm[i];
+				perm[i++] = temp;
+			} else if (val > pivot) {
+				temp = perm[gt];
+				perm[gt--] = perm[i];
+				perm[i] = temp;
+			} else {
+				i++;
+			}
+		}
+
+		if (n < lt)
+			right = lt - 1;
+		else if (n > gt)
+			left = gt + 1;
+		else
+			return;
+	}
+}
+
+static void int_kdtree_build_subtree(int_kdtree_t *tree, int node)
+{
+	kdtree_node_t *nd = &tree->nodes[node];
+	int dims = tree->dimensions;
+	int lo = nd->lo, hi = nd->hi;
+	int32_t *min = tree->bounds + (size_t)node * 2 * dims;
+	int32_t *max = min + dims;
+
+	nd->left = -1;
+	nd->right = -1;
+	memcpy(min, tree->coords + (size_t)tree->perm[lo] * dims,
+	       dims * sizeof(int32_t));
+	memcpy(max, min, dims * sizeof(int32_t));
+	for (int i = lo + 1; i < hi; i++) {
+		const int32_t *p = tree->coords + (size_t)tree->perm[i] * dims;
+		for (int d = 0; d < dims; d++) {
+			min[d] = p[d] < min[d] ? p[d] : min[d];
+			max[d] = p[d] > max[d] ? p[d] : max[d];
+		}
+	}
+	if (hi - lo <= KDTREE_LEAF_SIZE)
+		return;
+
+	int split_dim = 0;
+	for (int d = 1; d < dims; d++) {
+		if ((int64_t)max[d] - min[d] >
+		    (int64_t)max[split_dim] - min[split_dim])
+			split_dim = d;
+	}
+	if (max[split_dim] == min[split_dim])
+		return; /* All points coincide */
+
+	int mid = lo + (hi - lo) / 2;
+	int_nth_element(tree->perm, tree->coords, dims, lo, hi - 1, mid,
+			split_dim);
+
+	int child = tree->num_nodes;
+	tree->num_nodes += 2;
+	tree->nodes[child].lo = lo;
+	tree->nodes[child].hi = mid;
+	tree->nodes[child + 1].lo = mid;
+	tree->nodes[child + 1].hi = hi;
+	nd->left = child;
+	nd->right = child + 1;
+
+	int_kdtree_build_subtree(tree, child);
+	int_kdtree_build_subtree(tree, child + 1);
+}
+
+static void int_kdtree_free(int_kdtree_t *tree)
+{
+	if (!tree)
+		return;
+	scratch_put(tree->scratch, tree->nodes);
+	scratch_put(tree->scratch, tree->bounds);
+	scratch_put(tree->scratch, tree->perm);
+	free(tree);
+}
+
+static int_kdtree_t *int_kdtree_build(const int32_t *coords, int num_points,
+				      int dims, scratch_t *scratch)
+{
+	int_kdtree_t *tree = (int_kdtree_t *)calloc(1, sizeof(int_kdtree_t));
+	if (!tree)
+		return NULL;
+
+	int max_nodes = kdtree_max_nodes(num_points);
+	tree->coords = coords;
+	tree->num_points = num_points;
+	tree->dimensions = dims;
+	tree->scratch = scratch;
+	tree->nodes = (kdtree_node_t *)scratch_get(
+		scratch, SCRATCH_TREE_NODES,
+		max_nodes * sizeof(kdtree_node_t));
+	tree->bounds = (int32_t *)scratch_get(
+		scratch, SCRATCH_TREE_BOUNDS,
+		(size_t)max_nodes * 2 * dims * sizeof(int32_t));
+	tree->perm = (int *)scratch_get(scratch, SCRATCH_TREE_PERM,
+					num_points * sizeof(int));
+	if (!tree->nodes || !tree->bounds || !tree->perm) {
+		int_kdtree_free(tree);
+		return NULL;
+	}
+
+	for (int i = 0; i < num_points; i++) {
+		tree->perm[i] = i;
+	}
+	tree->num_nodes = 1;
+	tree->nodes[0].lo = 0;
+	tree->nodes[0].hi = num_points;
+	int_kdtree_build_subtree(tree, 0);
+	return tree;
+}
+
+/* Distance from a query to a node's box, clamped like int_dist() */
+static inline uint64_t int_box_dist(const int_metric_t *m,
+				    const int_kdtree_t *tree, int node,
+				    const int32_t *query)
+{
+	int dims = tree->dimensions;
+	const int32_t *min = tree->bounds + (size_t)node * 2 * dims;
+	const int32_t *max = min + dims;
+	uint64_t sum = 0;
+
+	for (int d = 0; d < dims; d++) {
+		int64_t below = (int64_t)min[d] - query[d];
+		int64_t above = (int64_t)query[d] - max[d];
+		int64_t diff = below > above ? below : above;
+		diff = diff > 0 ? diff : 0;
+		diff = diff < m->limit ? diff : m->limit;
+		sum += m->squared ? (uint64_t)(diff * diff) : (uint64_t)diff;
+	}
+	return sum;
+}
+
+typedef struct {
+	int_metric_t metric;
+	const int32_t *coords;
+	const int_kdtree_t *tree; /* NULL for brute force */
+} int_index_t;
+
+static int int_brute_visit(const nbr_index_t *index, int idx, visit_fn_t fn,
+			   void *arg)
+{
+	const int_index_t *ii = (const int_index_t *)index->impl;
+	int dims = index->dims;
+	const int32_t *query = ii->coords + (size_t)idx * dims;
+
+	for (int i = 0; i < index->num_points; i++) {
+		const int32_t *p = ii->coords + (size_t)i * dims;
+		if (int_dist(&ii->metric, query, p, dims) <= ii->metric.max &&
+		    fn(arg, i))
+			return 1;
+	}
+	return 0;
+}
+
+static int int_kdtree_visit(const nbr_index_t *index, int idx,
+			    visit_fn_t fn, void *arg)
+{
+	const int_index_t *ii = (const int_index_t *)index->impl;
+	const int_kdtree_t *tree = ii->tree;
+	int dims = index->dims;
+	const int32_t *query = ii->coords + (size_t)idx * dims;
+	int stack[KDTREE_MAX_DEPTH];
+	int top = 0;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		if (int_box_dist(&ii->metric, tree, node, query) >
+		    ii->metric.max)
+			continue;
+
+		const kdtree_node_t *nd = &tree->nodes[node];
+		if (nd->left < 0) {
+			for (int i = nd->lo; i < nd->hi; i++) {
+				int p = tree->perm[i];
+				const int32_t *c =
+					ii->coords + (size_t)p * dims;
+				if (int_dist(&ii->metric, query, c, dims) <=
+					    ii->metric.max &&
+				    fn(arg, p))
+					return 1;
+			}
+			continue;
+		}
+
+		stack[top++] = nd->right;
+		stack[top++] = nd->left;
+	}
+	return 0;
+}
+
+/* Metrics without an exact integer form cluster a double copy */
+static int cluster_int_as_double(const cdbscan_int_dataset_t *data,
+				 const cdbscan_params_t *params,
+				 thread_pool_t *pool, scratch_t *scratch,
+				 int *labels)
+{
+	size_t count = (size_t)data->num_points * data->dimensions;
+	double *coords = (double *)scratch_get(scratch, SCRATCH_COORDS,
+					       count * sizeof(double));
+	if (!coords)
+		return -1;
+	for (size_t i = 0; i < count; i++) {
+		coords[i] = data->coords[i];
+	}
+
+	int num_clusters = cluster_packed(coords, data->num_points,
+					  data->dimensions, params, NULL, pool,
+					  scratch, labels);
+	scratch_put(scratch, coords);
+	return num_clusters;
+}
+
+int cdbscan_cluster_int_dataset(cdbscan_context_t *ctx,
+				const cdbscan_int_dataset_t *data,
+				cdbscan_params_t params, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !data || !data->coords ||
+	    data->num_points <= 0 || data->dimensions <= 0 || !labels)
+		return -1;
+
+	int dims = data->dimensions;
+	int_index_t ii = { .coords = data->coords };
+	int exact = int_metric_init(&ii.metric, &params, dims);
+	if (!exact && (params.dist_type == CDBSCAN_DIST_EUCLIDEAN ||
+		       params.dist_type == CDBSCAN_DIST_MANHATTAN))
+		return -1; /* eps too large */
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+	int num_clusters = -1;
+
+	if (!exact) {
+		num_clusters = cluster_int_as_double(data, &params, env.pool,
+						     env.scratch, labels);
+	} else {
+		nbr_index_t index = { .visit = int_brute_visit,
+				      .impl = &ii,
+				      .pool = env.pool,
+				      .num_points = data->num_points,
+				      .dims = dims,
+				      .params = &params };
+		int_kdtree_t *tree = NULL;
+		if (params.use_kdtree) {
+			tree = int_kdtree_build(data->coords, data->num_points,
+						dims, env.scratch);
+			if (tree) {
+				ii.tree = tree;
+				index.visit = int_kdtree_visit;
+			}
+		}
+		num_clusters = cluster_index(&index, params.min_pts, 0, NULL,
+					     env.scratch, labels);
+		int_kdtree_free(tree);
+	}
+
+	call_end(&env);
+	return num_clusters;
+}
+
+/* Quantized coordinates
+ *
+ * Each coordinate is stored as an 8 or 16-bit code on a per-dimension
+ * grid spanning the data, and the KD-tree and distance kernels work on
+ * the codes. A code is within half a grid step of the value it encodes,
+ * so a distance computed on codes is within band of the true distance,
+ * band being the metric applied to one grid step per axis. Pairs closer
+ * than eps - band are neighbors and pairs beyond eps + band are not;
+ * only pairs in between are checked against the original coordinates,
+ * with the same distance function as the unquantized path, so the
+ * labels do not change. Distances on codes are compared as sums of
+ * |diff|^p against the band edges raised to p.
+ */
+typedef struct {
+	int bits;
+	int dims;
+	int num_points;
+	uint8_t *codes8; /* Row-major codes when bits == 8 */
+	uint16_t *codes16; /* Row-major codes when bits == 16 */
+	double *low; /* Per dimension: value of code 0 */
+	double *step; /* Per dimension: value between adjacent codes */
+	double p; /* Distances are sums of |diff|^p */
+	double inner; /* (eps - band)^p, or -1 if nothing is sure */
+	double outer; /* (eps + band)^p */
+	const double *coords; /* Original coordinates, for the band */
+	const cdbscan_params_t *params;
+	unsigned long long verified;
+
+	kdtree_node_t *nodes;
+	uint16_t *bounds; /* Per node: dims minimum codes, dims maximum */
+	int *perm;
+	int num_nodes;
+} quant_index_t;
+
+static inline int quant_code(const quant_index_t *q, size_t i)
+{
+	return q->bits == 8 ? q->codes8[i] : q->codes16[i];
+}
+
+static inline double quant_term(const quant_index_t *q, double diff)
+{
+	diff = fabs(diff);
+	if (q->p == 2.0)
+		return diff * diff;
+	if (q->p == 1.0)
+		return diff;
+	return pow(diff, q->p);
+}
+
+typedef struct {
+	quant_index_t *q;
+	const double *coords;
+} quant_encode_job_t;
+
+static void quant_encode_task(void *arg, int begin, int end, int worker)
+{
+	quant_encode_job_t *job = (quant_encode_job_t *)arg;
+	quant_index_t *q = job->q;
+	int dims = q->dims;
+	double top = (double)((1 << q->bits) - 1);
+
+	for (size_t i = (size_t)begin * dims; i < (size_t)end * dims; i++) {
+		int d = (int)(i % dims);
+		double code = q->step[d] > 0 ?
+				      nearbyint((job->coords[i] - q->low[d]) /
+						q->step[d]) :
+				      0.0;
+		code = code < 0 ? 0 : code > top ? top : code;
+		if (q->bits == 8)
+			q->codes8[i] = (uint8_t)code;
+		else
+			q->codes16[i] = (uint16_t)code;
+	}
+}
+
+static void quant_nth_element(const quant_index_t *q, int left, int right,
+			      int n, int dim)
+{
+	int *perm = q->perm;
+	int dims = q->dims;
+
+	while (left < right) {
+		int pivot =
+			quant_code(q, (size_t)perm[(left + right) / 2] * dims +
+					      dim);
+		int lt = left, i = left, gt = right;
+
+		while (i <= gt) {
+			int val = quant_code(q, (size_t)perm[i] * dims + dim);
+			int temp;
+			if (val < pivot) {
+				temp = perm[lt];
+				perm[lt++] = perm[i];
+				perm[i++] = temp;
+			} else if (val > pivot) {
+				temp = perm[gt];
+				perm[gt--] = perm[i];
+				perm[i] = temp;
+			} else {
+				i++;
+			}
+		}
+
+		if (n < lt)
+			right = lt - 1;
+		else if (n > gt)
+			left = gt + 1;
+		else
+			return;
+	}
+}
+
+static void quant_build_subtree(quant_index_t *q, int node)
+{
+	kdtree_node_t *nd = &q->nodes[node];
+	int dims = q->dims;
+	int lo = nd->lo, hi = nd->hi;
+	uint16_t *min = q->bounds + (size_t)node * 2 * dims;
+	uint16_t *max = min + dims;
+
+	nd->left = -1;
+	nd->right = -1;
+	for (int d = 0; d < dims; d++) {
+		min[d] = UINT16_MAX;
+		max[d] = 0;
+	}
+	for (int i = lo; i < hi; i++) {
+		size_t row = (size_t)q->perm[i] * dims;
+		for (int d = 0; d < dims; d++) {
+			int c = quant_code(q, row + d);
+			min[d] = c < min[d] ? c : min[d];
+			max[d] = c > max[d] ? c : max[d];
+		}
+	}
+	if (hi - lo <= KDTREE_LEAF_SIZE)
+		return;
+
+	/* Widest in real units, not in codes */
+	int split_dim = 0;
+	double widest = -1.0;
+	for (int d = 0; d < dims; d++) {
+		double width = (max[d] - min[d]) * q->step[d];
+		if (max[d] > min[d] && width > widest) {
+			widest = width;
+			split_dim = d;
+		}
+	}
+	if (widest < 0)
+		return; /* All codes coincide */
+
+	int mid = lo + (hi - lo) / 2;
+	quant_nth_element(q, lo, hi - 1, mid, split_dim);
+
+	int child = q->num_nodes;
+	q->num_nodes += 2;
+	q->nodes[child].lo = lo;
+	q->nodes[child].hi = mid;
+	q->nodes[child + 1].lo = mid;
+	q->nodes[child + 1].hi = hi;
+	nd->left = child;
+	nd->right = child + 1;
+
+	quant_build_subtree(q, child);
+	quant_build_subtree(q, child + 1);
+}
+
+static void quant_free(quant_index_t *q)
+{
+	free(q->codes8);
+	free(q->codes16);
+	free(q->low);
+	free(q->step);
+	free(q->nodes);
+	free(q->bounds);
+	free(q->perm);
+}
+
+/* Quantize coordinates and index the codes. Returns 0 if out of memory
+ * or if the metric has no band (see cdbscan_cluster_quantized()). */
+static int quant_init(quant_index_t *q, const cdbscan_dataset_t *data,
+		      int bits, const cdbscan_params_t *params,
+		      thread_pool_t *pool)
+{
+	int dims = data->dimensions;
+	int num_points = data->num_points;
+
+	memset(q, 0, sizeof(*q));
+	if (params->dist_type == CDBSCAN_DIST_EUCLIDEAN)
+		q->p = 2.0;
+	else if (params->dist_type == CDBSCAN_DIST_MANHATTAN)
+		q->p = 1.0;
+	else if (params->dist_type == CDBSCAN_DIST_MINKOWSKI &&
+		 params->minkowski_p >= 1.0)
+		q->p = params->minkowski_p; /* A metric only for p >= 1 */
+	else
+		return 0;
+
+	size_t count = (size_t)num_points * dims;
+	int max_nodes = kdtree_max_nodes(num_points);
+	q->bits = bits;
+	q->dims = dims;
+	q->num_points = num_points;
+	q->coords = data->coords;
+	q->params = params;
+	q->low = (double *)malloc(dims * sizeof(double));
+	q->step = (double *)malloc(dims * sizeof(double));
+	if (bits == 8)
+		q->codes8 = (uint8_t *)malloc(count);
+	else
+		q->codes16 = (uint16_t *)malloc(count * sizeof(uint16_t));
+	q->nodes = (kdtree_node_t *)malloc(max_nodes * sizeof(kdtree_node_t));
+	q->bounds = (uint16_t *)malloc((size_t)max_nodes * 2 * dims *
+				       sizeof(uint16_t));
+	q->perm = (int *)malloc(num_points * sizeof(int));
+	if (!q->low || !q->step || (!q->codes8 && !q->codes16) ||
+	    !q->nodes || !q->bounds || !q->perm) {
+		quant_free(q);
+		return 0;
+	}
+
+	double band = 0.0;
+	for (int d = 0; d < dims; d++) {
+		double lo = data->coords[d], hi = data->coords[d];
+		for (int i = 1; i < num_points; i++) {
+			double c = data->coords[(size_t)i * dims + d];
+			lo = c < lo ? c : lo;
+			hi = c > hi ? c : hi;
+		}
+		q->low[d] = lo;
+		q->step[d] = (hi - lo) / ((1 << bits) - 1);
+		band += quant_term(q, q->step[d]);
+	}
+
+	/* Two codes are off by up to one step per axis together. Widen the
+	 * band for rounding in the sums: a wider band only costs checks. */
+	band = pow(band, 1.0 / q->p) * (1.0 + 1e-9) + params->eps * 1e-12;
+	double inner = params->eps - band;
+	q->inner = inner > 0 ? quant_term(q, inner) : -1.0;
+	q->outer = quant_term(q, params->eps + band);
+
+	quant_encode_job_t job = { q, data->coords };
+	pool_parallel_for(pool, num_points, 0, quant_encode_task, &job);
+
+	for (int i = 0; i < num_points; i++) {
+		q->perm[i] = i;
+	}
+	q->num_nodes = 1;
+	q->nodes[0].lo = 0;
+	q->nodes[0].hi = num_points;
+	quant_build_subtree(q, 0);
+	return 1;
+}
+
+/* Code-space distance from a query to a node's box */
+static inline double quant_box_dist(const quant_index_t *q, int node,
+				    size_t query)
+{
+	int dims = q->dims;
+	const uint16_t *min = q->bounds + (size_t)node * 2 * dims;
+	const uint16_t *max = min + dims;
+	double sum = 0.0;
+
+	for (int d = 0; d < dims; d++) {
+		int c = quant_code(q, query + d);
+		int gap = c < min[d] ? min[d] - c : c > max[d] ? c - max[d] : 0;
+		sum += quant_term(q, gap * q->step[d]);
+	}
+	return sum;
+}
+
+/* Neighbor test for a pair: on codes when sure, on coordinates in the
+ * band */
+static int quant_within(quant_index_t *q, int a, int b)
+{
+	int dims = q->dims;
+	size_t ra = (size_t)a * dims, rb = (size_t)b * dims;
+	double sum = 0.0;
+
+	for (int d = 0; d < dims; d++) {
+		int diff = quant_code(q, ra + d) - quant_code(q, rb + d);
+		sum += quant_term(q, diff * q->step[d]);
+	}
+	if (sum <= q->inner)
+		return 1;
+	if (sum > q->outer)
+		return 0;
+
+	__atomic_fetch_add(&q->verified, 1, __ATOMIC_RELAXED);
+	double dist = calculate_distance(q->coords + ra, q->coords + rb, dims,
+					 q->params);
+	return dist >= 0 && dist <= q->params->eps;
+}
+
+static int quant_index_visit(const nbr_index_t *index, int idx,
+			     visit_fn_t fn, void *arg)
+{
+	quant_index_t *q = (quant_index_t *)index->impl;
+	size_t query = (size_t)idx * q->dims;
+	int stack[KDTREE_MAX_DEPTH];
+	int top = 0;
+
+	stack[top++] = 0;
+	while (top > 0) {
+		int node = stack[--top];
+		if (quant_box_dist(q, node, query) > q->outer)
+			continue;
+
+		const kdtree_node_t *nd = &q->nodes[node];
+		if (nd->left < 0) {
+			for (int i = nd->lo; i < nd->hi; i++) {
+				int p = q->perm[i];
+				if (quant_within(q, idx, p) && fn(arg, p))
+					return 1;
+			}
+			continue;
+		}
+
+		stack[top++] = nd->right;
+		stack[top++] = nd->left;
+	}
+	return 0;
+}
+
+int cdbscan_cluster_quantized(cdbscan_context_t *ctx,
+			      const cdbscan_dataset_t *data,
+			      cdbscan_quant_opts_t *opts,
+			      cdbscan_params_t params, int *labels)
+{
+	if (!cdbscan_validate_params(&params) || !dataset_valid(data) ||
+	    !opts || (opts->bits != 8 && opts->bits != 16) || !labels)
+		return -1;
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+
+	quant_index_t q;
+	int num_clusters = -1;
+	opts->verified = 0;
+	if (quant_init(&q, data, opts->bits, &params, env.pool)) {
+		nbr_index_t index = { .visit = quant_index_visit,
+				      .impl = &q,
+				      .pool = env.pool,
+				      .num_points = data->num_points,
+				      .dims = data->dimensions,
+				      .params = &params };
+		num_clusters = cluster_index(&index, params.min_pts, 0, NULL,
+					     env.scratch, labels);
+		opts->verified = q.verified;
+		quant_free(&q);
+	} else if (!q.p) {
+		/* No band for this metric: cluster the original data */
+		num_clusters = cluster_packed(data->coords, data->num_points,
+					      data->dimensions, &params, NULL,
+					      env.pool, env.scratch, labels);
+	}
+
+	call_end(&env);
+	return num_clusters;
+}
+
+/* Product quantization
+ *
+ * The dimensions are cut into num_subspaces groups and each group of a
+ * vector is replaced by the index of the nearest of up to 256 centroids
+ * trained by k-means on a sample, so a point costs one byte per group.
+ * Points are also partitioned by a coarse k-means into lists, stored
+ * together, each with the radius of its members around its center.
+ *
+ * A region query builds a table of squared distances from the query
+ * (the exact vector when given, else its reconstruction) to every
+ * centroid of every group; the approximate squared distance to a point
+ * is then one table lookup per group. Lists whose center is too far for
+ * any member to pass are skipped: an approximate distance differs from
+ * the distance to the point by at most the largest reconstruction error.
+ * With exact vectors and a rerank band, approximate distances within
+ * eps * (1 +- rerank) are recomputed exactly.
+ */
+#define PQ_CODES 256
+#define PQ_TRAIN_POINTS (PQ_CODES * 40)
+#define PQ_ITERATIONS 15
+#define PQ_MAX_LISTS 1024
+#define PQ_LIST_TRAIN 64 /* Sampled points per coarse center */
+
+struct cdbscan_pq {
+	int num_points;
+	int dims;
+	int num_subspaces;
+	int *sub_start; /* First dimension of each group, then dims */
+	int num_codes; /* Centroids per group */
+	double *codebooks; /* Group m, code k at codebooks + num_codes *
+			      sub_start[m] + k * width(m) */
+	uint8_t *codes; /* num_subspaces codes per row, rows in list order */
+	int *ids; /* Point of each row */
+	int *row; /* Row of each point */
+	int num_lists;
+	double *centers; /* Coarse centers, dims each */
+	double *radius; /* Largest member distance from each center */
+	int *list_start; /* First row of each list, then num_points */
+	double max_error; /* Largest distance of a point to its codes */
+};
+
+/* Nearest of k centers of the given width; sets its squared distance */
+static int pq_nearest(const double *x, const double *centers, int k,
+		      int width, double *best_dist2)
+{
+	int best = 0;
+	double best_d2 = DBL_MAX;
+
+	for (int c = 0; c < k; c++) {
+		double d2 = dist2(x, centers + (size_t)c * width, width);
+		if (d2 < best_d2) {
+			best_d2 = d2;
+			best = c;
+		}
+	}
+	if (best_dist2)
+		*best_dist2 = best_d2;
+	return best;
+}
+
+/* Lloyd's k-means on dimensions [offset, offset + width) of the sampled
+ * rows. Empty clusters are reseeded from a random sample. */
+static int pq_kmeans(const double *coords, int dims, const int *sample,
+		     int count, int offset, int width, int k, uint64_t seed,
+		     double *centers)
+{
+	double *points = (double *)malloc((size_t)count * width *
+					  sizeof(double));
+	double *sums = (double *)malloc((size_t)k * width * sizeof(double));
+	int *sizes = (int *)malloc(k * sizeof(int));
+	int *assign = (int *)malloc(count * sizeof(int));
+	if (!points || !sums || !sizes || !assign) {
+		free(points);
+		free(sums);
+		free(sizes);
+		free(assign);
+		return 0;
+	}
+
+	for (int i = 0; i < count; i++) {
+		memcpy(points + (size_t)i * width,
+		       coords + (size_t)sample[i] * dims + offset,
+		       width * sizeof(double));
+	}
+	/* The sample is in random order, so its head is a random start */
+	memcpy(centers, points, (size_t)k * width * sizeof(double));
+
+	for (int iter = 0; iter < PQ_ITERATIONS; iter++) {
+		int changed = 0;
+		for (int i = 0; i < count; i++) {
+			int c = pq_nearest(points + (size_t)i * width, centers,
+					   k, width, NULL);
+			changed += iter == 0 || c != assign[i];
+			assign[i] = c;
+		}
+		if (!changed)
+			break;
+
+		memset(sums, 0, (size_t)k * width * sizeof(double));
+		memset(sizes, 0, k * sizeof(int));
+		for (int i = 0; i < count; i++) {
+			double *sum = sums + (size_t)assign[i] * width;
+			const double *p = points + (size_t)i * width;
+			for (int d = 0; d < width; d++) {
+				sum[d] += p[d];
+			}
+			sizes[assign[i]]++;
+		}
+		for (int c = 0; c < k; c++) {
+			double *center = centers + (size_t)c * width;
+			if (sizes[c] == 0) {
+				int pick = (int)(rng_next(&seed) % count);
+				memcpy(center, points + (size_t)pick * width,
+				       width * sizeof(double));
+				continue;
+			}
+			for (int d = 0; d < width; d++) {
+				center[d] = sums[(size_t)c * width + d] /
+					    sizes[c];
+			}
+		}
+	}
+
+	free(points);
+	free(sums);
+	free(sizes);
+	free(assign);
+	return 1;
+}
+
+static inline int pq_width(const cdbscan_pq_t *pq, int m)
+{
+	return pq->sub_start[m + 1] - pq->sub_start[m];
+}
+
+static inline const double *pq_centroid(const cdbscan_pq_t *pq, int m,
+					int code)
+{
+	return pq->codebooks + (size_t)pq->num_codes * pq->sub_start[m] +
+	       (size_t)code * pq_width(pq, m);
+}
+
+/* Vector a row of codes stands for */
+static void pq_decode(const cdbscan_pq_t *pq, int row, double *out)
+{
+	const uint8_t *code = pq->codes + (size_t)row * pq->num_subspaces;
+	for (int m = 0; m < pq->num_subspaces; m++) {
+		memcpy(out + pq->sub_start[m], pq_centroid(pq, m, code[m]),
+		       pq_width(pq, m) * sizeof(double));
+	}
+}
+
+typedef struct {
+	cdbscan_pq_t *pq;
+	const double *coords;
+	const int *sample;
+	int count;
+	int num_lists; /* Coarse lists to train, as task num_subspaces */
+	uint64_t seed;
+	int failed;
+} pq_train_job_t;
+
+/* One task per group codebook, plus one for the coarse centers */
+static void pq_train_task(void *arg, int begin, int end, int worker)
+{
+	pq_train_job_t *job = (pq_train_job_t *)arg;
+	cdbscan_pq_t *pq = job->pq;
+
+	for (int m = begin; m < end; m++) {
+		int ok;
+		if (m == pq->num_subspaces) {
+			int count = job->count;
+			if (count > PQ_LIST_TRAIN * job->num_lists)
+				count = PQ_LIST_TRAIN * job->num_lists;
+			ok = pq_kmeans(job->coords, pq->dims, job->sample,
+				       count, 0, pq->dims, job->num_lists,
+				       job->seed + m, pq->centers);
+		} else {
+			double *codebook = pq->codebooks +
+					   (size_t)pq->num_codes *
+						   pq->sub_start[m];
+			ok = pq_kmeans(job->coords, pq->dims, job->sample,
+				       job->count, pq->sub_start[m],
+				       pq_width(pq, m), pq->num_codes,
+				       job->seed + m, codebook);
+		}
+		if (!ok)
+			job->failed = 1;
+	}
+}
+
+typedef struct {
+	cdbscan_pq_t *pq;
+	const double *coords;
+	int *list_of; /* Coarse list of each point */
+	float *center_dist; /* Distance of each point to its center */
+	double *worker_error; /* Largest reconstruction error per worker */
+	double *scratch; /* dims doubles per worker */
+} pq_encode_job_t;
+
+static void pq_assign_task(void *arg, int begin, int end, int worker)
+{
+	pq_encode_job_t *job = (pq_encode_job_t *)arg;
+	cdbscan_pq_t *pq = job->pq;
+
+	for (int i = begin; i < end; i++) {
+		double d2;
+		job->list_of[i] = pq_nearest(job->coords + (size_t)i * pq->dims,
+					     pq->centers, pq->num_lists,
+					     pq->dims, &d2);
+		/* Rounded up, so the list radius stays an upper bound */
+		job->center_dist[i] = nextafterf((float)sqrt(d2), FLT_MAX);
+	}
+}
+
+static void pq_encode_task(void *arg, int begin, int end, int worker)
+{
+	pq_encode_job_t *job = (pq_encode_job_t *)arg;
+	cdbscan_pq_t *pq = job->pq;
+	int dims = pq->dims;
+	double *decoded = job->scratch + (size_t)worker * dims;
+
+	for (int i = begin; i < end; i++) {
+		const double *x = job->coords + (size_t)i * dims;
+		uint8_t *code = pq->codes +
+				(size_t)pq->row[i] * pq->num_subspaces;
+		for (int m = 0; m < pq->num_subspaces; m++) {
+			code[m] = (uint8_t)pq_nearest(
+				x + pq->sub_start[m], pq_centroid(pq, m, 0),
+				pq->num_codes, pq_width(pq, m), NULL);
+		}
+
+		pq_decode(pq, pq->row[i], decoded);
+		double error = sqrt(dist2(x, decoded, dims));
+		if (error > job->worker_error[worker])
+			job->worker_error[worker] = error;
+	}
+}
+
+void cdbscan_pq_free(cdbscan_pq_t *pq)
+{
+	if (!pq)
+		return;
+	free(pq->sub_start);
+	free(pq->codebooks);
+	free(pq->codes);
+	free(pq->ids);
+	free(pq->row);
+	free(pq->centers);
+	free(pq->radius);
+	free(pq->list_start);
+	free(pq);
+}
+
+/* Allocate the arrays of a trained and encoded dataset */
+static cdbscan_pq_t *pq_alloc(int num_points, int dims, int num_subspaces,
+			      int num_codes, int num_lists)
+{
+	cdbscan_pq_t *pq = (cdbscan_pq_t *)calloc(1, sizeof(cdbscan_pq_t));
+	if (!pq)
+		return NULL;
+
+	pq->num_points = num_points;
+	pq->dims = dims;
+	pq->num_subspaces = num_subspaces;
+	pq->num_codes = num_codes;
+	pq->num_lists = num_lists;
+	pq->sub_start = (int *)malloc((num_subspaces + 1) * sizeof(int));
+	pq->codebooks =
+		(double *)malloc((size_t)num_codes * dims * sizeof(double));
+	pq->codes = (uint8_t *)malloc((size_t)num_points * num_subspaces);
+	pq->ids = (int *)malloc(num_points * sizeof(int));
+	pq->row = (int *)malloc(num_points * sizeof(int));
+	pq->centers =
+		(double *)malloc((size_t)num_lists * dims * sizeof(double));
+	pq->radius = (double *)calloc(num_lists, sizeof(double));
+	pq->list_start = (int *)calloc(num_lists + 1, sizeof(int));
+	if (!pq->sub_start || !pq->codebooks || !pq->codes || !pq->ids ||
+	    !pq->row || !pq->centers || !pq->radius || !pq->list_start) {
+		cdbscan_pq_free(pq);
+		return NULL;
+	}
+
+	/* Groups differ in width by at most one dimension */
+	for (int m = 0; m <= num_subspaces; m++) {
+		pq->sub_start[m] = (int)((long long)dims * m / num_subspaces);
+	}
+	return pq;
+}
+
+/* Group points by list: rows, ids, list starts and radii */
+static void pq_order_lists(cdbscan_pq_t *pq, const int *list_of,
+			   const float *center_dist)
+{
+	for (int i = 0; i < pq->num_points; i++) {
+		pq->list_start[list_of[i] + 1]++;
+		if (center_dist[i] > pq->radius[list_of[i]])
+			pq->radius[list_of[i]] = center_dist[i];
+	}
+	for (int l = 0; l < pq->num_lists; l++) {
+		pq->list_start[l + 1] += pq->list_start[l];
+	}
+	for (int i = 0; i < pq->num_points; i++) {
+		int r = pq->list_start[list_of[i]]++;
+		pq->row[i] = r;
+		pq->ids[r] = i;
+	}
+	for (int l = pq->num_lists; l > 0; l--) {
+		pq->list_start[l] = pq->list_start[l - 1];
+	}
+	pq->list_start[0] = 0;
+}
+
+cdbscan_pq_t *cdbscan_pq_build(cdbscan_context_t *ctx,
+			       const cdbscan_dataset_t *data,
+			       const cdbscan_pq_opts_t *opts)
+{
+	if (!dataset_valid(data))
+		return NULL;
+
+	int num_points = data->num_points;
+	int dims = data->dimensions;
+	int num_subspaces = (dims + 3) / 4;
+	int num_lists = (int)sqrt((double)num_points);
+	int train_points = PQ_TRAIN_POINTS;
+	uint64_t seed = 0;
+	if (opts) {
+		if (opts->num_subspaces > 0)
+			num_subspaces = opts->num_subspaces;
+		if (opts->num_lists > 0)
+			num_lists = opts->num_lists;
+		if (opts->train_points > 0)
+			train_points = opts->train_points;
+		seed = opts->seed;
+	}
+	if (num_subspaces > dims)
+		return NULL;
+	num_lists = num_lists < 1 ? 1 :
+		    num_lists > PQ_MAX_LISTS ? PQ_MAX_LISTS : num_lists;
+	if (train_points > num_points)
+		train_points = num_points;
+	if (num_lists > train_points)
+		num_lists = train_points;
+	int num_codes = train_points < PQ_CODES ? train_points : PQ_CODES;
+
+	cdbscan_pq_t *pq = pq_alloc(num_points, dims, num_subspaces,
+				    num_codes, num_lists);
+	int *sample = (int *)malloc(train_points * sizeof(int));
+	int *list_of = (int *)malloc(num_points * sizeof(int));
+	float *center_dist = (float *)malloc(num_points * sizeof(float));
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	int workers = pool_num_workers(env.pool);
+	double *worker_error = (double *)calloc(workers, sizeof(double));
+	double *scratch =
+		(double *)malloc((size_t)workers * dims * sizeof(double));
+
+	int ok = pq && sample && list_of && center_dist && worker_error &&
+		 scratch;
+	if (ok) {
+		/* Distinct random points: a partial Fisher-Yates shuffle
+		 * drawn lazily through list_of */
+		for (int i = 0; i < num_points; i++) {
+			list_of[i] = i;
+		}
+		uint64_t rng = seed;
+		for (int i = 0; i < train_points; i++) {
+			int j = i + (int)(rng_next(&rng) % (num_points - i));
+			int temp = list_of[i];
+			list_of[i] = list_of[j];
+			list_of[j] = temp;
+			sample[i] = list_of[i];
+		}
+
+		pq_train_job_t train = { pq, data->coords, sample,
+					 train_points, num_lists, seed, 0 };
+		pool_parallel_for(env.pool, num_subspaces + 1, 1,
+				  pq_train_task, &train);
+		ok = !train.failed;
+	}
+
+	if (ok) {
+		pq_encode_job_t job = { pq, data->coords, list_of, center_dist,
+					worker_error, scratch };
+		pool_parallel_for(env.pool, num_points, 0, pq_assign_task,
+				  &job);
+		pq_order_lists(pq, list_of, center_dist);
+		pool_parallel_for(env.pool, num_points, 0, pq_encode_task,
+				  &job);
+		for (int w = 0; w < workers; w++) {
+			if (worker_error[w] > pq->max_error)
+				pq->max_error = worker_error[w];
+		}
+		/* Margin for rounding in the table sums */
+		pq->max_error = pq->max_error * (1.0 + 1e-9) + 1e-12;
+	}
+	call_end(&env);
+
+	free(sample);
+	free(list_of);
+	free(center_dist);
+	free(worker_error);
+	free(scratch);
+	if (!ok) {
+		cdbscan_pq_free(pq);
+		return NULL;
+	}
+	return pq;
+}
+
+/* Region queries over the codes */
+typedef struct {
+	const cdbscan_pq_t *pq;
+	const double *exact; /* Exact vectors, NULL for codes only */
+	double eps;
+	double eps2;
+	double sure2; /* Accepted without a check below this, squared */
+	double accept2; /* Rejected above this, squared */
+	double reach; /* Lists farther than this are skipped */
+	double *tables; /* Distance table and decoded vector per worker */
+	int *busy; /* Per table: nonzero while a query holds it */
+	int num_tables;
+	size_t table_size; /* Doubles in one table and its vector */
+} pq_query_t;
+
+static void pq_query_init(pq_query_t *query, const cdbscan_pq_t *pq,
+			  const double *exact, double eps, double rerank)
+{
+	query->pq = pq;
+	query->exact = exact;
+	query->eps = eps;
+	query->eps2 = eps * eps;
+	if (!exact)
+		rerank = 0.0;
+
+	double sure = eps * (1.0 - rerank);
+	double accept = eps * (1.0 + rerank);
+	query->sure2 = sure > 0 ? sure * sure : -1.0;
+	query->accept2 = accept * accept;
+	query->reach = accept + pq->max_error;
+}
+
+/* Take a distance table for every worker of pool from scratch before
+ * the queries start. Returns: 0 on success, -1 if out of memory. */
+static int pq_query_tables(pq_query_t *query, thread_pool_t *pool,
+			   scratch_t *scratch)
+{
+	const cdbscan_pq_t *pq = query->pq;
+	int workers = pool_num_workers(pool);
+	query->num_tables = workers;
+	query->table_size =
+		(size_t)pq->num_subspaces * pq->num_codes + pq->dims;
+
+	size_t bytes = workers * query->table_size * sizeof(double);
+	size_t size = bytes + workers * sizeof(int);
+	size_t avail = scratch_avail(scratch);
+	if (avail && size > avail)
+		return -1;
+	scratch_reserve(scratch, size);
+	query->tables = (double *)scratch_get(scratch, SCRATCH_PQ_TABLE, size);
+	if (!query->tables)
+		return -1;
+	query->busy = (int *)((char *)query->tables + bytes);
+	memset(query->busy, 0, workers * sizeof(int));
+	return 0;
+}
+
+static int pq_index_visit(const nbr_index_t *index, int idx, visit_fn_t fn,
+			  void *arg)
+{
+	const pq_query_t *query = (const pq_query_t *)index->impl;
+	const cdbscan_pq_t *pq = query->pq;
+	int dims = pq->dims;
+	int num_subspaces = pq->num_subspaces;
+	int num_codes = pq->num_codes;
+
+	/* No more queries run at once than there are workers */
+	int t = 0;
+	while (__atomic_exchange_n(&query->busy[t], 1, __ATOMIC_ACQUIRE))
+		t = (t + 1) % query->num_tables;
+	double *table = query->tables + t * query->table_size;
+	double *vec = table + (size_t)num_subspaces * num_codes;
+
+	/* The query's own vector, or what its codes stand for */
+	const double *q = vec;
+	if (query->exact)
+		q = query->exact + (size_t)idx * dims;
+	else
+		pq_decode(pq, pq->row[idx], vec);
+
+	for (int m = 0; m < num_subspaces; m++) {
+		int width = pq_width(pq, m);
+		for (int k = 0; k < num_codes; k++) {
+			table[m * num_codes + k] = dist2(
+				q + pq->sub_start[m], pq_centroid(pq, m, k),
+				width);
+		}
+	}
+
+	/* A point is always its own neighbor, whatever its codes say */
+	int stopped = fn(arg, idx);
+	for (int l = 0; l < pq->num_lists && !stopped; l++) {
+		double center = sqrt(dist2(q, pq->centers + (size_t)l * dims,
+					   dims));
+		if (center - pq->radius[l] > query->reach)
+			continue;
+
+		for (int r = pq->list_start[l];
+		     r < pq->list_start[l + 1] && !stopped; r++) {
+			int p = pq->ids[r];
+			if (p == idx)
+				continue;
+
+			const uint8_t *code =
+				pq->codes + (size_t)r * num_subspaces;
+			double d2 = 0.0;
+			for (int m = 0; m < num_subspaces; m++) {
+				d2 += table[m * num_codes + code[m]];
+			}
+			if (d2 > query->accept2)
+				continue;
+			/* Only with exact vectors is there a band to check */
+			if (d2 > query->sure2 &&
+			    !dist2_within(dist2(q,
+						query->exact + (size_t)p * dims,
+						dims),
+					  query->eps, query->eps2))
+				continue;
+			stopped = fn(arg, p);
+		}
+	}
+
+	__atomic_store_n(&query->busy[t], 0, __ATOMIC_RELEASE);
+	return stopped;
+}
+
+static int pq_check(const cdbscan_pq_t *pq, const cdbscan_dataset_t *exact,
+		    const cdbscan_params_t *params, double rerank)
+{
+	if (!pq || !cdbscan_validate_params(params) ||
+	    params->dist_type != CDBSCAN_DIST_EUCLIDEAN || rerank < 0)
+		return 0;
+	return !exact ||
+	       (exact->coords && exact->num_points == pq->num_points &&
+		exact->dimensions == pq->dims);
+}
+
+int cdbscan_cluster_pq(cdbscan_context_t *ctx, const cdbscan_pq_t *pq,
+		       const cdbscan_dataset_t *exact, double rerank,
+		       cdbscan_params_t params, int *labels)
+{
+	if (!pq_check(pq, exact, &params, rerank) || !labels)
+		return -1;
+
+	pq_query_t query;
+	pq_query_init(&query, pq, exact ? exact->coords : NULL, params.eps,
+		      rerank);
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+	if (pq_query_tables(&query, env.pool, env.scratch) != 0) {
+		call_end(&env);
+		return -1;
+	}
+	nbr_index_t index = { .visit = pq_index_visit,
+			      .impl = &query,
+			      .pool = env.pool,
+			      .num_points = pq->num_points,
+			      .dims = pq->dims,
+			      .params = &params };
+	int num_clusters = cluster_index(&index, params.min_pts, 0, NULL,
+					 env.scratch, labels);
+	scratch_put(env.scratch, query.tables);
+	call_end(&env);
+	return num_clusters;
+}
+
+/* Recall and precision of sampled region queries against brute force on
+ * the exact vectors */
+typedef struct {
+	const nbr_index_t *index;
+	const double *coords;
+	const int *queries;
+	double eps;
+	unsigned long long *found; /* Per query: approximate neighbors */
+	unsigned long long *truth; /* Per query: exact neighbors */
+	unsigned long long *hits; /* Per query: approximate and exact */
+	int failed;
+} pq_measure_job_t;
+
+typedef struct {
+	unsigned char *mark;
+	int *list;
+	int count;
+} pq_collect_t;
+
+static int pq_collect_visit(void *arg, int idx)
+{
+	pq_collect_t *c = (pq_collect_t *)arg;
+	c->mark[idx] = 1;
+	c->list[c->count++] = idx;
+	return 0;
+}
+
+static void pq_measure_task(void *arg, int begin, int end, int worker)
+{
+	pq_measure_job_t *job = (pq_measure_job_t *)arg;
+	const nbr_index_t *index = job->index;
+	int n = index->num_points;
+	int dims = index->dims;
+	double eps2 = job->eps * job->eps;
+	pq_collect_t c;
+
+	c.mark = (unsigned char *)calloc(n, 1);
+	c.list = (int *)malloc(n * sizeof(int));
+	if (!c.mark || !c.list) {
+		free(c.mark);
+		free(c.list);
+		job->failed = 1;
+		return;
+	}
+
+	for (int i = begin; i < end; i++) {
+		int q = job->queries[i];
+		c.count = 0;
+		index->visit(index, q, pq_collect_visit, &c);
+
+		const double *x = job->coords + (size_t)q * dims;
+		unsigned long long truth = 0, hits = 0;
+		for (int p = 0; p < n; p++) {
+			const double *y = job->coords + (size_t)p * dims;
+			if (dist2_within(dist2(x, y, dims), job->eps, eps2)) {
+				truth++;
+				hits += c.mark[p];
+			}
+		}
+		job->found[i] = c.count;
+		job->truth[i] = truth;
+		job->hits[i] = hits;
+
+		for (int k = 0; k < c.count; k++) {
+			c.mark[c.list[k]] = 0;
+		}
+	}
+
+	free(c.mark);
+	free(c.list);
+}
+
+int cdbscan_pq_measure(cdbscan_context_t *ctx, const cdbscan_pq_t *pq,
+		       const cdbscan_dataset_t *exact, double rerank,
+		       cdbscan_params_t params, int num_queries,
+		       unsigned long long seed, cdbscan_pq_quality_t *quality)
+{
+	if (!exact || !pq_check(pq, exact, &params, rerank) ||
+	    num_queries <= 0 || !quality)
+		return -1;
+	if (num_queries > pq->num_points)
+		num_queries = pq->num_points;
+
+	int *queries = (int *)malloc(num_queries * sizeof(int));
+	unsigned long long *counts = (unsigned long long *)calloc(
+		3 * (size_t)num_queries, sizeof(unsigned long long));
+	if (!queries || !counts) {
+		free(queries);
+		free(counts);
+		return -1;
+	}
+	uint64_t rng = seed;
+	for (int i = 0; i < num_queries; i++) {
+		queries[i] = (int)(rng_next(&rng) % pq->num_points);
+	}
+
+	pq_query_t query;
+	pq_query_init(&query, pq, exact->coords, params.eps, rerank);
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+	if (pq_query_tables(&query, env.pool, env.scratch) != 0) {
+		call_end(&env);
+		free(queries);
+		free(counts);
+		return -1;
+	}
+	nbr_index_t index = { .visit = pq_index_visit,
+			      .impl = &query,
+			      .pool = env.pool,
+			      .num_points = pq->num_points,
+			      .dims = pq->dims,
+			      .params = &params };
+	pq_measure_job_t job = { &index,
+				 exact->coords,
+				 queries,
+				 params.eps,
+				 counts,
+				 counts + num_queries,
+				 counts + 2 * (size_t)num_queries,
+				 0 };
+	pool_parallel_for(env.pool, num_queries, 1, pq_measure_task, &job);
+	scratch_put(env.scratch, query.tables);
+	call_end(&env);
+
+	unsigned long long found = 0, truth = 0, hits = 0;
+	for (int i = 0; i < num_queries; i++) {
+		found += job.found[i];
+		truth += job.truth[i];
+		hits += job.hits[i];
+	}
+	quality->num_queries = num_queries;
+	quality->recall = truth ? (double)hits / truth : 1.0;
+	quality->precision = found ? (double)hits / found : 1.0;
+
+	free(queries);
+	free(counts);
+	return job.failed ? -1 : 0;
+}
+
+/* Batches
+ *
+ * Small datasets are clustered one per worker, each serially with that
+ * worker's scratch memory. They are ordered largest first and cut into
+ * tasks of similar estimated cost, so a few big datasets do not end up
+ * behind many small ones on the same worker. Datasets large enough to
+ * be worth splitting run one at a time on the whole pool.
+ */
+#define BATCH_PARALLEL_POINTS 50000
+
+typedef struct {
+	float cost;
+	int item;
+} batch_order_t;
+
+typedef struct {
+	cdbscan_batch_item_t *items;
+	const batch_order_t *order;
+	const cdbscan_params_t *params;
+	scratch_t *scratch; /* One per worker */
+} batch_job_t;
+
+static int compare_batch_cost(const void *a, const void *b)
+{
+	const batch_order_t *x = (const batch_order_t *)a;
+	const batch_order_t *y = (const batch_order_t *)b;
+	if (x->cost != y->cost)
+		return x->cost < y->cost ? 1 : -1;
+	return x->item - y->item;
+}
+
+static void batch_item_run(cdbscan_batch_item_t *item,
+			   const cdbscan_params_t *params, thread_pool_t *pool,
+			   scratch_t *scratch)
+{
+	if (!dataset_valid(&item->data) || !item->labels) {
+		item->num_clusters = -1;
+		return;
+	}
+	item->num_clusters = cluster_packed(item->data.coords,
+					    item->data.num_points,
+					    item->data.dimensions, params,
+					    NULL, pool, scratch, item->labels);
+}
+
+static void batch_task(void *arg, int begin, int end, int worker)
+{
+	batch_job_t *job = (batch_job_t *)arg;
+
+	for (int i = begin; i < end; i++) {
+		batch_item_run(&job->items[job->order[i].item], job->params,
+			       NULL, &job->scratch[worker]);
+	}
+}
+
+/* Per-worker scratch kept by the context for batches */
+static scratch_t *context_worker_scratch(cdbscan_context_t *ctx)
+{
+	int workers = pool_num_workers(ctx->pool);
+
+	if (!ctx->worker_scratch) {
+		ctx->worker_scratch =
+			(scratch_t *)calloc(workers, sizeof(scratch_t));
+		for (int w = 0; ctx->worker_scratch && w < workers; w++) {
+			ctx->worker_scratch[w].mem = &ctx->mem;
+		}
+	}
+	return ctx->worker_scratch;
+}
+
+int cdbscan_cluster_batch(cdbscan_context_t *ctx, cdbscan_batch_item_t *items,
+			  int num_items, cdbscan_params_t params)
+{
+	if (!cdbscan_validate_params(&params) || !items || num_items <= 0)
+		return -1;
+
+	call_env_t env;
+	call_begin(&env, ctx, params.num_threads);
+	thread_pool_t *pool = env.pool;
+	int workers = pool_num_workers(pool);
+	int brute = !params.use_kdtree ||
+		    params.dist_type != CDBSCAN_DIST_EUCLIDEAN;
+
+	batch_order_t *order =
+		(batch_order_t *)malloc(num_items * sizeof(batch_order_t));
+	scratch_t *scratch = env.scratch;
+	int owned_scratch = 0;
+	if (workers > 1 && env.ctx) {
+		/* Datasets run side by side and share the limit */
+		scratch = context_worker_scratch(env.ctx);
+		for (int w = 0; scratch && w < workers; w++) {
+			scratch[w].limit = env.ctx->memory_limit / workers;
+		}
+	} else if (workers > 1) {
+		scratch = (scratch_t *)calloc(workers, sizeof(scratch_t));
+		owned_scratch = 1;
+	}
+
+	if (!order || !scratch) {
+		/* Fall back to one dataset at a time */
+		for (int i = 0; i < num_items; i++) {
+			batch_item_run(&items[i], &params, pool, env.scratch);
+		}
+	} else {
+		int count = 0;
+		for (int i = 0; i < num_items; i++) {
+			double n = items[i].data.num_points;
+			if (workers > 1 && n >= BATCH_PARALLEL_POINTS) {
+				batch_item_run(&items[i], &params, pool,
+					       env.scratch);
+				continue;
+			}
+			if (n < 1)
+				n = 1;
+			order[count].item = i;
+			order[count].cost = brute ? n * n : n * log2(n + 1);
+			count++;
+		}
+		qsort(order, count, sizeof(batch_order_t), compare_batch_cost);
+
+		float *cost = (float *)malloc(count * sizeof(float));
+		if (cost) {
+			for (int i = 0; i < count; i++) {
+				cost[i] = order[i].cost;
+			}
+		}
+
+		batch_job_t job = { items, order, &params, scratch };
+		pool_parallel_for_cost(pool, count, 1, cost, batch_task, &job);
+		free(cost);
+	}
+
+	if (owned_scratch && scratch) {
+		for (int w = 0; w < workers; w++) {
+			scratch_release(&scratch[w]);
+		}
+		free(scratch);
+	}
+	free(order);
+	call_end(&env);
+
+	for (int i = 0; i < num_items; i++) {
+		if (items[i].num_clusters < 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Frame-to-frame clustering
+ *
+ * Point i of a frame is taken to be point i of the previous frame. The
+ * KD-tree is refitted to the new coordinates and only rebuilt once its
+ * leaves have loosened too much. A point's core status is checked again
+ * only if it moved or a moved point entered or left its neighborhood.
+ * Clusters without such points keep their labels; the others are
+ * expanded again and take the id of the previous cluster most of their
+ * points came from.
+ */
+#define TRACKER_MAX_LOOSENING 2.0
+
+struct cdbscan_tracker {
+	cdbscan_params_t params;
+	int num_points; /* 0 before the first frame */
+	int dims;
+	double *coords; /* Current frame, row-major */
+	kdtree_t *tree; /* Kept across frames for Euclidean distance */
+	double built_extent; /* Leaf extent when the tree was built */
+	int *labels;
+	int *prev; /* Labels of the previous frame */
+	unsigned char *core;
+	unsigned char *affected;
+	int *queue;
+	int next_id; /* Smallest cluster id never handed out */
+	int verified; /* Points checked again by the last update */
+};
+
+cdbscan_tracker_t *cdbscan_tracker_create(cdbscan_params_t params)
+{
+	if (!cdbscan_validate_params(&params))
+		return NULL;
+
+	cdbscan_tracker_t *t =
+		(cdbscan_tracker_t *)calloc(1, sizeof(cdbscan_tracker_t));
+	if (t)
+		t->params = params;
+	return t;
+}
+
+static void tracker_release(cdbscan_tracker_t *t)
+{
+	kdtree_free(t->tree);
+	free(t->coords);
+	free(t->labels);
+	free(t->prev);
+	free(t->core);
+	free(t->affected);
+	free(t->queue);
+	t->tree = NULL;
+	t->coords = NULL;
+	t->labels = NULL;
+	t->prev = NULL;
+	t->core = NULL;
+	t->affected = NULL;
+	t->queue = NULL;
+	t->num_points = 0;
+}
+
+void cdbscan_tracker_destroy(cdbscan_tracker_t *tracker)
+{
+	if (!tracker)
+		return;
+	tracker_release(tracker);
+	free(tracker);
+}
+
+int cdbscan_tracker_verified(const cdbscan_tracker_t *tracker)
+{
+	return tracker ? tracker->verified : 0;
+}
+
+/* Start over with a point set of a new size */
+static int tracker_resize(cdbscan_tracker_t *t, int num_points, int dims)
+{
+	tracker_release(t);
+	t->coords =
+		(double *)malloc((size_t)num_points * dims * sizeof(double));
+	t->labels = (int *)malloc(num_points * sizeof(int));
+	t->prev = (int *)malloc(num_points * sizeof(int));
+	t->core = (unsigned char *)malloc(num_points);
+	t->affected = (unsigned char *)malloc(num_points);
+	t->queue = (int *)malloc(num_points * sizeof(int));
+	if (!t->coords || !t->labels || !t->prev || !t->core ||
+	    !t->affected || !t->queue) {
+		tracker_release(t);
+		return 0;
+	}
+
+	t->num_points = num_points;
+	t->dims = dims;
+	t->next_id = 0;
+	return 1;
+}
+
+static void tracker_index(cdbscan_tracker_t *t, nbr_index_t *index,
+			  thread_pool_t *pool)
+{
+	memset(index, 0, sizeof(*index));
+	index->visit = brute_index_visit;
+	index->pool = pool;
+	index->coords = t->coords;
+	index->num_points = t->num_points;
+	index->dims = t->dims;
+	index->params = &t->params;
+	if (t->tree) {
+		index->visit = kdtree_index_visit;
+		index->estimate = kdtree_index_estimate;
+		index->impl = t->tree;
+	}
+}
+
+static int tracker_build_tree(cdbscan_tracker_t *t, thread_pool_t *pool)
+{
+	kdtree_free(t->tree);
+	t->tree = kdtree_build(t->coords, NULL, t->num_points, t->dims, pool,
+			       NULL);
+	if (!t->tree)
+		return 0;
+	t->built_extent = kdtree_leaf_extent(t->tree);
+	return 1;
+}
+
+/* Cluster the current coordinates from scratch, ids from 0 */
+static int tracker_full(cdbscan_tracker_t *t, thread_pool_t *pool,
+			scratch_t *scratch)
+{
+	if (t->params.dist_type == CDBSCAN_DIST_EUCLIDEAN &&
+	    !tracker_build_tree(t, pool))
+		return -1;
+
+	nbr_index_t index;
+	tracker_index(t, &index, pool);
+	dbscan_engine_t engine = { .index = &index,
+				   .num_points = t->num_points,
+				   .min_pts = t->params.min_pts,
+				   .labels = t->labels,
+				   .core = t->core,
+				   .queue = t->queue,
+				   .pool = pool,
+				   .scratch = scratch };
+	t->verified = t->num_points;
+	return engine_run(&engine);
+}
+
+typedef struct {
+	cdbscan_tracker_t *tracker;
+	const int *moved;
+	const double *old; /* Previous positions of the moved points */
+	unsigned char *dirty; /* Per cluster id: to be grown again */
+} tracker_job_t;
+
+static int mark_affected_visit(void *arg, int idx)
+{
+	cdbscan_tracker_t *t = (cdbscan_tracker_t *)arg;
+	__atomic_store_n(&t->affected[idx], 1, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* A moved point changes the neighborhoods around where it was and where
+ * it is now */
+static void tracker_mark_task(void *arg, int begin, int end, int worker)
+{
+	tracker_job_t *job = (tracker_job_t *)arg;
+	cdbscan_tracker_t *t = job->tracker;
+	int dims = t->dims;
+	double eps = t->params.eps;
+
+	for (int i = begin; i < end; i++) {
+		int idx = job->moved[i];
+		mark_affected_visit(t, idx);
+		kdtree_visit(t->tree, job->old + (size_t)i * dims, eps,
+			     mark_affected_visit, t);
+		kdtree_visit(t->tree, t->coords + (size_t)idx * dims, eps,
+			     mark_affected_visit, t);
+	}
+}
+
+static void tracker_core_task(void *arg, int begin, int end, int worker)
+{
+	tracker_job_t *job = (tracker_job_t *)arg;
+	cdbscan_tracker_t *t = job->tracker;
+	double eps = t->params.eps;
+
+	for (int i = begin; i < end; i++) {
+		int idx = t->queue[i];
+		count_arg_t c = { 0, t->params.min_pts };
+		kdtree_visit(t->tree, t->coords + (size_t)idx * t->dims, eps,
+			     count_visit, &c);
+		t->core[idx] = c.count >= t->params.min_pts;
+	}
+}
+
+static int dirty_visit(void *arg, int idx)
+{
+	tracker_job_t *job = (tracker_job_t *)arg;
+	const cdbscan_tracker_t *t = job->tracker;
+	if (t->core[idx] && t->labels[idx] >= 0)
+		__atomic_store_n(&job->dirty[t->labels[idx]], 1,
+				 __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* Clusters with an affected point may split, and an affected point that
+ * is core now may join the clusters of the core points around it */
+static void tracker_dirty_task(void *arg, int begin, int end, int worker)
+{
+	tracker_job_t *job = (tracker_job_t *)arg;
+	cdbscan_tracker_t *t = job->tracker;
+
+	for (int i = begin; i < end; i++) {
+		int idx = t->queue[i];
+		if (t->labels[idx] >= 0)
+			__atomic_store_n(&job->dirty[t->labels[idx]], 1,
+					 __ATOMIC_RELAXED);
+		if (t->core[idx])
+			kdtree_visit(t->tree,
+				     t->coords + (size_t)idx * t->dims,
+				     t->params.eps, dirty_visit, job);
+	}
+}
+
+typedef struct {
+	const cdbscan_tracker_t *tracker;
+	int label;
+} border_arg_t;
+
+static int border_visit(void *arg, int idx)
+{
+	border_arg_t *b = (border_arg_t *)arg;
+	if (!b->tracker->core[idx] || b->tracker->labels[idx] < 0)
+		return 0;
+	b->label = b->tracker->labels[idx];
+	return 1;
+}
+
+/* Update the clustering for new coordinates. Re-expanded clusters get
+ * temporary ids from t->next_id; returns one past the last of them, or -1
+ * if out of memory. */
+static int tracker_warm(cdbscan_tracker_t *t, const double *coords,
+			thread_pool_t *pool, scratch_t *scratch)
+{
+	int n = t->num_points, dims = t->dims;
+	size_t row = dims * sizeof(double);
+
+	/* Moved points, listed in queue, and where they were */
+	int num_moved = 0;
+	for (int i = 0; i < n; i++) {
+		if (memcmp(t->coords + (size_t)i * dims,
+			   coords + (size_t)i * dims, row) != 0)
+			t->queue[num_moved++] = i;
+	}
+	double *old = (double *)malloc(num_moved * row + 1);
+	if (!old)
+		return -1;
+	for (int i = 0; i < num_moved; i++) {
+		memcpy(old + (size_t)i * dims,
+		       t->coords + (size_t)t->queue[i] * dims, row);
+	}
+
+	memcpy(t->coords, coords, n * row);
+	kdtree_refit(t->tree, t->coords);
+	if (kdtree_leaf_extent(t->tree) >
+		    TRACKER_MAX_LOOSENING * t->built_extent &&
+	    !tracker_build_tree(t, pool)) {
+		free(old);
+		return -1;
+	}
+
+	memset(t->affected, 0, n);
+	tracker_job_t job = { t, t->queue, old, NULL };
+	pool_parallel_for(pool, num_moved, 0, tracker_mark_task, &job);
+	free(old);
+
+	/* Check the affected points again */
+	int num_affected = 0;
+	for (int i = 0; i < n; i++) {
+		if (t->affected[i])
+			t->queue[num_affected++] = i;
+	}
+	pool_parallel_for(pool, num_affected, 0, tracker_core_task, &job);
+	t->verified = num_affected;
+
+	/* Clusters the affected points may split or join are dissolved and
+	 * grown again */
+	unsigned char *dirty = (unsigned char *)calloc(t->next_id + 1, 1);
+	if (!dirty)
+		return -1;
+	job.dirty = dirty;
+	pool_parallel_for(pool, num_affected, 0, tracker_dirty_task, &job);
+	for (int i = 0; i < n; i++) {
+		int label = t->labels[i];
+		if ((label >= 0 && dirty[label]) ||
+		    (label == CDBSCAN_NOISE && t->affected[i]))
+			t->labels[i] = CDBSCAN_UNCLASSIFIED;
+	}
+	free(dirty);
+
+	nbr_index_t index;
+	tracker_index(t, &index, pool);
+	dbscan_engine_t engine = { .index = &index,
+				   .num_points = n,
+				   .min_pts = t->params.min_pts,
+				   .labels = t->labels,
+				   .core = t->core,
+				   .queue = t->queue,
+				   .cluster_id = t->next_id,
+				   .keep_labels = 1,
+				   .pool = pool,
+				   .scratch = scratch };
+	engine_estimate_cost(&engine);
+	engine_expand_all(&engine);
+	scratch_put(scratch, engine.est);
+	scratch_put(scratch, engine.cost);
+
+	/* A border point of a dissolved cluster that no new cluster reached
+	 * may still border a cluster that was kept */
+	for (int i = 0; i < n; i++) {
+		if (t->labels[i] != CDBSCAN_NOISE || t->core[i] ||
+		    t->prev[i] < 0)
+			continue;
+		border_arg_t b = { t, CDBSCAN_NOISE };
+		kdtree_visit(t->tree, t->coords + (size_t)i * dims,
+			     t->params.eps, border_visit, &b);
+		t->labels[i] = b.label;
+	}
+
+	return engine.cluster_id;
+}
+
+static int compare_long_long(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+typedef struct {
+	int count;
+	int temp;
+	int old;
+} id_vote_t;
 
-	for (int i = 0; i < num_points; i++) {
-		if (!points[i].coords)
-			return 0;
-		if (points[i].dimensions != dims)
-			return 0;
+static int compare_votes(const void *a, const void *b)
+{
+	const id_vote_t *x = (const id_vote_t *)a;
+	const id_vote_t *y = (const id_vote_t *)b;
+	if (x->count != y->count)
+		return y->count - x->count;
+	if (x->temp != y->temp)
+		return x->temp - y->temp;
+	return x->old - y->old;
+}
 
-		/* Check for NaN or Inf */
-		for (int d = 0; d < dims; d++) {
-			if (isnan(points[i].coords[d]) ||
-			    isinf(points[i].coords[d])) {
-				return 0;
+/* Replace the temporary ids [base, end) by the previous id most of each
+ * cluster's points had, each previous id used once, or by fresh ids.
+ * Returns the number of clusters. */
+static int tracker_match_ids(cdbscan_tracker_t *t, int base, int end)
+{
+	int n = t->num_points;
+	int num_temp = end - base;
+	long long *pairs = (long long *)malloc(n * sizeof(long long) + 1);
+	id_vote_t *votes = (id_vote_t *)malloc(n * sizeof(id_vote_t) + 1);
+	int *map = (int *)malloc(num_temp * sizeof(int) + 1);
+	unsigned char *used = (unsigned char *)calloc(end + 1, 1);
+
+	if (!pairs || !votes || !map || !used) {
+		/* Keep the temporary ids; they are unused elsewhere */
+		t->next_id = end;
+	} else {
+		int num_pairs = 0;
+		for (int i = 0; i < n; i++) {
+			long long temp = t->labels[i] - base;
+			if (temp >= 0 && t->prev[i] >= 0)
+				pairs[num_pairs++] = temp * base + t->prev[i];
+		}
+		qsort(pairs, num_pairs, sizeof(long long), compare_long_long);
+
+		int num_votes = 0;
+		for (int i = 0; i < num_pairs; i++) {
+			if (i == 0 || pairs[i] != pairs[i - 1]) {
+				votes[num_votes].count = 0;
+				votes[num_votes].temp = (int)(pairs[i] / base);
+				votes[num_votes].old = (int)(pairs[i] % base);
+				num_votes++;
+			}
+			votes[num_votes - 1].count++;
+		}
+		qsort(votes, num_votes, sizeof(id_vote_t), compare_votes);
+
+		for (int i = 0; i < num_temp; i++) {
+			map[i] = -1;
+		}
+		for (int i = 0; i < num_votes; i++) {
+			if (map[votes[i].temp] < 0 && !used[votes[i].old]) {
+				map[votes[i].temp] = votes[i].old;
+				used[votes[i].old] = 1;
 			}
 		}
+
+		t->next_id = base;
+		for (int i = 0; i < num_temp; i++) {
+			if (map[i] < 0)
+				map[i] = t->next_id++;
+		}
+		for (int i = 0; i < n; i++) {
+			if (t->labels[i] >= base)
+				t->labels[i] = map[t->labels[i] - base];
+		}
 	}
 
-	return 1;
+	/* Count the distinct ids in use */
+	int num_clusters = 0;
+	if (used) {
+		memset(used, 0, end + 1);
+		for (int i = 0; i < n; i++) {
+			int label = t->labels[i];
+			if (label >= 0 && !used[label]) {
+				used[label] = 1;
+				num_clusters++;
+			}
+		}
+	}
+
+	free(pairs);
+	free(votes);
+	free(map);
+	free(used);
+	return num_clusters;
 }
 
-/* Region query implementations */
-int cdbscan_region_query(const cdbscan_point_t *points, int num_points,
-			 int point_idx, double eps, int *neighbors)
+int cdbscan_tracker_update(cdbscan_tracker_t *tracker, cdbscan_context_t *ctx,
+			   const cdbscan_dataset_t *frame, int *labels)
 {
-	if (!points || !neighbors || point_idx < 0 || point_idx >= num_points) {
-		return 0;
-	}
-
-	int neighbor_count = 0;
-	const cdbscan_point_t *query_point = &points[point_idx];
+	cdbscan_tracker_t *t = tracker;
+	if (!t || !dataset_valid(frame) || !labels)
+		return -1;
 
-	for (int i = 0; i < num_points; i++) {
-		double dist = cdbscan_euclidean_distance(
-			query_point->coords, points[i].coords,
-			query_point->dimensions);
-		if (dist >= 0 && dist <= eps) {
-			neighbors[neighbor_count++] = i;
+	int n = frame->num_points;
+	call_env_t env;
+	call_begin(&env, ctx, t->params.num_threads);
+
+	int num_clusters;
+	if (n != t->num_points || frame->dimensions != t->dims) {
+		/* First frame, or a different point set */
+		if (tracker_resize(t, n, frame->dimensions)) {
+			memcpy(t->coords, frame->coords,
+			       (size_t)n * t->dims * sizeof(double));
+			num_clusters = tracker_full(t, env.pool, env.scratch);
+			t->next_id = num_clusters > 0 ? num_clusters : 0;
+		} else {
+			num_clusters = -1;
 		}
+	} else {
+		int base = t->next_id;
+		int end;
+		memcpy(t->prev, t->labels, n * sizeof(int));
+
+		if (t->tree) {
+			end = tracker_warm(t, frame->coords, env.pool,
+					   env.scratch);
+		} else {
+			memcpy(t->coords, frame->coords,
+			       (size_t)n * t->dims * sizeof(double));
+			end = tracker_full(t, env.pool, env.scratch);
+			for (int i = 0; end >= 0 && i < n; i++) {
+				if (t->labels[i] >= 0)
+					t->labels[i] += base;
+			}
+			end = end >= 0 ? base + end : end;
+		}
+
+		num_clusters = end >= 0 ? tracker_match_ids(t, base, end) : -1;
 	}
+	call_end(&env);
 
-	return neighbor_count;
+	if (num_clusters < 0) {
+		tracker_release(t);
+		return -1;
+	}
+	memcpy(labels, t->labels, n * sizeof(int));
+	return num_clusters;
 }
 
-int cdbscan_region_query_custom(const cdbscan_point_t *points, int num_points,
-				int point_idx, const cdbscan_params_t *params,
-				int *neighbors)
+/* CSV loading
+ *
+ * The file is mapped and cut into chunks of CSV_CHUNK bytes, each moved
+ * forward to the start of a line. One parallel pass counts the rows of
+ * every chunk; their prefix sums tell each chunk where its first row
+ * goes, and a second pass parses the chunks straight into the dataset.
+ * A number of up to 19 digits whose decimal exponent is within 22 is a
+ * product or quotient of two exact doubles and converts exactly with one
+ * rounding (Clinger's fast path); other numbers go to strtod(). */
+#define CSV_CHUNK ((size_t)1 << 20)
+#define CSV_MAX_FIELD 128 /* Longest number handed to strtod() */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CSV_SWAR 1 /* Convert eight digits at a time */
+#else
+#define CSV_SWAR 0
+#endif
+
+typedef struct {
+	const char *begin, *end; /* Lines after the header */
+	char delim;
+	const int *column_of; /* Output column of each field, -1 to skip */
+	int num_fields; /* Fields read from each line */
+	int dims;
+	int num_chunks;
+	size_t *rows; /* Rows per chunk, then the first row of each */
+	size_t *lines; /* Lines per chunk, then the first line of each */
+	size_t *error; /* First bad line of each chunk, 0 if none */
+	double *coords;
+} csv_job_t;
+
+static const double csv_pow10[23] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int csv_space(char c)
 {
-	if (!points || !neighbors || !params || point_idx < 0 ||
-	    point_idx >= num_points) {
-		return 0;
-	}
+	return c == ' ' || c == '\t' || c == '\r';
+}
 
-	int neighbor_count = 0;
-	const cdbscan_point_t *query_point = &points[point_idx];
+static int csv_blank(const char *p, const char *eol)
+{
+	while (p < eol && csv_space(*p))
+		p++;
+	return p == eol;
+}
 
-	for (int i = 0; i < num_points; i++) {
-		double dist = calculate_distance(query_point->coords,
-						 points[i].coords,
-						 query_point->dimensions,
-						 params);
-		if (dist >= 0 && dist <= params->eps) {
-			neighbors[neighbor_count++] = i;
-		}
-	}
+#if CSV_SWAR
+/* Eight ASCII digits in a little-endian word */
+static int csv_eight_digits(uint64_t v)
+{
+	return ((v & 0xF0F0F0F0F0F0F0F0ULL) |
+		(((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >>
+		 4)) == 0x3333333333333333ULL;
+}
 
-	return neighbor_count;
+static uint64_t csv_eight_value(uint64_t v)
+{
+	v -= 0x3030303030303030ULL;
+	v = v * 10 + (v >> 8); /* Pairs of digits */
+	return (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+		(((v >> 16) & 0x000000FF000000FFULL) *
+		 (1 + (10000ULL << 32)))) >> 32;
 }
+#endif
 
-/* Forward declaration for internal function */
-static int expand_cluster(cdbscan_point_t *points, int num_points,
-			  int point_idx, int cluster_id,
-			  const cdbscan_params_t *params, int *neighbors,
-			  int *seeds, int *seed_size);
+/* Append the digits at p to *m, keeping at most 19 in *count and
+ * setting *inexact when more follow. Returns the end of the digits. */
+static const char *csv_digits(const char *p, const char *eol, uint64_t *m,
+			      int *count, int *inexact)
+{
+#if CSV_SWAR
+	while (eol - p >= 8 && *count <= 11) {
+		uint64_t v;
+		memcpy(&v, p, 8);
+		if (!csv_eight_digits(v))
+			break;
+		*m = *m * 100000000 + csv_eight_value(v);
+		*count += 8;
+		p += 8;
+	}
+#endif
+	for (; p < eol && (unsigned)(*p - '0') < 10; p++) {
+		if (*count < 19) {
+			*m = *m * 10 + (unsigned)(*p - '0');
+			(*count)++;
+		} else {
+			*inexact = 1;
+		}
+	}
+	return p;
+}
 
-/* Forward declaration for KD-tree version */
-static int expand_cluster_kdtree(cdbscan_point_t *points, int num_points,
-				 int point_idx, int cluster_id,
-				 const cdbscan_params_t *params,
-				 const kdtree_t *tree, int *neighbors,
-				 int *seeds, int *seed_size);
+/* Numbers the fast path cannot convert exactly, and words like "inf" */
+static int csv_parse_slow(const char **pp, const char *start,
+			  const char *eol, char delim, double *out)
+{
+	const char *next = memchr(start, delim, eol - start);
+	if (!next)
+		next = eol;
+	const char *end = next;
+	while (end > start && (csv_space(end[-1]) || end[-1] == '"'))
+		end--;
+
+	char buf[CSV_MAX_FIELD];
+	size_t len = end - start;
+	if (len == 0 || len >= sizeof(buf))
+		return 0;
+	memcpy(buf, start, len);
+	buf[len] = '\0';
+	char *stop;
+	double v = strtod(buf, &stop);
+	if (stop != buf + len || !isfinite(v))
+		return 0;
+	*out = v;
+	*pp = next;
+	return 1;
+}
 
-/* Main DBSCAN clustering algorithm */
-int cdbscan_cluster(cdbscan_point_t *points, int num_points,
-		    cdbscan_params_t params)
+/* Parse the field at *pp, optionally blank-padded and quoted, and leave
+ * *pp at the delimiter or end of line after it.
+ * Returns: 1 for a finite number, 0 otherwise */
+static int csv_parse_double(const char **pp, const char *eol, char delim,
+			    double *out)
 {
-	/* Validate inputs */
-	if (!cdbscan_validate_params(&params))
-		return -1;
-	if (!cdbscan_validate_data(points, num_points))
-		return -1;
+	const char *p = *pp;
+	while (p < eol && *p != delim && csv_space(*p))
+		p++;
+	int quoted = p < eol && *p == '"';
+	p += quoted;
+	const char *start = p;
+
+	int neg = p < eol && *p == '-';
+	p += p < eol && (*p == '-' || *p == '+');
+	uint64_t m = 0;
+	int count = 0, inexact = 0, exp10 = 0;
+	const char *digits = p;
+	while (p < eol && *p == '0')
+		p++;
+	p = csv_digits(p, eol, &m, &count, &inexact);
+	int seen = p > digits;
+	if (p < eol && *p == '.') {
+		const char *frac = ++p;
+		int before = count;
+		while (!count && p < eol && *p == '0') {
+			p++;
+			exp10--;
+		}
+		p = csv_digits(p, eol, &m, &count, &inexact);
+		exp10 -= count - before;
+		seen |= p > frac;
+	}
+	if (seen && p < eol && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+		int eneg = q < eol && *q == '-';
+		q += q < eol && (*q == '-' || *q == '+');
+		if (q < eol && (unsigned)(*q - '0') < 10) {
+			int e = 0;
+			for (; q < eol && (unsigned)(*q - '0') < 10; q++) {
+				if (e < 100000)
+					e = e * 10 + (*q - '0');
+			}
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+	p += quoted && p < eol && *p == '"';
+	while (p < eol && *p != delim && csv_space(*p))
+		p++;
+
+	if (seen && !inexact && (p == eol || *p == delim) &&
+	    m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+		double v = (double)m;
+		v = exp10 < 0 ? v / csv_pow10[-exp10] : v * csv_pow10[exp10];
+		*out = neg ? -v : v;
+		*pp = p;
+		return 1;
+	}
+	return csv_parse_slow(pp, start, eol, delim, out);
+}
 
-	/* Initialize all points as UNCLASSIFIED */
-	for (int i = 0; i < num_points; i++) {
-		points[i].cluster_id = CDBSCAN_UNCLASSIFIED;
-		points[i].index = i;
+/* Whether every field of a line is a number */
+static int csv_numeric(const char *p, const char *eol, char delim)
+{
+	for (;;) {
+		double v;
+		if (!csv_parse_double(&p, eol, delim, &v))
+			return 0;
+		if (p == eol)
+			return 1;
+		p++;
 	}
+}
 
-	/* Allocate working arrays */
-	int *neighbors = (int *)malloc(num_points * sizeof(int));
-	int *seeds = (int *)malloc(num_points * sizeof(int));
-	if (!neighbors || !seeds) {
-		free(neighbors);
-		free(seeds);
+/* Index of the header field name, -1 if there is none */
+static int csv_find_name(const char *p, const char *eol, char delim,
+			 const char *name)
+{
+	if (!name)
 		return -1;
+	size_t len = strlen(name);
+	for (int f = 0;; f++) {
+		const char *next = memchr(p, delim, eol - p);
+		if (!next)
+			next = eol;
+		const char *a = p, *b = next;
+		while (a < b && (csv_space(*a) || *a == '"'))
+			a++;
+		while (b > a && (csv_space(b[-1]) || b[-1] == '"'))
+			b--;
+		if ((size_t)(b - a) == len && memcmp(a, name, len) == 0)
+			return f;
+		if (next == eol)
+			return -1;
+		p = next + 1;
 	}
+}
 
-	/* Build KD-tree if requested and using Euclidean distance */
-	kdtree_t *tree = NULL;
-	if (params.use_kdtree && params.dist_type == CDBSCAN_DIST_EUCLIDEAN) {
-		tree = kdtree_build(points, num_points);
-		if (!tree) {
-			/* Fall back to brute force if tree building fails */
-			params.use_kdtree = 0;
+/* First byte of chunk c: the start of the first line beginning in it */
+static const char *csv_chunk_start(const csv_job_t *job, int c)
+{
+	if (c == 0)
+		return job->begin;
+	if (c >= job->num_chunks)
+		return job->end;
+	const char *p = job->begin + (size_t)c * CSV_CHUNK - 1;
+	const char *nl = memchr(p, '\n', job->end - p);
+	return nl ? nl + 1 : job->end;
+}
+
+static void csv_count_task(void *arg, int begin, int end, int worker)
+{
+	csv_job_t *job = (csv_job_t *)arg;
+
+	for (int c = begin; c < end; c++) {
+		const char *p = csv_chunk_start(job, c);
+		const char *e = csv_chunk_start(job, c + 1);
+		size_t rows = 0, lines = 0;
+		while (p < e) {
+			const char *nl = memchr(p, '\n', e - p);
+			const char *eol = nl ? nl : e;
+			rows += !csv_blank(p, eol);
+			lines++;
+			p = nl ? nl + 1 : e;
 		}
+		job->rows[c] = rows;
+		job->lines[c] = lines;
 	}
+}
 
-	int cluster_id = 0;
-
-	/* Process each point */
-	for (int i = 0; i < num_points; i++) {
-		if (points[i].cluster_id != CDBSCAN_UNCLASSIFIED) {
-			continue; /* Already processed */
+/* Parse the selected fields of a line into row.
+ * Returns: 1 on success, 0 for a missing field or one not a number */
+static int csv_parse_line(const csv_job_t *job, const char *p,
+			  const char *eol, double *row)
+{
+	for (int f = 0; f < job->num_fields; f++) {
+		if (f > 0) {
+			if (p == eol)
+				return 0;
+			p++;
 		}
-
-		/* Find neighbors using KD-tree or brute force */
-		int neighbor_count;
-		if (tree) {
-			neighbor_count = kdtree_range_query(tree, i, params.eps,
-							    neighbors);
+		int col = job->column_of[f];
+		if (col >= 0) {
+			if (!csv_parse_double(&p, eol, job->delim, &row[col]))
+				return 0;
 		} else {
-			neighbor_count = cdbscan_region_query_custom(
-				points, num_points, i, &params, neighbors);
+			const char *next = memchr(p, job->delim, eol - p);
+			p = next ? next : eol;
 		}
+	}
+	return 1;
+}
 
-		if (neighbor_count < params.min_pts) {
-			/* Mark as noise (may be changed later if it's a border point) */
-			points[i].cluster_id = CDBSCAN_NOISE;
-		} else {
-			/* Core point - start a new cluster */
-			int seed_size = 0;
-			if (tree) {
-				if (expand_cluster_kdtree(points, num_points, i,
-							  cluster_id, &params,
-							  tree, neighbors,
-							  seeds, &seed_size)) {
-					cluster_id++;
-				}
-			} else {
-				if (expand_cluster(points, num_points, i,
-						   cluster_id, &params,
-						   neighbors, seeds,
-						   &seed_size)) {
-					cluster_id++;
+static void csv_parse_task(void *arg, int begin, int end, int worker)
+{
+	csv_job_t *job = (csv_job_t *)arg;
+
+	for (int c = begin; c < end; c++) {
+		const char *p = csv_chunk_start(job, c);
+		const char *e = csv_chunk_start(job, c + 1);
+		double *row = job->coords + job->rows[c] * job->dims;
+		size_t line = job->lines[c];
+		job->error[c] = 0;
+		for (; p < e; line++) {
+			const char *nl = memchr(p, '\n', e - p);
+			const char *eol = nl ? nl : e;
+			if (!csv_blank(p, eol)) {
+				if (!csv_parse_line(job, p, eol, row)) {
+					job->error[c] = line;
+					break;
 				}
+				row += job->dims;
 			}
+			p = nl ? nl + 1 : e;
 		}
 	}
+}
 
-	/* Clean up */
-	if (tree) {
-		kdtree_free(tree);
+/* Map the selected columns to fields of the first line p..eol; returns
+ * the output column of each field, or NULL */
+static int *csv_columns(const cdbscan_csv_options_t *opts, const char *p,
+			const char *eol, char delim, int total, int header,
+			int *num_fields)
+{
+	int dims = opts->num_columns > 0 ? opts->num_columns : total;
+	int *field = (int *)malloc(dims * sizeof(int));
+	if (!field)
+		return NULL;
+	*num_fields = 0;
+	for (int k = 0; k < dims; k++) {
+		if (opts->num_columns == 0)
+			field[k] = k;
+		else if (opts->columns)
+			field[k] = opts->columns[k];
+		else if (header > 0)
+			field[k] = csv_find_name(p, eol, delim,
+						 opts->column_names[k]);
+		else
+			field[k] = -1;
+		if (field[k] < 0 || field[k] >= total) {
+			free(field);
+			return NULL;
+		}
+		if (field[k] >= *num_fields)
+			*num_fields = field[k] + 1;
 	}
-	free(neighbors);
-	free(seeds);
 
-	return cluster_id; /* Return number of clusters found */
+	int *column_of = (int *)malloc(*num_fields * sizeof(int));
+	if (column_of) {
+		for (int f = 0; f < *num_fields; f++)
+			column_of[f] = -1;
+		for (int k = 0; k < dims; k++) {
+			if (column_of[field[k]] >= 0) {
+				free(column_of);
+				column_of = NULL;
+				break;
+			}
+			column_of[field[k]] = k;
+		}
+	}
+	free(field);
+	return column_of;
 }
 
-/* Expand cluster from a core point */
-static int expand_cluster(cdbscan_point_t *points, int num_points,
-			  int point_idx, int cluster_id,
-			  const cdbscan_params_t *params, int *neighbors,
-			  int *seeds, int *seed_size)
+static int csv_load(cdbscan_context_t *ctx, const char *text, size_t size,
+		    cdbscan_csv_options_t *opts, cdbscan_dataset_t *data)
 {
-	/* Get initial seeds from region query */
-	*seed_size = cdbscan_region_query_custom(points, num_points, point_idx,
-						 params, seeds);
-
-	if (*seed_size < params->min_pts) {
-		/* Not a core point */
-		points[point_idx].cluster_id = CDBSCAN_NOISE;
-		return 0;
+	csv_job_t job = { .delim = opts->delimiter ? opts->delimiter : ',' };
+	const char *p = text, *end = text + size, *eol;
+	if (size >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+		p += 3;
+
+	/* The first line that is not blank gives the number of fields */
+	size_t line = 1;
+	for (;; line++) {
+		if (p >= end)
+			return -1;
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		if (!csv_blank(p, eol))
+			break;
+		p = eol + (eol < end);
 	}
-
-	/* Assign cluster ID to all points in seeds */
-	for (int i = 0; i < *seed_size; i++) {
-		points[seeds[i]].cluster_id = cluster_id;
+	int total = 1;
+	for (const char *q = p; (q = memchr(q, job.delim, eol - q)); q++)
+		total++;
+
+	int header = opts->header;
+	if (header == 0 && opts->num_columns > 0 && !opts->columns)
+		header = 1;
+	else if (header == 0)
+		header = csv_numeric(p, eol, job.delim) ? -1 : 1;
+	int *column_of = csv_columns(opts, p, eol, job.delim, total, header,
+				     &job.num_fields);
+	if (!column_of)
+		return -1;
+	job.column_of = column_of;
+	job.dims = opts->num_columns > 0 ? opts->num_columns : total;
+	if (header > 0) {
+		p = eol < end ? eol + 1 : end;
+		line++;
+	}
+	job.begin = p;
+	job.end = end;
+	job.num_chunks = (int)((end - p + CSV_CHUNK - 1) / CSV_CHUNK);
+	if (job.num_chunks == 0) {
+		free(column_of);
+		return -1;
 	}
 
-	/* Remove the core point from seeds */
-	for (int i = 0; i < *seed_size; i++) {
-		if (seeds[i] == point_idx) {
-			seeds[i] = seeds[--(*seed_size)];
+	size_t *counts = (size_t *)malloc(3 * job.num_chunks * sizeof(size_t));
+	if (!counts) {
+		free(column_of);
+		return -1;
+	}
+	job.rows = counts;
+	job.lines = counts + job.num_chunks;
+	job.error = counts + 2 * job.num_chunks;
+
+	call_env_t env;
+	call_begin(&env, ctx, 0);
+	pool_parallel_for(env.pool, job.num_chunks, 1, csv_count_task, &job);
+	size_t rows = 0;
+	for (int c = 0; c < job.num_chunks; c++) {
+		size_t r = job.rows[c], l = job.lines[c];
+		job.rows[c] = rows;
+		job.lines[c] = line;
+		rows += r;
+		line += l;
+	}
+	if (rows > 0 && rows <= INT_MAX &&
+	    rows <= SIZE_MAX / sizeof(double) / job.dims)
+		job.coords = (double *)malloc(rows * job.dims * sizeof(double));
+	if (job.coords)
+		pool_parallel_for(env.pool, job.num_chunks, 1, csv_parse_task,
+				  &job);
+	call_end(&env);
+
+	int ret = job.coords ? 0 : -1;
+	for (int c = 0; job.coords && c < job.num_chunks; c++) {
+		if (job.error[c]) {
+			size_t bad = job.error[c];
+			opts->error_line = bad < INT_MAX ? (int)bad : INT_MAX;
+			free(job.coords);
+			ret = -1;
 			break;
 		}
 	}
+	if (ret == 0) {
+		data->coords = job.coords;
+		data->num_points = (int)rows;
+		data->dimensions = job.dims;
+	}
+	free(counts);
+	free(column_of);
+	return ret;
+}
 
-	/* Process all seed points */
-	int current_seed = 0;
-	while (current_seed < *seed_size) {
-		int current_point = seeds[current_seed];
+int cdbscan_load_csv(cdbscan_context_t *ctx, const char *path,
+		     cdbscan_csv_options_t *opts, cdbscan_dataset_t *data)
+{
+	cdbscan_csv_options_t defaults = { 0 };
+	if (!opts)
+		opts = &defaults;
+	opts->error_line = 0;
+	if (!path || !data || opts->num_columns < 0 ||
+	    (opts->num_columns > 0 && !opts->columns && !opts->column_names))
+		return -1;
 
-		/* Find neighbors of current seed point */
-		int neighbor_count = cdbscan_region_query_custom(
-			points, num_points, current_point, params, neighbors);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		close(fd);
+		return -1;
+	}
+	size_t size = (size_t)st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	madvise(map, size, MADV_WILLNEED);
 
-		if (neighbor_count >= params->min_pts) {
-			/* Current point is also a core point */
-			for (int i = 0; i < neighbor_count; i++) {
-				int neighbor_idx = neighbors[i];
+	int ret = csv_load(ctx, (const char *)map, size, opts, data);
+	munmap(map, size);
+	return ret;
+}
 
-				if (points[neighbor_idx].cluster_id ==
-					    CDBSCAN_UNCLASSIFIED ||
-				    points[neighbor_idx].cluster_id ==
-					    CDBSCAN_NOISE) {
-					if (points[neighbor_idx].cluster_id ==
-					    CDBSCAN_UNCLASSIFIED) {
-						/* Add to seeds if it was unclassified */
-						seeds[(*seed_size)++] =
-							neighbor_idx;
-					}
+void cdbscan_free_dataset(cdbscan_dataset_t *data)
+{
+	if (!data)
+		return;
+	free((void *)data->coords);
+	data->coords = NULL;
+	data->num_points = 0;
+	data->dimensions = 0;
+}
 
-					/* Assign to current cluster */
-					points[neighbor_idx].cluster_id =
-						cluster_id;
-				}
-			}
-		}
+/* Binary dataset files
+ *
+ * A 64-byte header is followed by the point rows and then the optional
+ * label and weight columns, each section starting on a 64-byte boundary
+ * at the offset the header gives. Opening a file maps it and checks the
+ * header; the sections are used in place. The writer streams rows to
+ * "<path>.tmp" and the label and weight columns to temporary files,
+ * copies those after the rows when it is closed, writes the header last
+ * and renames the result over the path, so an unfinished file never
+ * replaces the old one. */
+#define FILE_MAGIC "CDBSCNDS"
+#define FILE_BYTE_ORDER 0x01020304u
+#define FILE_ALIGN 64
+#define FILE_LAYOUT_ROWS 0
+#define FILE_COPY_BLOCK 65536
 
-		current_seed++;
+typedef struct {
+	char magic[8];
+	uint32_t byte_order; /* FILE_BYTE_ORDER as the writer stored it */
+	uint32_t version;
+	uint32_t dtype;
+	uint32_t layout;
+	uint32_t dims;
+	uint32_t flags; /* CDBSCAN_FILE_LABELS, CDBSCAN_FILE_WEIGHTS */
+	uint64_t num_points;
+	uint64_t coords_offset;
+	uint64_t labels_offset; /* 0 without labels */
+	uint64_t weights_offset; /* 0 without weights */
+} file_header_t;
+
+struct cdbscan_file {
+	void *map;
+	size_t size;
+	file_header_t header;
+};
+
+struct cdbscan_file_writer {
+	FILE *f;
+	FILE *side[2]; /* Labels and weights until the writer is closed */
+	char *path;
+	char *tmp_path; /* Written, then renamed to path on close */
+	file_header_t header;
+	int failed; /* An I/O error; close() then fails */
+};
+
+static size_t file_dtype_size(uint32_t dtype)
+{
+	switch (dtype) {
+	case CDBSCAN_FILE_DOUBLE:
+		return sizeof(double);
+	case CDBSCAN_FILE_INT32:
+		return sizeof(int32_t);
+	default:
+		return 0;
 	}
+}
 
-	return 1; /* Successfully expanded cluster */
+static uint64_t file_align(uint64_t offset)
+{
+	return (offset + FILE_ALIGN - 1) & ~(uint64_t)(FILE_ALIGN - 1);
 }
 
-/* Expand cluster from a core point using KD-tree */
-static int expand_cluster_kdtree(cdbscan_point_t *points, int num_points,
-				 int point_idx, int cluster_id,
-				 const cdbscan_params_t *params,
-				 const kdtree_t *tree, int *neighbors,
-				 int *seeds, int *seed_size)
+/* Whether a section of count elements of size bytes at offset lies in a
+ * file of file_size bytes */
+static int file_section_ok(uint64_t offset, uint64_t count, size_t size,
+			   size_t file_size)
 {
-	/* Get initial seeds from KD-tree range query */
-	*seed_size = kdtree_range_query(tree, point_idx, params->eps, seeds);
+	return offset >= sizeof(file_header_t) && offset % FILE_ALIGN == 0 &&
+	       offset <= file_size && count <= (file_size - offset) / size;
+}
 
-	if (*seed_size < params->min_pts) {
-		/* Not a core point */
-		points[point_idx].cluster_id = CDBSCAN_NOISE;
+/* Check a header against a file of file_size bytes */
+static int file_header_ok(const file_header_t *h, size_t file_size)
+{
+	if (memcmp(h->magic, FILE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->byte_order != FILE_BYTE_ORDER ||
+	    h->version != CDBSCAN_FILE_VERSION ||
+	    h->layout != FILE_LAYOUT_ROWS || h->dims == 0 ||
+	    h->dims > INT_MAX || h->num_points > INT_MAX ||
+	    (h->flags & ~(uint32_t)(CDBSCAN_FILE_LABELS |
+				    CDBSCAN_FILE_WEIGHTS)))
 		return 0;
+	size_t size = file_dtype_size(h->dtype);
+	if (!size || !file_section_ok(h->coords_offset, h->num_points,
+				      size * h->dims, file_size))
+		return 0;
+	if ((h->flags & CDBSCAN_FILE_LABELS) &&
+	    !file_section_ok(h->labels_offset, h->num_points, sizeof(int32_t),
+			     file_size))
+		return 0;
+	if ((h->flags & CDBSCAN_FILE_WEIGHTS) &&
+	    !file_section_ok(h->weights_offset, h->num_points, sizeof(double),
+			     file_size))
+		return 0;
+	return 1;
+}
+
+cdbscan_file_t *cdbscan_file_open(const char *path)
+{
+	if (!path)
+		return NULL;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(file_header_t)) {
+		close(fd);
+		return NULL;
 	}
+	size_t size = (size_t)st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
 
-	/* Assign cluster ID to all points in seeds */
-	for (int i = 0; i < *seed_size; i++) {
-		points[seeds[i]].cluster_id = cluster_id;
+	cdbscan_file_t *file = (cdbscan_file_t *)malloc(sizeof(*file));
+	if (!file) {
+		munmap(map, size);
+		return NULL;
 	}
+	file->map = map;
+	file->size = size;
+	memcpy(&file->header, map, sizeof(file->header));
+	if (!file_header_ok(&file->header, size)) {
+		cdbscan_file_close(file);
+		return NULL;
+	}
+	return file;
+}
 
-	/* Remove the core point from seeds */
-	for (int i = 0; i < *seed_size; i++) {
-		if (seeds[i] == point_idx) {
-			seeds[i] = seeds[--(*seed_size)];
-			break;
-		}
+void cdbscan_file_close(cdbscan_file_t *file)
+{
+	if (!file)
+		return;
+	munmap(file->map, file->size);
+	free(file);
+}
+
+static const void *file_section(const cdbscan_file_t *file, uint64_t offset)
+{
+	return (const char *)file->map + offset;
+}
+
+int cdbscan_file_dataset(const cdbscan_file_t *file, cdbscan_dataset_t *data)
+{
+	if (!file || !data || file->header.dtype != CDBSCAN_FILE_DOUBLE)
+		return -1;
+	data->coords = (const double *)file_section(file,
+						    file->header.coords_offset);
+	data->num_points = (int)file->header.num_points;
+	data->dimensions = (int)file->header.dims;
+	return 0;
+}
+
+int cdbscan_file_int_dataset(const cdbscan_file_t *file,
+			     cdbscan_int_dataset_t *data)
+{
+	if (!file || !data || file->header.dtype != CDBSCAN_FILE_INT32)
+		return -1;
+	data->coords = (const int32_t *)file_section(
+		file, file->header.coords_offset);
+	data->num_points = (int)file->header.num_points;
+	data->dimensions = (int)file->header.dims;
+	return 0;
+}
+
+const int32_t *cdbscan_file_labels(const cdbscan_file_t *file)
+{
+	if (!file || !(file->header.flags & CDBSCAN_FILE_LABELS))
+		return NULL;
+	return (const int32_t *)file_section(file, file->header.labels_offset);
+}
+
+const double *cdbscan_file_weights(const cdbscan_file_t *file)
+{
+	if (!file || !(file->header.flags & CDBSCAN_FILE_WEIGHTS))
+		return NULL;
+	return (const double *)file_section(file,
+					    file->header.weights_offset);
+}
+
+/* Copy size bytes from the current position of src to dst */
+static int file_copy(FILE *dst, FILE *src, uint64_t size)
+{
+	char buf[FILE_COPY_BLOCK];
+	while (size > 0) {
+		size_t len = size < sizeof(buf) ? (size_t)size : sizeof(buf);
+		if (fread(buf, 1, len, src) != len ||
+		    fwrite(buf, 1, len, dst) != len)
+			return -1;
+		size -= len;
 	}
+	return 0;
+}
+
+/* Continue an existing file: copy its rows to the new file and its
+ * columns to the side files. The old file is only read.
+ * Returns: 0 on success, -1 on error */
+static int file_writer_reopen(cdbscan_file_writer_t *w, FILE *f)
+{
+	file_header_t h;
+	struct stat st;
+	if (fread(&h, sizeof(h), 1, f) != 1 || fstat(fileno(f), &st) != 0 ||
+	    !file_header_ok(&h, (size_t)st.st_size) ||
+	    h.dims != w->header.dims || h.dtype != w->header.dtype ||
+	    h.flags != w->header.flags)
+		return -1;
 
-	/* Process all seed points */
-	int current_seed = 0;
-	while (current_seed < *seed_size) {
-		int current_point = seeds[current_seed];
+	uint64_t offsets[2] = { h.labels_offset, h.weights_offset };
+	size_t sizes[2] = { sizeof(int32_t), sizeof(double) };
+	for (int s = 0; s < 2; s++) {
+		if (!w->side[s])
+			continue;
+		if (fseeko(f, (off_t)offsets[s], SEEK_SET) != 0 ||
+		    file_copy(w->side[s], f, h.num_points * sizes[s]) != 0)
+			return -1;
+	}
 
-		/* Find neighbors of current seed point using KD-tree */
-		int neighbor_count = kdtree_range_query(tree, current_point,
-							params->eps, neighbors);
+	size_t row = h.dims * file_dtype_size(h.dtype);
+	if (fseeko(f, (off_t)h.coords_offset, SEEK_SET) != 0 ||
+	    fseeko(w->f, (off_t)w->header.coords_offset, SEEK_SET) != 0 ||
+	    file_copy(w->f, f, h.num_points * row) != 0)
+		return -1;
+	w->header.num_points = h.num_points;
+	return 0;
+}
 
-		if (neighbor_count >= params->min_pts) {
-			/* Current point is also a core point */
-			for (int i = 0; i < neighbor_count; i++) {
-				int neighbor_idx = neighbors[i];
+cdbscan_file_writer_t *cdbscan_file_writer_create(const char *path, int dims,
+						  cdbscan_file_dtype_t dtype,
+						  int flags)
+{
+	if (!path || dims <= 0 || !file_dtype_size(dtype) ||
+	    (flags & ~(CDBSCAN_FILE_LABELS | CDBSCAN_FILE_WEIGHTS |
+		       CDBSCAN_FILE_APPEND)))
+		return NULL;
 
-				if (points[neighbor_idx].cluster_id ==
-					    CDBSCAN_UNCLASSIFIED ||
-				    points[neighbor_idx].cluster_id ==
-					    CDBSCAN_NOISE) {
-					if (points[neighbor_idx].cluster_id ==
-					    CDBSCAN_UNCLASSIFIED) {
-						/* Add to seeds if it was unclassified */
-						seeds[(*seed_size)++] =
-							neighbor_idx;
-					}
+	cdbscan_file_writer_t *w =
+		(cdbscan_file_writer_t *)calloc(1, sizeof(*w));
+	if (!w)
+		return NULL;
+	w->header.byte_order = FILE_BYTE_ORDER;
+	w->header.version = CDBSCAN_FILE_VERSION;
+	w->header.dtype = dtype;
+	w->header.layout = FILE_LAYOUT_ROWS;
+	w->header.dims = dims;
+	w->header.flags = flags & (CDBSCAN_FILE_LABELS | CDBSCAN_FILE_WEIGHTS);
+	w->header.coords_offset = file_align(sizeof(file_header_t));
+	for (int s = 0; s < 2; s++) {
+		if ((flags & (CDBSCAN_FILE_LABELS << s)) &&
+		    !(w->side[s] = tmpfile()))
+			w->failed = 1;
+	}
 
-					/* Assign to current cluster */
-					points[neighbor_idx].cluster_id =
-						cluster_id;
-				}
-			}
-		}
+	size_t len = strlen(path);
+	w->path = (char *)malloc(len + 1);
+	w->tmp_path = (char *)malloc(len + sizeof(".tmp"));
+	if (w->path && w->tmp_path) {
+		memcpy(w->path, path, len + 1);
+		memcpy(w->tmp_path, path, len);
+		memcpy(w->tmp_path + len, ".tmp", sizeof(".tmp"));
+		w->f = fopen(w->tmp_path, "wb");
+	}
 
-		current_seed++;
+	/* Header placeholder, the rows start after it */
+	static const char zero[FILE_ALIGN];
+	if (w->f && fwrite(zero, 1, w->header.coords_offset, w->f) !=
+			    w->header.coords_offset)
+		w->failed = 1;
+	FILE *f = (flags & CDBSCAN_FILE_APPEND) ? fopen(path, "rb") : NULL;
+	if (f) {
+		if (w->f && !w->failed && file_writer_reopen(w, f) != 0)
+			w->failed = 1;
+		fclose(f);
 	}
+	if (!w->f || w->failed) {
+		w->failed = 1;
+		cdbscan_file_writer_close(w);
+		return NULL;
+	}
+	return w;
+}
+
+int cdbscan_file_writer_append(cdbscan_file_writer_t *w, const void *coords,
+			       const int32_t *labels, const double *weights,
+			       int count)
+{
+	if (!w || w->failed || count < 0 || (count > 0 && !coords) ||
+	    (w->side[0] && count > 0 && !labels) ||
+	    (w->side[1] && count > 0 && !weights) ||
+	    (uint64_t)count > INT_MAX - w->header.num_points)
+		return -1;
+
+	size_t row = w->header.dims * file_dtype_size(w->header.dtype);
+	if (fwrite(coords, row, count, w->f) != (size_t)count ||
+	    (w->side[0] && fwrite(labels, sizeof(int32_t), count,
+				  w->side[0]) != (size_t)count) ||
+	    (w->side[1] && fwrite(weights, sizeof(double), count,
+				  w->side[1]) != (size_t)count)) {
+		w->failed = 1;
+		return -1;
+	}
+	w->header.num_points += count;
+	return 0;
+}
+
+int cdbscan_file_writer_close(cdbscan_file_writer_t *w)
+{
+	if (!w)
+		return -1;
 
-	return 1; /* Successfully expanded cluster */
+	file_header_t *h = &w->header;
+	uint64_t end = h->coords_offset +
+		       h->num_points * h->dims * file_dtype_size(h->dtype);
+	uint64_t *offsets[2] = { &h->labels_offset, &h->weights_offset };
+	size_t sizes[2] = { sizeof(int32_t), sizeof(double) };
+	for (int s = 0; s < 2 && !w->failed; s++) {
+		if (!w->side[s])
+			continue;
+		static const char zero[FILE_ALIGN];
+		*offsets[s] = file_align(end);
+		size_t pad = (size_t)(*offsets[s] - end);
+		end = *offsets[s] + h->num_points * sizes[s];
+		if (fwrite(zero, 1, pad, w->f) != pad ||
+		    fflush(w->side[s]) != 0 ||
+		    fseeko(w->side[s], 0, SEEK_SET) != 0 ||
+		    file_copy(w->f, w->side[s], h->num_points * sizes[s]) != 0)
+			w->failed = 1;
+	}
+	if (w->f && !w->failed) {
+		memcpy(h->magic, FILE_MAGIC, sizeof(h->magic));
+		if (fseeko(w->f, 0, SEEK_SET) != 0 ||
+		    fwrite(h, sizeof(*h), 1, w->f) != 1)
+			w->failed = 1;
+	}
+	if (w->f && fclose(w->f) != 0)
+		w->failed = 1;
+	for (int s = 0; s < 2; s++) {
+		if (w->side[s])
+			fclose(w->side[s]);
+	}
+	if (w->f && !w->failed && rename(w->tmp_path, w->path) != 0)
+		w->failed = 1;
+	if (w->f && w->failed)
+		unlink(w->tmp_path);
+
+	int ret = w->failed ? -1 : 0;
+	free(w->path);
+	free(w->tmp_path);
+	free(w);
+	return ret;
 }
 
 /* Utility functions */
@@ -0,0 +1,145 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: a context's allocator and huge pages serve its working memory,
+ * every block is freed with its size, and labels do not change */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+static void check_labels(cdbscan_context_t *ctx, const double *coords,
+			 int num_points, int dims, cdbscan_params_t params)
+{
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(expected && labels);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	int n = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	assert(n > 0);
+	assert(cdbscan_cluster_dataset(ctx, &data, params, labels) == n);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+	free(expected);
+	free(labels);
+}
+
+void test_allocator()
+{
+	printf("Test: Context Allocator\n");
+	printf("=======================\n");
+
+	srand(31);
+	int num_points = 20000;
+	double *coords = make_uniform(num_points, 2);
+	cdbscan_params_t params = { .eps = 0.01,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	alloc_stats_t stats = { 0 };
+	cdbscan_allocator_t allocator = { counting_alloc, NULL, counting_free,
+					  &stats };
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == 0);
+	check_labels(ctx, coords, num_points, 2, params);
+	assert(stats.allocs > 0 && stats.live > 0);
+
+	/* Held memory goes back through the old allocator on a change */
+	allocator.aligned_alloc = counting_aligned_alloc;
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == 0);
+	assert(stats.live == 0);
+	params.use_kdtree = 0;
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	check_labels(ctx, coords, 5000, 2, params);
+	assert(stats.aligned > 0);
+	printf("%d allocations, %d aligned\n", stats.allocs, stats.aligned);
+
+	cdbscan_context_destroy(ctx);
+	assert(stats.live == 0);
+
+	/* Missing functions, and back to malloc */
+	ctx = cdbscan_context_create(2);
+	assert(ctx);
+	allocator.free = NULL;
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == -1);
+	assert(cdbscan_context_set_allocator(NULL, NULL) == -1);
+	assert(cdbscan_context_set_allocator(ctx, NULL) == 0);
+	cdbscan_context_destroy(ctx);
+
+	free(coords);
+	printf("[PASS] Allocator serves and gets back all memory\n\n");
+}
+
+void test_huge_pages()
+{
+	printf("Test: Huge Pages\n");
+	printf("================\n");
+
+	/* Tree boxes and the curve copy of the points pass 2MB */
+	srand(37);
+	int num_points = 150000;
+	double *coords = make_uniform(num_points, 3);
+	cdbscan_params_t params = { .eps = 0.02,
+				    .min_pts = 6,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	alloc_stats_t stats = { 0 };
+	cdbscan_allocator_t allocator = { counting_alloc, NULL, counting_free,
+					  &stats };
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == 0);
+	assert(cdbscan_context_set_huge_pages(ctx, 1) == 0);
+	for (int run = 0; run < 2; run++) {
+		check_labels(ctx, coords, num_points, 3, params);
+	}
+
+	/* Small arrays still come from the allocator, large ones not */
+	size_t live = stats.live;
+	assert(stats.allocs > 0 && live > 0);
+	assert(cdbscan_context_set_huge_pages(ctx, 0) == 0);
+	assert(stats.live == 0);
+	check_labels(ctx, coords, num_points, 3, params);
+	printf("Allocator holds %zu bytes, %zu without huge pages\n", live,
+	       stats.live);
+	assert(stats.live > live);
+	assert(cdbscan_context_set_huge_pages(NULL, 1) == -1);
+	cdbscan_context_destroy(ctx);
+	assert(stats.live == 0);
+
+	free(coords);
+	printf("[PASS] Labels match with huge pages\n\n");
+}
+
+int main()
+{
+	printf("Testing Allocators\n");
+	printf("==================\n\n");
+
+	test_allocator();
+	test_huge_pages();
+
+	printf("[SUCCESS] All allocator tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,180 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: row-major datasets and batches give the same labels as
+ * cdbscan_cluster() on the same points */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+static double *make_coords(int num_points, int dims, unsigned int seed)
+{
+	srand(seed);
+	return make_blobs(num_points, dims, 3, 4.0, 1.0, 1.0);
+}
+
+/* Labels from the point-array API, for reference */
+static int reference_labels(const double *coords, int num_points, int dims,
+			    cdbscan_params_t params, int *labels)
+{
+	cdbscan_point_t *points = cdbscan_create_points(num_points, dims);
+	assert(points);
+	for (int i = 0; i < num_points; i++) {
+		memcpy(points[i].coords, coords + i * dims,
+		       dims * sizeof(double));
+	}
+
+	int n = cdbscan_cluster(points, num_points, params);
+	for (int i = 0; i < num_points; i++) {
+		labels[i] = points[i].cluster_id;
+		free(points[i].coords);
+	}
+	free(points);
+	return n;
+}
+
+void test_cluster_dataset()
+{
+	printf("Test: Clustering a Row-Major Dataset\n");
+	printf("====================================\n");
+
+	int num_points = 3000;
+	int dims = 3;
+	double *coords = make_coords(num_points, dims, 4);
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(expected && labels);
+
+	cdbscan_params_t params = { .eps = 0.3,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	cdbscan_dataset_t data = { coords, num_points, dims };
+
+	int n_ref = reference_labels(coords, num_points, dims, params,
+				     expected);
+	int n = cdbscan_cluster_dataset(NULL, &data, params, labels);
+	printf("Clusters: %d (reference %d)\n", n, n_ref);
+	assert(n == n_ref && n > 0);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+
+	/* Invalid input */
+	assert(cdbscan_cluster_dataset(NULL, NULL, params, labels) == -1);
+	assert(cdbscan_cluster_dataset(NULL, &data, params, NULL) == -1);
+	coords[7] = NAN;
+	assert(cdbscan_cluster_dataset(NULL, &data, params, labels) == -1);
+
+	printf("[PASS] Labels match cdbscan_cluster()\n\n");
+
+	free(coords);
+	free(expected);
+	free(labels);
+}
+
+void test_cluster_batch()
+{
+	printf("Test: Batch of Small Datasets\n");
+	printf("=============================\n");
+
+	int num_items = 200;
+	int dims = 2;
+	cdbscan_batch_item_t *items = (cdbscan_batch_item_t *)calloc(
+		num_items, sizeof(cdbscan_batch_item_t));
+	int **expected = (int **)calloc(num_items, sizeof(int *));
+	int *expected_clusters = (int *)calloc(num_items, sizeof(int));
+	assert(items && expected && expected_clusters);
+
+	cdbscan_params_t params = { .eps = 0.25,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	/* Sizes from a handful of points up to a few thousand */
+	for (int i = 0; i < num_items; i++) {
+		int n = 5 + (i * 7919) % 3000;
+		double *coords = make_coords(n, dims, 1000 + i);
+		items[i].data.coords = coords;
+		items[i].data.num_points = n;
+		items[i].data.dimensions = dims;
+		items[i].labels = (int *)malloc(n * sizeof(int));
+		expected[i] = (int *)malloc(n * sizeof(int));
+		assert(items[i].labels && expected[i]);
+		expected_clusters[i] = reference_labels(coords, n, dims,
+							params, expected[i]);
+	}
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	/* Serial, threaded, and again to reuse the context's memory */
+	for (int run = 0; run < 3; run++) {
+		for (int i = 0; i < num_items; i++) {
+			memset(items[i].labels, 0,
+			       items[i].data.num_points * sizeof(int));
+		}
+
+		int ret = cdbscan_cluster_batch(run ? ctx : NULL, items,
+						num_items, params);
+		assert(ret == 0);
+		for (int i = 0; i < num_items; i++) {
+			assert(items[i].num_clusters == expected_clusters[i]);
+			for (int p = 0; p < items[i].data.num_points; p++) {
+				assert(items[i].labels[p] == expected[i][p]);
+			}
+		}
+		printf("Run %d: %d datasets match\n", run, num_items);
+	}
+
+	/* A bad dataset fails alone */
+	int *saved = items[3].labels;
+	items[3].labels = NULL;
+	assert(cdbscan_cluster_batch(ctx, items, num_items, params) == -1);
+	assert(items[3].num_clusters == -1);
+	assert(items[4].num_clusters == expected_clusters[4]);
+	items[3].labels = saved;
+
+	printf("[PASS] Batch labels match per-dataset results\n\n");
+
+	for (int i = 0; i < num_items; i++) {
+		free((double *)items[i].data.coords);
+		free(items[i].labels);
+		free(expected[i]);
+	}
+	free(items);
+	free(expected);
+	free(expected_clusters);
+	cdbscan_context_destroy(ctx);
+}
+
+int main()
+{
+	printf("Testing Dataset and Batch API\n");
+	printf("=============================\n\n");
+
+	test_cluster_dataset();
+	test_cluster_batch();
+
+	printf("[SUCCESS] All batch tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,148 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: clustering without a KD-tree, over the bit matrix of
+ * neighborhoods, gives the labels of the KD-tree and of a direct count */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+/* Blobs of different spread, with a few near-duplicate points */
+static double *make_coords(int num_points, int dims)
+{
+	double *coords = make_blobs(num_points, dims, 5, 2.0, 0.5, 1.0);
+	for (int i = 1; i < num_points; i += 97) {
+		memcpy(coords + i * dims, coords + (i - 1) * dims,
+		       dims * sizeof(double));
+		coords[i * dims] += 0.25;
+	}
+	return coords;
+}
+
+static double manhattan(const double *a, const double *b, int dims,
+			void *params)
+{
+	(void)params;
+	return cdbscan_manhattan_distance(a, b, dims);
+}
+
+static int cluster(cdbscan_context_t *ctx, const double *coords,
+		   int num_points, int dims, cdbscan_params_t params,
+		   int *labels)
+{
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	return cdbscan_cluster_dataset(ctx, &data, params, labels);
+}
+
+/* Every point with min_pts neighbors by a direct count is in a cluster */
+static void check_core(const double *coords, int num_points, int dims,
+		       cdbscan_params_t params, const int *labels)
+{
+	for (int i = 0; i < num_points; i++) {
+		int count = 0;
+		for (int j = 0; j < num_points; j++) {
+			count += cdbscan_manhattan_distance(
+					 coords + i * dims, coords + j * dims,
+					 dims) <= params.eps;
+		}
+		if (count >= params.min_pts)
+			assert(labels[i] >= 0);
+	}
+}
+
+void test_bit_matrix_labels()
+{
+	printf("Test: Bit Matrix Labels\n");
+	printf("=======================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	srand(23);
+
+	/* Sizes off and on a word boundary, low and high dimensions */
+	int sizes[3] = { 1000, 2048, 3001 };
+	int dims[3] = { 2, 7, 24 };
+	for (int t = 0; t < 3; t++) {
+		int n = sizes[t], d = dims[t];
+		double *coords = make_coords(n, d);
+		int *expected = (int *)malloc(n * sizeof(int));
+		int *labels = (int *)malloc(n * sizeof(int));
+		assert(expected && labels);
+
+		cdbscan_params_t params = { .eps = 0.25 * d,
+					    .min_pts = 5,
+					    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+					    .use_kdtree = 1 };
+		int n_ref = cluster(NULL, coords, n, d, params, expected);
+		assert(n_ref > 0);
+		params.use_kdtree = 0;
+		for (int run = 0; run < 2; run++) {
+			assert(cluster(run ? ctx : NULL, coords, n, d, params,
+				       labels) == n_ref);
+			for (int i = 0; i < n; i++) {
+				assert(labels[i] == expected[i]);
+			}
+		}
+
+		/* Manhattan mirrors half of the matrix, a custom metric
+		 * computes all of it */
+		params.dist_type = CDBSCAN_DIST_MANHATTAN;
+		params.eps = 0.25 * d * 1.5;
+		n_ref = cluster(ctx, coords, n, d, params, expected);
+		check_core(coords, n, d, params, expected);
+		params.dist_type = CDBSCAN_DIST_CUSTOM;
+		params.custom_dist = manhattan;
+		assert(cluster(ctx, coords, n, d, params, labels) == n_ref);
+		for (int i = 0; i < n; i++) {
+			assert(labels[i] == expected[i]);
+		}
+		printf("%d points, %dD: %d clusters\n", n, d, n_ref);
+
+		free(coords);
+		free(expected);
+		free(labels);
+	}
+
+	/* Large matrices only under a memory limit that has room */
+	cdbscan_params_t params = { .eps = 0.5,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_MANHATTAN };
+	size_t matrix = (size_t)30000 * 30000 / 8;
+	assert(cdbscan_memory_estimate(ctx, 30000, 2, params) < matrix);
+	assert(cdbscan_memory_estimate(ctx, 20000, 2, params) >
+	       (size_t)20000 * 20000 / 8);
+	assert(cdbscan_context_set_memory_limit(ctx, 2 * matrix) == 0);
+	assert(cdbscan_memory_estimate(ctx, 30000, 2, params) > matrix);
+
+	cdbscan_context_destroy(ctx);
+	printf("[PASS] Bit matrix labels match\n\n");
+}
+
+int main()
+{
+	printf("Testing Bit Matrix Clustering\n");
+	printf("=============================\n\n");
+
+	test_bit_matrix_labels();
+
+	printf("[SUCCESS] All bit matrix tests passed!\n");
+	return 0;
+}
@@ -26,6 +26,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <assert.h>
 #include "cdbscan.h"
 
@@ -181,12 +182,76 @@ void test_border_and_noise_points()
 	free(neighbors);
 }
 
+static double euclidean(const double *a, const double *b, int dims,
+			void *params)
+{
+	(void)params;
+	return cdbscan_euclidean_distance(a, b, dims);
+}
+
+/* Most points are scattered noise that is settled without a query;
+ * those next to a core point must still become border points */
+void test_sparse_noise_points()
+{
+	printf("Test: Sparse Noise Points\n");
+	printf("=========================\n");
+
+	int num_points = 6000;
+	double *coords = (double *)malloc(num_points * 2 * sizeof(double));
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(coords && expected && labels);
+
+	/* Rings of points just over eps apart around small dense discs */
+	srand(5);
+	for (int i = 0; i < num_points; i++) {
+		double angle = rand() / (double)RAND_MAX * 6.283185307179586;
+		double radius = rand() / (double)RAND_MAX;
+		int disc = i % 40;
+		if (i % 3)
+			radius = 1.0 + 5.0 * radius * radius;
+		else
+			radius *= 0.3;
+		coords[i * 2] = disc * 12.0 + radius * cos(angle);
+		coords[i * 2 + 1] = radius * sin(angle);
+	}
+
+	cdbscan_dataset_t data = { coords, num_points, 2 };
+	cdbscan_params_t params = { .eps = 0.8,
+				    .min_pts = 12,
+				    .dist_type = CDBSCAN_DIST_CUSTOM,
+				    .custom_dist = euclidean };
+	int n_ref = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+
+	/* Brute force and KD-tree, with and without a sketch */
+	int border = 0;
+	for (int kdtree = 0; kdtree < 2; kdtree++) {
+		params.use_kdtree = kdtree;
+		int n = cdbscan_cluster_dataset(NULL, &data, params, labels);
+		assert(n == n_ref);
+		for (int i = 0; i < num_points; i++) {
+			assert(labels[i] == expected[i]);
+			border += i % 3 && labels[i] >= 0;
+		}
+	}
+	printf("Clusters: %d, ring points in clusters: %d\n", n_ref,
+	       border / 2);
+	assert(border > 0);
+
+	printf("[PASS] Sparse points keep their border labels\n\n");
+	free(coords);
+	free(expected);
+	free(labels);
+}
+
 int main()
 {
 	printf("Testing DBSCAN Border Points and Noise Specification\n");
 	printf("====================================================\n\n");
 
 	test_border_and_noise_points();
+	test_sparse_noise_points();
 
 	printf("\n[SUCCESS] All border and noise tests passed!\n");
 	return 0;
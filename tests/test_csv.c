@@ -0,0 +1,249 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: CSV files load with the values strtod() gives, selected columns
+ * and headers are honored, and bad fields report their line */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "cdbscan.h"
+
+static char path[] = "/tmp/cdbscan_csv_XXXXXX";
+
+static void write_file(const char *text, size_t len)
+{
+	FILE *f = fopen(path, "wb");
+	assert(f);
+	assert(fwrite(text, 1, len, f) == len);
+	fclose(f);
+}
+
+static int load(cdbscan_context_t *ctx, const char *text,
+		cdbscan_csv_options_t *opts, cdbscan_dataset_t *data)
+{
+	write_file(text, strlen(text));
+	return cdbscan_load_csv(ctx, path, opts, data);
+}
+
+/* One value in a format picked by rand() */
+static int format_value(char *buf, size_t size)
+{
+	double v = (rand() / (double)RAND_MAX - 0.5) * 2000.0;
+	switch (rand() % 6) {
+	case 0:
+		return snprintf(buf, size, "%.17g", v);
+	case 1:
+		return snprintf(buf, size, "%.3f", v);
+	case 2:
+		return snprintf(buf, size, "%.6e", v * 1e-30);
+	case 3:
+		return snprintf(buf, size, "%d", (int)v);
+	case 4:
+		return snprintf(buf, size, "%.25f", v * 1e-6);
+	default:
+		return snprintf(buf, size, " \"%.9g\" ", v);
+	}
+}
+
+void test_csv_values()
+{
+	printf("Test: CSV Values\n");
+	printf("================\n");
+
+	/* Several chunks, with CRLF and blank lines and no final newline */
+	srand(53);
+	int num_points = 120000, dims = 3;
+	size_t cap = (size_t)num_points * 128, len = 0;
+	char *text = (char *)malloc(cap);
+	double *expected = (double *)malloc(num_points * dims * sizeof(double));
+	assert(text && expected);
+	len += sprintf(text, "x,y,z\n");
+	for (int i = 0; i < num_points; i++) {
+		for (int d = 0; d < dims; d++) {
+			char buf[64];
+			format_value(buf, sizeof(buf));
+			expected[i * dims + d] = strtod(buf + (buf[0] == ' ') +
+							(buf[1] == '"'),
+							NULL);
+			len += sprintf(text + len, "%s%s", d ? "," : "", buf);
+		}
+		if (i % 1000 == 999)
+			len += sprintf(text + len, "\r\n\n");
+		else if (i < num_points - 1)
+			len += sprintf(text + len, "\n");
+	}
+	write_file(text, len);
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	cdbscan_context_t *ctxs[2] = { NULL, ctx };
+	for (int t = 0; t < 2; t++) {
+		cdbscan_dataset_t data;
+		assert(cdbscan_load_csv(ctxs[t], path, NULL, &data) == 0);
+		assert(data.num_points == num_points);
+		assert(data.dimensions == dims);
+		assert(memcmp(data.coords, expected,
+			      num_points * dims * sizeof(double)) == 0);
+		cdbscan_free_dataset(&data);
+		assert(!data.coords && data.num_points == 0);
+	}
+	printf("%d points in %zu bytes\n", num_points, len);
+
+	/* Digits past the fast path, exponents and words strtod() takes */
+	const char *hard[] = { "0.1",
+			       "-0",
+			       "123456789012345678901234567890",
+			       "9007199254740993",
+			       "2.2250738585072011e-308",
+			       "4.9e-324",
+			       "1e23",
+			       "0.000000000000000000000000000001",
+			       "+.5",
+			       "7.",
+			       "1E+2",
+			       "0x1p-3",
+			       "1.7976931348623157e308" };
+	int num_hard = sizeof(hard) / sizeof(hard[0]);
+	len = 0;
+	for (int i = 0; i < num_hard; i++)
+		len += sprintf(text + len, "%s\n", hard[i]);
+	cdbscan_dataset_t data;
+	assert(load(ctx, text, NULL, &data) == 0);
+	assert(data.num_points == num_hard && data.dimensions == 1);
+	for (int i = 0; i < num_hard; i++) {
+		double v = strtod(hard[i], NULL);
+		assert(memcmp(&data.coords[i], &v, sizeof(double)) == 0);
+	}
+	cdbscan_free_dataset(&data);
+
+	cdbscan_context_destroy(ctx);
+	free(text);
+	free(expected);
+	printf("[PASS] Values match strtod()\n\n");
+}
+
+void test_csv_columns()
+{
+	printf("Test: CSV Columns\n");
+	printf("=================\n");
+
+	const char *text = "\xEF\xBB\xBF"
+			   "id, \"x\" ,y,label\n"
+			   "1,0.5,2.5,a\n"
+			   "2,1.5,3.5,b\n";
+	cdbscan_dataset_t data;
+
+	/* By name, in the order asked for; the header is implied */
+	const char *names[2] = { "y", "x" };
+	cdbscan_csv_options_t opts = { .column_names = names,
+				       .num_columns = 2 };
+	assert(load(NULL, text, &opts, &data) == 0);
+	assert(data.num_points == 2 && data.dimensions == 2);
+	assert(data.coords[0] == 2.5 && data.coords[1] == 0.5);
+	assert(data.coords[2] == 3.5 && data.coords[3] == 1.5);
+	cdbscan_free_dataset(&data);
+
+	/* By index; the header is detected */
+	int columns[3] = { 1, 0, 2 };
+	opts = (cdbscan_csv_options_t){ .columns = columns, .num_columns = 3 };
+	assert(load(NULL, text, &opts, &data) == 0);
+	assert(data.num_points == 2 && data.dimensions == 3);
+	assert(data.coords[0] == 0.5 && data.coords[1] == 1.0 &&
+	       data.coords[5] == 3.5);
+	cdbscan_free_dataset(&data);
+
+	/* Every column of a file without header, another delimiter */
+	opts = (cdbscan_csv_options_t){ .delimiter = ';' };
+	assert(load(NULL, "\n1;2\n3;4\n\n", &opts, &data) == 0);
+	assert(data.num_points == 2 && data.dimensions == 2);
+	assert(data.coords[0] == 1.0 && data.coords[3] == 4.0);
+	cdbscan_free_dataset(&data);
+
+	/* A numeric first line skipped as header on request */
+	opts = (cdbscan_csv_options_t){ .header = 1 };
+	assert(load(NULL, "1,2\n3,4\n", &opts, &data) == 0);
+	assert(data.num_points == 1 && data.coords[0] == 3.0);
+	cdbscan_free_dataset(&data);
+
+	printf("[PASS] Columns are selected\n\n");
+}
+
+void test_csv_errors()
+{
+	printf("Test: CSV Errors\n");
+	printf("================\n");
+
+	cdbscan_dataset_t data;
+	cdbscan_csv_options_t opts = { 0 };
+
+	/* Bad fields give the line of the first */
+	assert(load(NULL, "x,y\n1,2\n\n3,abc\n5,6\n7\n", &opts, &data) == -1);
+	assert(opts.error_line == 4);
+	assert(load(NULL, "x,y\n1,2\n3,4\n5\n", &opts, &data) == -1);
+	assert(opts.error_line == 4);
+	assert(load(NULL, "1,2\n3,inf\n", &opts, &data) == -1);
+	assert(opts.error_line == 2);
+	assert(load(NULL, "1,2\n3,\n", &opts, &data) == -1);
+	assert(opts.error_line == 2);
+	assert(load(NULL, "1,2\n3,4 5\n", &opts, &data) == -1);
+	assert(opts.error_line == 2);
+	assert(load(NULL, "1,2\n3,4\n", &opts, &data) == 0);
+	assert(opts.error_line == 0);
+	cdbscan_free_dataset(&data);
+
+	/* Nothing to load, or columns that do not exist */
+	assert(load(NULL, "x,y\n", &opts, &data) == -1);
+	assert(load(NULL, "\n\n", &opts, &data) == -1);
+	const char *names[1] = { "z" };
+	opts = (cdbscan_csv_options_t){ .column_names = names,
+					.num_columns = 1 };
+	assert(load(NULL, "x,y\n1,2\n", &opts, &data) == -1);
+	int columns[2] = { 0, 0 };
+	opts = (cdbscan_csv_options_t){ .columns = columns, .num_columns = 2 };
+	assert(load(NULL, "1,2\n", &opts, &data) == -1);
+	columns[1] = 2;
+	assert(load(NULL, "1,2\n", &opts, &data) == -1);
+	assert(opts.error_line == 0);
+
+	write_file("", 0);
+	assert(cdbscan_load_csv(NULL, path, NULL, &data) == -1);
+	unlink(path);
+	assert(cdbscan_load_csv(NULL, path, NULL, &data) == -1);
+	assert(cdbscan_load_csv(NULL, NULL, NULL, &data) == -1);
+
+	printf("[PASS] Errors are reported\n\n");
+}
+
+int main()
+{
+	printf("Testing CSV Loading\n");
+	printf("===================\n\n");
+
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	test_csv_values();
+	test_csv_columns();
+	test_csv_errors();
+
+	printf("[SUCCESS] All CSV tests passed!\n");
+	return 0;
+}
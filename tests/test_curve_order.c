@@ -0,0 +1,205 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: sorting points along a space-filling curve does not change any
+ * label, including cluster numbering and border assignment */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+/* Blobs with narrow gaps between them, in random input order */
+static void check_coords(cdbscan_context_t *ctx, double *coords,
+			 int num_points, int dims, cdbscan_params_t params)
+{
+	int *plain = (int *)malloc(num_points * sizeof(int));
+	int *sorted = (int *)malloc(num_points * sizeof(int));
+	assert(plain && sorted);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	params.curve_order = -1;
+	int n_plain = cdbscan_cluster_dataset(ctx, &data, params, plain);
+	params.curve_order = 1;
+	int n_sorted = cdbscan_cluster_dataset(ctx, &data, params, sorted);
+	assert(n_plain == n_sorted && n_plain > 0);
+	for (int i = 0; i < num_points; i++) {
+		assert(plain[i] == sorted[i]);
+	}
+	printf("%dD, metric %d, kd-tree %d: %d clusters\n", dims,
+	       params.dist_type, params.use_kdtree, n_plain);
+
+	free(coords);
+	free(plain);
+	free(sorted);
+}
+
+static void check_order(cdbscan_context_t *ctx, int num_points, int dims,
+			cdbscan_params_t params)
+{
+	check_coords(ctx, make_blobs(num_points, dims, 8, 1.1, 1.0, 0.0),
+		     num_points, dims, params);
+}
+
+void test_curve_order_labels()
+{
+	printf("Test: Labels Under Curve Order\n");
+	printf("==============================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	srand(9);
+
+	cdbscan_params_t params = { .eps = 0.08,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	check_order(NULL, 6000, 2, params);
+	check_order(ctx, 6000, 2, params);
+	params.eps = 0.2;
+	check_order(ctx, 5000, 3, params);
+	params.eps = 0.4;
+	check_order(ctx, 4000, 6, params); /* Core counts in query packets */
+	params.eps = 0.7;
+	check_order(ctx, 3000, 10, params); /* Forced beyond the auto range */
+
+	params.use_kdtree = 0;
+	params.eps = 0.1;
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	check_order(ctx, 2000, 2, params);
+	params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+	params.eps = 0.05;
+	check_order(ctx, 1500, 1, params);
+
+	cdbscan_context_destroy(ctx);
+	printf("[PASS] Curve order leaves labels unchanged\n\n");
+}
+
+void test_curve_order_duplicates()
+{
+	printf("Test: Repeated Points Under Curve Order\n");
+	printf("=======================================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	srand(5);
+
+	/* Few distinct positions, so runs of equal curve keys are longer
+	 * than a tree leaf */
+	int num_points = 8000;
+	double *coords = (double *)malloc(num_points * 2 * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points * 2; i++) {
+		coords[i] = (rand() % 40) * 0.05;
+	}
+	cdbscan_params_t params = { .eps = 0.06,
+				    .min_pts = 30,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	check_coords(ctx, coords, num_points, 2, params);
+
+	/* One position with a few outliers far away */
+	coords = (double *)malloc(num_points * 2 * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points * 2; i++) {
+		coords[i] = i % 1000 == 1 ? 100.0 + i : 1.0;
+	}
+	check_coords(NULL, coords, num_points, 2, params);
+
+	cdbscan_context_destroy(ctx);
+	printf("[PASS] Repeated points cluster the same\n\n");
+}
+
+/* Points packed, checked and measured in one pass cluster like the same
+ * coordinates as a dataset, and any bad point fails the call */
+void test_curve_order_points()
+{
+	printf("Test: Points Packed Under Curve Order\n");
+	printf("=====================================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	srand(7);
+
+	int num_points = 12000, dims = 3;
+	double *coords = make_blobs(num_points, dims, 8, 1.1, 1.0, 0.0);
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	cdbscan_point_t *points =
+		(cdbscan_point_t *)malloc(num_points * sizeof(cdbscan_point_t));
+	assert(labels && points);
+	for (int i = 0; i < num_points; i++) {
+		points[i].coords = coords + i * dims;
+		points[i].dimensions = dims;
+	}
+
+	cdbscan_params_t params = { .eps = 0.08,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	int n = cdbscan_cluster_dataset(ctx, &data, params, labels);
+	assert(n > 0);
+	assert(cdbscan_cluster_ctx(ctx, points, num_points, params) == n);
+	for (int i = 0; i < num_points; i++) {
+		assert(points[i].cluster_id == labels[i]);
+	}
+	printf("%d points: %d clusters\n", num_points, n);
+
+	/* Bad values in the last chunk, seen by every thread count */
+	double saved = coords[(num_points - 1) * dims + 1];
+	double bad[2] = { NAN, INFINITY };
+	for (int b = 0; b < 2; b++) {
+		coords[(num_points - 1) * dims + 1] = bad[b];
+		assert(cdbscan_cluster_dataset(ctx, &data, params, labels) ==
+		       -1);
+		assert(cdbscan_cluster_dataset(NULL, &data, params, labels) ==
+		       -1);
+		assert(cdbscan_cluster_ctx(ctx, points, num_points, params) ==
+		       -1);
+	}
+	coords[(num_points - 1) * dims + 1] = saved;
+
+	/* Malformed points */
+	points[9000].dimensions = 2;
+	assert(cdbscan_cluster_ctx(ctx, points, num_points, params) == -1);
+	points[9000].dimensions = dims;
+	points[5].coords = NULL;
+	assert(cdbscan_cluster_ctx(NULL, points, num_points, params) == -1);
+	points[5].coords = coords + 5 * dims;
+	assert(cdbscan_cluster_ctx(NULL, points, num_points, params) == n);
+
+	cdbscan_context_destroy(ctx);
+	free(coords);
+	free(labels);
+	free(points);
+	printf("[PASS] Packed points match and bad points fail\n\n");
+}
+
+int main()
+{
+	printf("Testing Space-Filling Curve Order\n");
+	printf("=================================\n\n");
+
+	test_curve_order_labels();
+	test_curve_order_duplicates();
+	test_curve_order_points();
+
+	printf("[SUCCESS] All curve order tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,257 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: eps estimation from k-distance curves */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+/* Two dense blobs plus uniform background noise */
+static cdbscan_point_t *make_blobs(int num_points)
+{
+	cdbscan_point_t *points = cdbscan_create_points(num_points, 2);
+	assert(points);
+
+	srand(42);
+	for (int i = 0; i < num_points; i++) {
+		double u = rand() / (double)RAND_MAX;
+		double v = rand() / (double)RAND_MAX;
+		if (i % 10 == 9) {
+			points[i].coords[0] = u * 10.0;
+			points[i].coords[1] = v * 10.0;
+		} else {
+			double cx = (i % 2) ? 2.0 : 7.0;
+			points[i].coords[0] = cx + (u - 0.5) * 1.0;
+			points[i].coords[1] = 5.0 + (v - 0.5) * 1.0;
+		}
+	}
+	return points;
+}
+
+static void free_blobs(cdbscan_point_t *points, int num_points)
+{
+	for (int i = 0; i < num_points; i++) {
+		free(points[i].coords);
+	}
+	free(points);
+}
+
+void test_sampled_matches_full()
+{
+	printf("Test: Sampling Every Point Matches Full Estimate\n");
+	printf("================================================\n");
+
+	int num_points = 500;
+	int k = 4;
+	cdbscan_point_t *points = make_blobs(num_points);
+
+	cdbscan_kdist_result_t *full = cdbscan_estimate_eps(points, num_points,
+							    k);
+	assert(full);
+
+	cdbscan_sample_opts_t opts = { .num_samples = num_points, .seed = 1 };
+	cdbscan_eps_sample_result_t *sampled =
+		cdbscan_estimate_eps_sampled(points, num_points, k, &opts);
+	assert(sampled);
+
+	printf("Full eps: %.6f, sampled eps: %.6f [%.6f, %.6f]\n",
+	       full->suggested_eps, sampled->suggested_eps, sampled->ci_low,
+	       sampled->ci_high);
+
+	assert(sampled->num_samples == num_points);
+	assert(fabs(full->suggested_eps - sampled->suggested_eps) < 1e-12);
+	assert(sampled->ci_low <= sampled->suggested_eps);
+	assert(sampled->ci_high >= sampled->suggested_eps);
+
+	printf("[PASS] Exhaustive sample reproduces the full estimate\n\n");
+
+	cdbscan_free_kdist_result(full);
+	cdbscan_free_eps_sample_result(sampled);
+	free_blobs(points, num_points);
+}
+
+void test_sampled_interval()
+{
+	printf("Test: Bootstrap Interval and Target Width\n");
+	printf("=========================================\n");
+
+	int num_points = 4000;
+	int k = 4;
+	cdbscan_point_t *points = make_blobs(num_points);
+
+	cdbscan_kdist_result_t *full = cdbscan_estimate_eps(points, num_points,
+							    k);
+	assert(full);
+
+	cdbscan_sample_opts_t opts = { .num_samples = 400, .seed = 7 };
+	cdbscan_eps_sample_result_t *a =
+		cdbscan_estimate_eps_sampled(points, num_points, k, &opts);
+	cdbscan_eps_sample_result_t *b =
+		cdbscan_estimate_eps_sampled(points, num_points, k, &opts);
+	assert(a && b);
+
+	printf("Full eps: %.4f, m=%d sampled eps: %.4f [%.4f, %.4f]\n",
+	       full->suggested_eps, a->num_samples, a->suggested_eps,
+	       a->ci_low, a->ci_high);
+
+	/* Same seed, same answer */
+	assert(a->num_samples == 400);
+	assert(a->suggested_eps == b->suggested_eps);
+	assert(a->ci_low == b->ci_low && a->ci_high == b->ci_high);
+
+	/* And the same on threads */
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	cdbscan_eps_sample_result_t *e = cdbscan_estimate_eps_sampled_ctx(
+		ctx, points, num_points, k, &opts);
+	assert(e && e->num_samples == a->num_samples);
+	assert(memcmp(e->distances, a->distances,
+		      a->num_samples * sizeof(double)) == 0);
+	assert(e->ci_low == a->ci_low && e->ci_high == a->ci_high);
+	cdbscan_free_eps_sample_result(e);
+	cdbscan_context_destroy(ctx);
+
+	/* The interval should cover the full-data estimate */
+	assert(a->ci_low <= full->suggested_eps);
+	assert(a->ci_high >= full->suggested_eps);
+	printf("[OK] Interval covers the full estimate\n");
+
+	/* A width we can never reach grows the sample to its cap */
+	cdbscan_sample_opts_t tight = { .num_samples = 100,
+					.max_samples = 800,
+					.target_width = 1e-12,
+					.seed = 7 };
+	cdbscan_eps_sample_result_t *c =
+		cdbscan_estimate_eps_sampled(points, num_points, k, &tight);
+	assert(c);
+	printf("Unreachable width: m=%d, width=%.4f\n", c->num_samples,
+	       c->ci_high - c->ci_low);
+	assert(c->num_samples == 800);
+
+	/* A generous width stops at the initial sample */
+	cdbscan_sample_opts_t loose = { .num_samples = 100,
+					.target_width = 1e6,
+					.seed = 7 };
+	cdbscan_eps_sample_result_t *d =
+		cdbscan_estimate_eps_sampled(points, num_points, k, &loose);
+	assert(d);
+	assert(d->num_samples == 100);
+	printf("[OK] Target width controls the sample size\n");
+
+	printf("[PASS] Bootstrap interval test passed\n\n");
+
+	cdbscan_free_kdist_result(full);
+	cdbscan_free_eps_sample_result(a);
+	cdbscan_free_eps_sample_result(b);
+	cdbscan_free_eps_sample_result(c);
+	cdbscan_free_eps_sample_result(d);
+	free_blobs(points, num_points);
+}
+
+void test_multi_k_curves()
+{
+	printf("Test: Multi-k Curves From One Sweep\n");
+	printf("===================================\n");
+
+	int num_points = 1000;
+	int max_k = 6;
+	cdbscan_point_t *points = make_blobs(num_points);
+
+	cdbscan_kdist_curves_t *curves =
+		cdbscan_estimate_eps_multi(points, num_points, max_k);
+	assert(curves);
+	assert(curves->max_k == max_k && curves->num_points == num_points);
+
+	for (int k = 1; k <= max_k; k++) {
+		const double *curve =
+			curves->distances + (size_t)(k - 1) * num_points;
+
+		/* Curves are ascending and nested: d_k <= d_(k+1) */
+		for (int i = 1; i < num_points; i++) {
+			assert(curve[i - 1] <= curve[i]);
+		}
+		if (k > 1) {
+			const double *prev = curve - num_points;
+			for (int i = 0; i < num_points; i++) {
+				assert(prev[i] <= curve[i]);
+			}
+		}
+
+		/* Each curve agrees with a single-k estimate */
+		cdbscan_kdist_result_t *single =
+			cdbscan_estimate_eps(points, num_points, k);
+		assert(single);
+		printf("k=%d: eps=%.4f (single-k %.4f), knee at %d\n", k,
+		       curves->suggested_eps[k - 1], single->suggested_eps,
+		       curves->knee_index[k - 1]);
+		assert(curves->suggested_eps[k - 1] == single->suggested_eps);
+		assert(curves->knee_index[k - 1] >= 0);
+		cdbscan_free_kdist_result(single);
+	}
+
+	printf("[PASS] Multi-k curves match per-k estimates\n\n");
+
+	cdbscan_free_kdist_curves(curves);
+	free_blobs(points, num_points);
+}
+
+void test_knee_detection()
+{
+	printf("Test: Knee Detection\n");
+	printf("====================\n");
+
+	/* Flat k-distances for 90 clustered points, then a steep noise tail:
+	 * the knee sits where the tail starts, not at a fixed percentile */
+	int num_points = 100;
+	cdbscan_point_t *points = cdbscan_create_points(num_points, 1);
+	assert(points);
+	for (int i = 0; i < 90; i++) {
+		points[i].coords[0] = i * 0.1;
+	}
+	for (int i = 90; i < num_points; i++) {
+		points[i].coords[0] = 100.0 * (i - 88);
+	}
+
+	cdbscan_kdist_result_t *kdist = cdbscan_estimate_eps(points,
+							     num_points, 1);
+	assert(kdist);
+	printf("Suggested eps: %.4f\n", kdist->suggested_eps);
+	assert(fabs(kdist->suggested_eps - 0.1) < 1e-9);
+
+	printf("[PASS] Knee found at the end of the flat region\n\n");
+
+	cdbscan_free_kdist_result(kdist);
+	free_blobs(points, num_points);
+}
+
+int main()
+{
+	printf("Testing Eps Estimation\n");
+	printf("======================\n\n");
+
+	test_sampled_matches_full();
+	test_sampled_interval();
+	test_multi_k_curves();
+	test_knee_detection();
+
+	printf("[SUCCESS] All eps estimation tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: dataset files written in appends open with the same points,
+ * labels and weights, cluster in place, and broken files do not open */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+static char path[] = "/tmp/cdbscan_file_XXXXXX";
+
+/* Write points from..to of coords, labels and weights in uneven appends */
+static void write_points(cdbscan_file_writer_t *w, const double *coords,
+			 const int32_t *labels, const double *weights,
+			 int dims, int from, int to)
+{
+	while (from < to) {
+		int count = rand() % 1500;
+		if (count > to - from)
+			count = to - from;
+		assert(cdbscan_file_writer_append(w, coords + from * dims,
+						  labels + from, weights + from,
+						  count) == 0);
+		from += count;
+	}
+}
+
+void test_file_roundtrip()
+{
+	printf("Test: Dataset File Round Trip\n");
+	printf("=============================\n");
+
+	srand(59);
+	int num_points = 12000, dims = 3, first = 7000;
+	double *coords = make_blobs(num_points, dims, 4, 3.0, 1.0, 0.0);
+	int32_t *labels = (int32_t *)malloc(num_points * sizeof(int32_t));
+	double *weights = (double *)malloc(num_points * sizeof(double));
+	assert(labels && weights);
+	for (int i = 0; i < num_points; i++) {
+		labels[i] = i % 7 - 1;
+		weights[i] = i * 0.25;
+	}
+
+	/* Written in two sessions, the second appending */
+	int flags = CDBSCAN_FILE_LABELS | CDBSCAN_FILE_WEIGHTS;
+	cdbscan_file_writer_t *w = cdbscan_file_writer_create(
+		path, dims, CDBSCAN_FILE_DOUBLE, flags);
+	assert(w);
+	write_points(w, coords, labels, weights, dims, 0, first);
+	assert(cdbscan_file_open(path) == NULL);
+	assert(cdbscan_file_writer_close(w) == 0);
+	assert(!cdbscan_file_writer_create(path, dims + 1, CDBSCAN_FILE_DOUBLE,
+					   flags | CDBSCAN_FILE_APPEND));
+	assert(!cdbscan_file_writer_create(path, dims, CDBSCAN_FILE_DOUBLE,
+					   CDBSCAN_FILE_APPEND));
+	w = cdbscan_file_writer_create(path, dims, CDBSCAN_FILE_DOUBLE,
+				       flags | CDBSCAN_FILE_APPEND);
+	assert(w);
+	assert(cdbscan_file_writer_append(w, coords, NULL, weights, 1) == -1);
+	write_points(w, coords, labels, weights, dims, first, num_points);
+
+	/* The old file is untouched until the writer is closed */
+	cdbscan_file_t *old = cdbscan_file_open(path);
+	assert(old);
+	cdbscan_dataset_t old_data;
+	assert(cdbscan_file_dataset(old, &old_data) == 0);
+	assert(old_data.num_points == first);
+	assert(memcmp(cdbscan_file_labels(old), labels,
+		      first * sizeof(int32_t)) == 0);
+	cdbscan_file_close(old);
+	assert(cdbscan_file_writer_close(w) == 0);
+	char tmp_path[256];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	assert(access(tmp_path, F_OK) != 0);
+
+	cdbscan_file_t *file = cdbscan_file_open(path);
+	assert(file);
+	cdbscan_dataset_t data;
+	cdbscan_int_dataset_t int_data;
+	assert(cdbscan_file_int_dataset(file, &int_data) == -1);
+	assert(cdbscan_file_dataset(file, &data) == 0);
+	assert(data.num_points == num_points && data.dimensions == dims);
+	assert((uintptr_t)data.coords % 64 == 0);
+	assert(memcmp(data.coords, coords,
+		      num_points * dims * sizeof(double)) == 0);
+	assert(memcmp(cdbscan_file_labels(file), labels,
+		      num_points * sizeof(int32_t)) == 0);
+	assert(memcmp(cdbscan_file_weights(file), weights,
+		      num_points * sizeof(double)) == 0);
+
+	/* Clustered straight from the mapping */
+	cdbscan_params_t params = { .eps = 0.1,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *found = (int *)malloc(num_points * sizeof(int));
+	assert(expected && found);
+	cdbscan_dataset_t source = { coords, num_points, dims };
+	int n = cdbscan_cluster_dataset(NULL, &source, params, expected);
+	assert(n > 0);
+	assert(cdbscan_cluster_dataset(NULL, &data, params, found) == n);
+	assert(memcmp(found, expected, num_points * sizeof(int)) == 0);
+	cdbscan_file_close(file);
+	printf("%d points, %d clusters\n", num_points, n);
+
+	free(coords);
+	free(labels);
+	free(weights);
+	free(expected);
+	free(found);
+	printf("[PASS] Files give back what was written\n\n");
+}
+
+void test_file_int()
+{
+	printf("Test: Integer Dataset File\n");
+	printf("==========================\n");
+
+	/* Two squares of lattice points, no labels or weights */
+	int32_t coords[2 * 50];
+	for (int i = 0; i < 50; i++) {
+		int square = i / 25;
+		coords[2 * i] = square * 100 + i % 5;
+		coords[2 * i + 1] = (i % 25) / 5;
+	}
+	cdbscan_file_writer_t *w = cdbscan_file_writer_create(
+		path, 2, CDBSCAN_FILE_INT32, 0);
+	assert(w);
+	assert(cdbscan_file_writer_append(w, coords, NULL, NULL, 50) == 0);
+	assert(cdbscan_file_writer_close(w) == 0);
+
+	cdbscan_file_t *file = cdbscan_file_open(path);
+	assert(file);
+	cdbscan_dataset_t data;
+	cdbscan_int_dataset_t int_data;
+	assert(cdbscan_file_dataset(file, &data) == -1);
+	assert(cdbscan_file_int_dataset(file, &int_data) == 0);
+	assert(int_data.num_points == 50 && int_data.dimensions == 2);
+	assert(!cdbscan_file_labels(file) && !cdbscan_file_weights(file));
+	int labels[50];
+	cdbscan_params_t params = { .eps = 1.0,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	assert(cdbscan_cluster_int_dataset(NULL, &int_data, params, labels) ==
+	       2);
+	cdbscan_file_close(file);
+
+	printf("[PASS] Integer points cluster from the file\n\n");
+}
+
+void test_file_invalid()
+{
+	printf("Test: Invalid Dataset Files\n");
+	printf("===========================\n");
+
+	double coords[4 * 2] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+	cdbscan_file_writer_t *w = cdbscan_file_writer_create(
+		path, 2, CDBSCAN_FILE_DOUBLE, 0);
+	assert(w);
+	assert(cdbscan_file_writer_append(w, coords, NULL, NULL, 4) == 0);
+	assert(cdbscan_file_writer_close(w) == 0);
+
+	FILE *f = fopen(path, "rb");
+	assert(f);
+	unsigned char bytes[128];
+	size_t len = fread(bytes, 1, sizeof(bytes), f);
+	fclose(f);
+	assert(len == 64 + sizeof(coords));
+
+	/* Cut short, a newer version, a bad magic */
+	int offsets[3] = { -1, 12, 0 };
+	for (int t = 0; t < 3; t++) {
+		unsigned char copy[128];
+		memcpy(copy, bytes, len);
+		if (offsets[t] >= 0)
+			copy[offsets[t]] ^= 0x40;
+		f = fopen(path, "wb");
+		assert(f);
+		fwrite(copy, 1, offsets[t] < 0 ? len - 1 : len, f);
+		fclose(f);
+		assert(cdbscan_file_open(path) == NULL);
+
+		/* Not appended to, and left as it was */
+		assert(!cdbscan_file_writer_create(path, 2, CDBSCAN_FILE_DOUBLE,
+						   CDBSCAN_FILE_APPEND));
+		f = fopen(path, "rb");
+		assert(f);
+		unsigned char kept[128];
+		assert(fread(kept, 1, sizeof(kept), f) ==
+		       (offsets[t] < 0 ? len - 1 : len));
+		assert(memcmp(kept, copy, offsets[t] < 0 ? len - 1 : len) == 0);
+		fclose(f);
+	}
+
+	/* Arguments */
+	assert(!cdbscan_file_writer_create(path, 0, CDBSCAN_FILE_DOUBLE, 0));
+	assert(!cdbscan_file_writer_create(path, 2, (cdbscan_file_dtype_t)7,
+					   0));
+	assert(!cdbscan_file_writer_create(NULL, 2, CDBSCAN_FILE_DOUBLE, 0));
+	assert(cdbscan_file_writer_close(NULL) == -1);
+	assert(cdbscan_file_writer_append(NULL, coords, NULL, NULL, 1) == -1);
+	unlink(path);
+	assert(cdbscan_file_open(path) == NULL);
+	assert(cdbscan_file_open(NULL) == NULL);
+	cdbscan_file_close(NULL);
+
+	printf("[PASS] Broken files are rejected\n\n");
+}
+
+int main()
+{
+	printf("Testing Dataset Files\n");
+	printf("=====================\n\n");
+
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	close(fd);
+
+	test_file_roundtrip();
+	test_file_int();
+	test_file_invalid();
+
+	printf("[SUCCESS] All dataset file tests passed!\n");
+	return 0;
+}
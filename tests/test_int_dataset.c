@@ -0,0 +1,146 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: integer datasets cluster like their double copies away from the
+ * eps boundary, and exactly at it */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+/* Fixed-point blobs in centimeters, far from the origin */
+static int32_t *make_coords(int num_points, int dims)
+{
+	int32_t *coords =
+		(int32_t *)malloc(num_points * dims * sizeof(int32_t));
+	assert(coords);
+	for (int i = 0; i < num_points; i++) {
+		int blob = rand() % 4;
+		for (int d = 0; d < dims; d++) {
+			coords[i * dims + d] = -2000000000 + blob * 100000 +
+					       rand() % (3000 + blob * 500);
+		}
+	}
+	return coords;
+}
+
+void test_int_labels()
+{
+	printf("Test: Integer Labels\n");
+	printf("====================\n");
+
+	int num_points = 2000, dims = 2;
+	srand(5);
+	int32_t *coords = make_coords(num_points, dims);
+	double *real = (double *)malloc(num_points * dims * sizeof(double));
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(real && expected && labels);
+	for (int i = 0; i < num_points * dims; i++) {
+		real[i] = coords[i];
+	}
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	cdbscan_dataset_t data = { real, num_points, dims };
+	cdbscan_int_dataset_t idata = { coords, num_points, dims };
+	cdbscan_dist_type_t types[3] = { CDBSCAN_DIST_EUCLIDEAN,
+					 CDBSCAN_DIST_MANHATTAN,
+					 CDBSCAN_DIST_MINKOWSKI };
+
+	/* Integer eps: both paths are exact */
+	for (int t = 0; t < 3; t++) {
+		for (int tree = 0; tree < 2; tree++) {
+			cdbscan_params_t params = { .eps = 300.0,
+						    .min_pts = 5,
+						    .dist_type = types[t],
+						    .minkowski_p = 3.0,
+						    .use_kdtree = tree };
+			cdbscan_params_t ref = params;
+			ref.use_kdtree = 1;
+			int n_ref = cdbscan_cluster_dataset(NULL, &data, ref,
+							    expected);
+			int n = cdbscan_cluster_int_dataset(
+				tree ? ctx : NULL, &idata, params, labels);
+			printf("Metric %d, tree %d: %d clusters\n", t, tree, n);
+			assert(n == n_ref && n > 0);
+			for (int i = 0; i < num_points; i++) {
+				assert(labels[i] == expected[i]);
+			}
+		}
+	}
+
+	cdbscan_params_t params = { .eps = 3e9,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	assert(cdbscan_cluster_int_dataset(ctx, &idata, params, labels) == -1);
+	assert(cdbscan_cluster_int_dataset(ctx, NULL, params, labels) == -1);
+
+	printf("[PASS] Labels match double coordinates\n\n");
+	cdbscan_context_destroy(ctx);
+	free(coords);
+	free(real);
+	free(expected);
+	free(labels);
+}
+
+void test_int_boundary()
+{
+	printf("Test: Exact eps Boundary\n");
+	printf("========================\n");
+
+	/* Opposite corners of a unit cube are sqrt(3) apart, and the double
+	 * nearest sqrt(3) is slightly below it */
+	int32_t coords[6] = { 0, 0, 0, 1, 1, 1 };
+	int labels[2];
+	cdbscan_int_dataset_t data = { coords, 2, 3 };
+	cdbscan_params_t params = { .eps = sqrt(3.0),
+				    .min_pts = 2,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	assert(cdbscan_cluster_int_dataset(NULL, &data, params, labels) == 0);
+	assert(labels[0] == CDBSCAN_NOISE && labels[1] == CDBSCAN_NOISE);
+
+	/* Just above, they are neighbors */
+	params.eps = nextafter(sqrt(3.0), 2.0);
+	assert(cdbscan_cluster_int_dataset(NULL, &data, params, labels) == 1);
+	assert(labels[0] == 0 && labels[1] == 0);
+
+	/* Exactly on the boundary counts as a neighbor */
+	params.eps = 1.0;
+	coords[3] = 1;
+	coords[4] = 0;
+	coords[5] = 0;
+	assert(cdbscan_cluster_int_dataset(NULL, &data, params, labels) == 1);
+
+	printf("[PASS] Boundary pairs are decided exactly\n\n");
+}
+
+int main()
+{
+	printf("Testing Integer Datasets\n");
+	printf("========================\n\n");
+
+	test_int_labels();
+	test_int_boundary();
+
+	printf("[SUCCESS] All integer dataset tests passed!\n");
+	return 0;
+}
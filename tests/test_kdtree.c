@@ -222,6 +222,54 @@ void test_kdtree_region_query()
 	free(neighbors_kdtree);
 }
 
+void test_kdtree_dense_clusters()
+{
+	printf("\nTest: KD-tree Dense Clusters\n");
+	printf("============================\n");
+
+	/* Dense blobs touching at their edges, so expansion passes through
+	 * long stretches of claimed points and borders are contested */
+	int num_points = 4000;
+	double *coords = (double *)malloc(num_points * 2 * sizeof(double));
+	int *brute = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(coords && brute && labels);
+	srand(3);
+	for (int i = 0; i < num_points; i++) {
+		int blob = i % 4;
+		double r = sqrt(rand() / (double)RAND_MAX);
+		double a = rand() / (double)RAND_MAX * 6.283185307179586;
+		coords[i * 2] = blob * 1.9 + r * cos(a);
+		coords[i * 2 + 1] = (blob % 2) * 0.5 + r * sin(a);
+	}
+
+	cdbscan_params_t params = { .eps = 0.12,
+				    .min_pts = 25,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	cdbscan_dataset_t data = { coords, num_points, 2 };
+	int n_brute = cdbscan_cluster_dataset(NULL, &data, params, brute);
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	params.use_kdtree = 1;
+	for (int run = 0; run < 2; run++) {
+		int n = cdbscan_cluster_dataset(run ? ctx : NULL, &data, params,
+						labels);
+		printf("Run %d: %d clusters (brute force %d)\n", run, n,
+		       n_brute);
+		assert(n == n_brute && n > 1);
+		for (int i = 0; i < num_points; i++) {
+			assert(labels[i] == brute[i]);
+		}
+	}
+
+	printf("[PASS] Dense clusters match brute force\n");
+	cdbscan_context_destroy(ctx);
+	free(coords);
+	free(brute);
+	free(labels);
+}
+
 int main()
 {
 	printf("Testing KD-tree Implementation\n");
@@ -229,6 +277,7 @@ int main()
 
 	test_kdtree_correctness();
 	test_kdtree_region_query();
+	test_kdtree_dense_clusters();
 
 	printf("\n[SUCCESS] All KD-tree tests passed!\n");
 	return 0;
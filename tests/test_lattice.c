@@ -0,0 +1,196 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: lattice and raster clustering give the same labels as clustering
+ * the same integer coordinates as doubles */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+/* Blobs of lattice points, some cells holding several points */
+static int32_t *make_points(int num_points, int dims, int spread,
+			    int offset)
+{
+	int32_t *coords =
+		(int32_t *)malloc(num_points * dims * sizeof(int32_t));
+	assert(coords);
+	for (int i = 0; i < num_points; i++) {
+		int blob = rand() % 3;
+		for (int d = 0; d < dims; d++) {
+			coords[i * dims + d] = offset + blob * spread +
+					       rand() % (spread / 2);
+		}
+	}
+	return coords;
+}
+
+/* Lattice labels must equal the labels of the double coordinates */
+static void check_lattice(cdbscan_context_t *ctx, const int32_t *coords,
+			  int num_points, int dims, cdbscan_params_t params)
+{
+	double *real = (double *)malloc(num_points * dims * sizeof(double));
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(real && expected && labels);
+	for (int i = 0; i < num_points * dims; i++) {
+		real[i] = coords[i];
+	}
+
+	cdbscan_dataset_t data = { real, num_points, dims };
+	cdbscan_int_dataset_t lattice = { coords, num_points, dims };
+	int n_ref = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	int n = cdbscan_cluster_lattice(ctx, &lattice, params, labels);
+	assert(n == n_ref && n > 0);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+	printf("%dD, eps %.2f, metric %d: %d clusters\n", dims, params.eps,
+	       params.dist_type, n);
+
+	free(real);
+	free(expected);
+	free(labels);
+}
+
+void test_lattice_labels()
+{
+	printf("Test: Lattice Labels\n");
+	printf("====================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	srand(11);
+
+	/* Dense 2D image-like points, every metric */
+	int32_t *coords = make_points(4000, 2, 30, -100);
+	cdbscan_params_t params = { .eps = 1.5,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	check_lattice(NULL, coords, 4000, 2, params);
+	check_lattice(ctx, coords, 4000, 2, params);
+	params.eps = 2.0;
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	check_lattice(ctx, coords, 4000, 2, params);
+	params.eps = 2.5;
+	params.dist_type = CDBSCAN_DIST_MINKOWSKI;
+	params.minkowski_p = 3.0;
+	check_lattice(ctx, coords, 4000, 2, params);
+	free(coords);
+
+	/* 3D voxels */
+	coords = make_points(6000, 3, 30, 0);
+	params.eps = 1.8;
+	params.min_pts = 6;
+	params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+	check_lattice(ctx, coords, 6000, 3, params);
+	free(coords);
+
+	/* Sparse points far from the origin use hashed lookup */
+	coords = make_points(3000, 2, 400, 1000000);
+	params.eps = 6.0;
+	params.min_pts = 3;
+	check_lattice(ctx, coords, 3000, 2, params);
+
+	/* Unsupported metric and oversized stencil */
+	cdbscan_int_dataset_t data = { coords, 3000, 2 };
+	int labels[3000];
+	params.dist_type = CDBSCAN_DIST_COSINE;
+	assert(cdbscan_cluster_lattice(ctx, &data, params, labels) == -1);
+	params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+	params.eps = 5000.0;
+	assert(cdbscan_cluster_lattice(ctx, &data, params, labels) == -1);
+	assert(cdbscan_cluster_lattice(ctx, NULL, params, labels) == -1);
+	free(coords);
+
+	cdbscan_context_destroy(ctx);
+	printf("[PASS] Lattice labels match double coordinates\n\n");
+}
+
+void test_raster()
+{
+	printf("Test: Raster\n");
+	printf("============\n");
+
+	/* Two filled discs and scattered specks in a 64 x 96 image */
+	int shape[2] = { 64, 96 };
+	int num_cells = shape[0] * shape[1];
+	unsigned char *image = (unsigned char *)calloc(num_cells, 1);
+	int *labels = (int *)malloc(num_cells * sizeof(int));
+	assert(image && labels);
+	for (int y = 0; y < shape[0]; y++) {
+		for (int x = 0; x < shape[1]; x++) {
+			int a = (y - 20) * (y - 20) + (x - 20) * (x - 20);
+			int b = (y - 40) * (y - 40) + (x - 70) * (x - 70);
+			image[y * shape[1] + x] = a < 100 || b < 150 ||
+						  (x * 7 + y * 13) % 53 == 0;
+		}
+	}
+
+	cdbscan_params_t params = { .eps = 1.0,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	int n = cdbscan_cluster_raster(NULL, image, shape, 2, params, labels);
+	printf("Clusters: %d\n", n);
+	assert(n == 2);
+	assert(labels[20 * shape[1] + 20] != labels[40 * shape[1] + 70]);
+
+	/* Same as the occupied cells as lattice points */
+	int num_points = 0;
+	int32_t *coords = (int32_t *)malloc(num_cells * 2 * sizeof(int32_t));
+	int *expected = (int *)malloc(num_cells * sizeof(int));
+	assert(coords && expected);
+	for (int i = 0; i < num_cells; i++) {
+		if (!image[i]) {
+			assert(labels[i] == CDBSCAN_UNCLASSIFIED);
+			continue;
+		}
+		coords[num_points * 2] = i / shape[1];
+		coords[num_points * 2 + 1] = i % shape[1];
+		num_points++;
+	}
+	cdbscan_int_dataset_t data = { coords, num_points, 2 };
+	assert(cdbscan_cluster_lattice(NULL, &data, params, expected) == n);
+	for (int i = 0, p = 0; i < num_cells; i++) {
+		if (image[i])
+			assert(labels[i] == expected[p++]);
+	}
+
+	shape[1] = 0;
+	assert(cdbscan_cluster_raster(NULL, image, shape, 2, params,
+				      labels) == -1);
+
+	printf("[PASS] Raster labels match lattice points\n\n");
+	free(image);
+	free(labels);
+	free(coords);
+	free(expected);
+}
+
+int main()
+{
+	printf("Testing Lattice Clustering\n");
+	printf("==========================\n\n");
+
+	test_lattice_labels();
+	test_raster();
+
+	printf("[SUCCESS] All lattice tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: the memory estimate bounds what a call takes, and under a limit
+ * calls stay within it with unchanged labels or fail without allocating */
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+/* Cluster on ctx and compare with a call without a limit; returns the
+ * peak bytes the call took from the allocator */
+static size_t check_labels(cdbscan_context_t *ctx, alloc_stats_t *stats,
+			   const double *coords, int num_points, int dims,
+			   cdbscan_params_t params)
+{
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(expected && labels);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	int n = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	assert(n > 0);
+	stats->peak = stats->live;
+	assert(cdbscan_cluster_dataset(ctx, &data, params, labels) == n);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+	free(expected);
+	free(labels);
+	return stats->peak;
+}
+
+void test_memory_estimate()
+{
+	printf("Test: Memory Estimate\n");
+	printf("=====================\n");
+
+	srand(41);
+	alloc_stats_t stats = { 0 };
+	cdbscan_allocator_t allocator = { counting_alloc, NULL, counting_free,
+					  &stats };
+	cdbscan_context_t *ctx = cdbscan_context_create(2);
+	assert(ctx);
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == 0);
+
+	/* The bit matrix, then the KD-tree with curve order and sketch */
+	int sizes[2] = { 3000, 20000 };
+	int dims[2] = { 4, 3 };
+	cdbscan_params_t params[2] = {
+		{ .eps = 0.6, .min_pts = 5,
+		  .dist_type = CDBSCAN_DIST_MANHATTAN },
+		{ .eps = 0.1, .min_pts = 5,
+		  .dist_type = CDBSCAN_DIST_EUCLIDEAN, .use_kdtree = 1 }
+	};
+	for (int t = 0; t < 2; t++) {
+		double *coords =
+			make_blobs(sizes[t], dims[t], 4, 2.0, 0.5, 1.0);
+		size_t estimate = cdbscan_memory_estimate(ctx, sizes[t],
+							  dims[t], params[t]);
+		size_t peak = check_labels(ctx, &stats, coords, sizes[t],
+					   dims[t], params[t]);
+		printf("%d points, %dD: estimate %zu, peak %zu\n", sizes[t],
+		       dims[t], estimate, peak);
+		assert(peak <= estimate && peak > estimate / 2);
+		assert(cdbscan_memory_estimate(NULL, sizes[t], dims[t],
+					       params[t]) <= estimate);
+		free(coords);
+	}
+
+	/* Invalid input */
+	params[0].eps = -1.0;
+	assert(cdbscan_memory_estimate(ctx, 100, 2, params[0]) == 0);
+	assert(cdbscan_memory_estimate(ctx, 0, 2, params[1]) == 0);
+
+	cdbscan_context_destroy(ctx);
+	assert(stats.live == 0);
+	printf("[PASS] Estimate bounds the peak\n\n");
+}
+
+void test_memory_limit()
+{
+	printf("Test: Memory Limit\n");
+	printf("==================\n");
+
+	srand(43);
+	alloc_stats_t stats = { 0 };
+	cdbscan_allocator_t allocator = { counting_alloc, NULL, counting_free,
+					  &stats };
+	cdbscan_context_t *ctx = cdbscan_context_create(2);
+	assert(ctx);
+	assert(cdbscan_context_set_allocator(ctx, &allocator) == 0);
+
+	int num_points = 20000, dims = 3;
+	double *coords = make_blobs(num_points, dims, 4, 2.0, 0.5, 1.0);
+	cdbscan_params_t params = { .eps = 0.1,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	size_t full = cdbscan_memory_estimate(ctx, num_points, dims, params);
+
+	/* Each limit gives up more, down to brute force in 5 bytes per
+	 * point besides the labels */
+	size_t limits[4] = { full - 1, full / 2, full / 4, 6 * num_points };
+	for (int t = 0; t < 4; t++) {
+		assert(cdbscan_context_set_memory_limit(ctx, limits[t]) == 0);
+		size_t estimate = cdbscan_memory_estimate(ctx, num_points, dims,
+							  params);
+		assert(estimate <= limits[t]);
+		size_t peak = check_labels(ctx, &stats, coords, num_points,
+					   dims, params);
+		printf("Limit %zu: estimate %zu, peak %zu\n", limits[t],
+		       estimate, peak);
+		assert(peak <= estimate);
+	}
+
+	/* Memory kept from a larger call makes room for the next one */
+	assert(cdbscan_context_set_memory_limit(ctx, full) == 0);
+	check_labels(ctx, &stats, coords, num_points, dims, params);
+	cdbscan_params_t brute = { .eps = 0.3,
+				   .min_pts = 5,
+				   .dist_type = CDBSCAN_DIST_MANHATTAN };
+	size_t peak = check_labels(ctx, &stats, coords, 5000, dims, brute);
+	assert(peak <= full);
+
+	/* Too small for anything: fails before allocating */
+	assert(cdbscan_context_set_memory_limit(ctx, 4 * num_points) == 0);
+	assert(cdbscan_memory_estimate(ctx, num_points, dims, params) >
+	       4 * (size_t)num_points);
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(labels);
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	int allocs = stats.allocs;
+	assert(cdbscan_cluster_dataset(ctx, &data, params, labels) == -1);
+	assert(stats.allocs == allocs);
+
+	/* Packing the points counts as well */
+	cdbscan_point_t points[64];
+	for (int i = 0; i < 64; i++) {
+		points[i].coords = coords + i * dims;
+		points[i].dimensions = dims;
+	}
+	assert(cdbscan_context_set_memory_limit(ctx, 1024) == 0);
+	assert(cdbscan_cluster_ctx(ctx, points, 64, params) == -1);
+	assert(cdbscan_context_set_memory_limit(ctx, 0) == 0);
+	assert(cdbscan_cluster_ctx(ctx, points, 64, params) >= 0);
+	assert(cdbscan_context_set_memory_limit(NULL, 0) == -1);
+
+	cdbscan_context_destroy(ctx);
+	assert(stats.live == 0);
+	free(labels);
+	free(coords);
+	printf("[PASS] Calls stay within the limit\n\n");
+}
+
+int main()
+{
+	printf("Testing Memory Limits\n");
+	printf("=====================\n\n");
+
+	test_memory_estimate();
+	test_memory_limit();
+
+	printf("[SUCCESS] All memory limit tests passed!\n");
+	return 0;
+}
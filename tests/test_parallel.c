@@ -0,0 +1,365 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: multi-threaded runs produce the same results as serial runs */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+/* Several blobs of different density plus background noise */
+static cdbscan_point_t *make_dataset(int num_points, int dims,
+				     unsigned int seed)
+{
+	cdbscan_point_t *points = cdbscan_create_points(num_points, dims);
+	assert(points);
+
+	srand(seed);
+	for (int i = 0; i < num_points; i++) {
+		int blob = rand() % 5;
+		for (int d = 0; d < dims; d++) {
+			double u = rand() / (double)RAND_MAX;
+			if (blob == 4) {
+				points[i].coords[d] = u * 10.0;
+			} else {
+				points[i].coords[d] =
+					blob * 2.5 +
+					(u - 0.5) * (0.4 + blob * 0.3);
+			}
+		}
+	}
+	return points;
+}
+
+static cdbscan_point_t *copy_dataset(const cdbscan_point_t *src,
+				     int num_points, int dims)
+{
+	cdbscan_point_t *points = cdbscan_create_points(num_points, dims);
+	assert(points);
+	for (int i = 0; i < num_points; i++) {
+		memcpy(points[i].coords, src[i].coords, dims * sizeof(double));
+	}
+	return points;
+}
+
+static void free_dataset(cdbscan_point_t *points, int num_points)
+{
+	for (int i = 0; i < num_points; i++) {
+		free(points[i].coords);
+	}
+	free(points);
+}
+
+void test_parallel_clustering()
+{
+	printf("Test: Threaded Clustering Matches Serial\n");
+	printf("========================================\n");
+
+	int num_points = 5000;
+	int dims = 2;
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	printf("Context threads: %d\n", cdbscan_context_num_threads(ctx));
+
+	for (int use_kdtree = 0; use_kdtree <= 1; use_kdtree++) {
+		cdbscan_point_t *serial = make_dataset(num_points, dims, 11);
+		cdbscan_point_t *threaded = copy_dataset(serial, num_points,
+							 dims);
+		cdbscan_point_t *transient =
+			copy_dataset(serial, num_points, dims);
+
+		cdbscan_params_t params = { .eps = 0.15,
+					    .min_pts = 5,
+					    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+					    .use_kdtree = use_kdtree };
+
+		int n_serial = cdbscan_cluster(serial, num_points, params);
+		int n_threaded =
+			cdbscan_cluster_ctx(ctx, threaded, num_points, params);
+
+		/* Without a context, num_threads starts workers per call */
+		params.num_threads = 3;
+		int n_transient =
+			cdbscan_cluster(transient, num_points, params);
+
+		printf("%s: serial=%d, context=%d, num_threads=%d clusters\n",
+		       use_kdtree ? "KD-tree" : "Brute force", n_serial,
+		       n_threaded, n_transient);
+		assert(n_serial > 0);
+		assert(n_serial == n_threaded && n_serial == n_transient);
+
+		for (int i = 0; i < num_points; i++) {
+			assert(serial[i].cluster_id == threaded[i].cluster_id);
+			assert(serial[i].cluster_id ==
+			       transient[i].cluster_id);
+		}
+
+		free_dataset(serial, num_points);
+		free_dataset(threaded, num_points);
+		free_dataset(transient, num_points);
+	}
+
+	/* The same context is reused across calls */
+	for (int round = 0; round < 3; round++) {
+		cdbscan_point_t *points =
+			make_dataset(num_points, 3, 100 + round);
+		cdbscan_params_t params = { .eps = 0.3,
+					    .min_pts = 4,
+					    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+					    .use_kdtree = 1 };
+		assert(cdbscan_cluster_ctx(ctx, points, num_points, params) >=
+		       0);
+		free_dataset(points, num_points);
+	}
+
+	printf("[PASS] Labels are identical for every point\n\n");
+	cdbscan_context_destroy(ctx);
+}
+
+void test_parallel_utilities()
+{
+	printf("Test: Threaded Normalization and Eps Estimation\n");
+	printf("===============================================\n");
+
+	int num_points = 10000;
+	int dims = 3;
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	cdbscan_point_t *serial = make_dataset(num_points, dims, 5);
+	cdbscan_point_t *threaded = copy_dataset(serial, num_points, dims);
+
+	/* Results must not depend on the number of threads */
+	cdbscan_normalize_zscore(serial, num_points);
+	cdbscan_normalize_zscore_ctx(ctx, threaded, num_points);
+	cdbscan_normalize_minmax(serial, num_points);
+	cdbscan_normalize_minmax_ctx(ctx, threaded, num_points);
+	for (int i = 0; i < num_points; i++) {
+		for (int d = 0; d < dims; d++) {
+			assert(serial[i].coords[d] == threaded[i].coords[d]);
+			assert(serial[i].coords[d] >= 0.0 &&
+			       serial[i].coords[d] <= 1.0);
+		}
+	}
+	printf("[OK] Normalization is identical\n");
+
+	cdbscan_kdist_result_t *a = cdbscan_estimate_eps(serial, num_points, 4);
+	cdbscan_kdist_result_t *b =
+		cdbscan_estimate_eps_ctx(ctx, threaded, num_points, 4);
+	assert(a && b);
+	assert(a->suggested_eps == b->suggested_eps);
+	for (int i = 0; i < num_points; i++) {
+		assert(a->distances[i] == b->distances[i]);
+	}
+	printf("[OK] Eps estimation is identical (eps=%.4f)\n",
+	       a->suggested_eps);
+
+	printf("[PASS] Threaded utilities match serial results\n\n");
+
+	cdbscan_free_kdist_result(a);
+	cdbscan_free_kdist_result(b);
+	free_dataset(serial, num_points);
+	free_dataset(threaded, num_points);
+	cdbscan_context_destroy(ctx);
+}
+
+void test_single_large_cluster()
+{
+	printf("Test: One Dominant Cluster Expanded in Parallel\n");
+	printf("===============================================\n");
+
+	int num_points = 20000;
+	int dims = 2;
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	/* A filled square with a few stragglers around it */
+	cdbscan_point_t *serial = cdbscan_create_points(num_points, dims);
+	assert(serial);
+	srand(21);
+	for (int i = 0; i < num_points; i++) {
+		double spread = i % 50 == 0 ? 3.0 : 1.0;
+		for (int d = 0; d < dims; d++) {
+			double u = rand() / (double)RAND_MAX;
+			serial[i].coords[d] = spread * u;
+		}
+	}
+	cdbscan_point_t *threaded = copy_dataset(serial, num_points, dims);
+
+	cdbscan_params_t params = { .eps = 0.02,
+				    .min_pts = 6,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	int n_serial = cdbscan_cluster(serial, num_points, params);
+	int n_threaded = cdbscan_cluster_ctx(ctx, threaded, num_points, params);
+
+	int largest = 0;
+	for (int i = 0; i < num_points; i++) {
+		assert(serial[i].cluster_id == threaded[i].cluster_id);
+		largest += serial[i].cluster_id == 0;
+	}
+	printf("%d clusters, first has %d points\n", n_serial, largest);
+	assert(n_serial == n_threaded);
+	assert(largest > num_points / 2);
+
+	printf("[PASS] Labels are identical for every point\n\n");
+
+	free_dataset(serial, num_points);
+	free_dataset(threaded, num_points);
+	cdbscan_context_destroy(ctx);
+}
+
+void test_thread_stats()
+{
+	printf("Test: Scheduler Statistics\n");
+	printf("==========================\n");
+
+	int num_points = 20000;
+	int dims = 2;
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	int num_threads = cdbscan_context_num_threads(ctx);
+	cdbscan_thread_stats_t stats[8];
+
+	/* Nothing has run yet */
+	assert(cdbscan_context_thread_stats(ctx, stats, 8) == num_threads);
+	for (int t = 0; t < num_threads; t++) {
+		assert(stats[t].tasks == 0 && stats[t].items == 0);
+	}
+
+	cdbscan_point_t *points = make_dataset(num_points, dims, 3);
+	cdbscan_params_t params = { .eps = 0.1,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+	assert(cdbscan_cluster_ctx(ctx, points, num_points, params) > 0);
+
+	int n = cdbscan_context_thread_stats(ctx, stats, 8);
+	unsigned long long tasks = 0, items = 0;
+	for (int t = 0; t < n; t++) {
+		printf("Thread %d: %llu tasks, %llu steals, %.1f%% busy\n", t,
+		       stats[t].tasks, stats[t].steals,
+		       stats[t].wall_seconds > 0 ?
+			       100.0 * stats[t].busy_seconds /
+				       stats[t].wall_seconds :
+			       0.0);
+		assert(stats[t].busy_seconds >= 0.0);
+		assert(stats[t].wall_seconds == stats[0].wall_seconds);
+		tasks += stats[t].tasks;
+		items += stats[t].items;
+	}
+	assert(tasks > 0);
+	/* The core-point pass alone covers every point once */
+	assert(items >= (unsigned long long)num_points);
+
+	/* A short buffer only gets the first threads */
+	assert(cdbscan_context_thread_stats(ctx, stats, 1) == 1);
+
+	cdbscan_context_reset_stats(ctx);
+	cdbscan_context_thread_stats(ctx, stats, 8);
+	for (int t = 0; t < n; t++) {
+		assert(stats[t].tasks == 0 && stats[t].steals == 0);
+		assert(stats[t].busy_seconds == 0.0);
+	}
+
+	printf("[PASS] Statistics are collected and reset\n\n");
+
+	free_dataset(points, num_points);
+	cdbscan_context_destroy(ctx);
+}
+
+void test_numa_placement()
+{
+	printf("Test: NUMA Placement\n");
+	printf("====================\n");
+
+	int num_points = 8000;
+	int dims = 3;
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	assert(cdbscan_context_set_numa(ctx, 64) == -1);
+	assert(cdbscan_context_set_numa(ctx, CDBSCAN_NUMA_FIRST_TOUCH |
+						     CDBSCAN_NUMA_REPLICATE) ==
+	       0);
+	int num_nodes = cdbscan_context_num_nodes(ctx);
+	printf("Nodes: %d\n", num_nodes);
+	assert(num_nodes >= 1);
+
+	cdbscan_point_t *serial = make_dataset(num_points, dims, 8);
+	cdbscan_point_t *placed = copy_dataset(serial, num_points, dims);
+
+	for (int use_kdtree = 0; use_kdtree <= 1; use_kdtree++) {
+		cdbscan_params_t params = { .eps = 0.25,
+					    .min_pts = 5,
+					    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+					    .use_kdtree = use_kdtree };
+		int n_serial = cdbscan_cluster(serial, num_points, params);
+		int n_placed =
+			cdbscan_cluster_ctx(ctx, placed, num_points, params);
+		assert(n_serial == n_placed);
+		for (int i = 0; i < num_points; i++) {
+			assert(serial[i].cluster_id == placed[i].cluster_id);
+		}
+	}
+	printf("[OK] Labels match a serial run\n");
+
+	/* Per-node totals from the per-thread counters */
+	cdbscan_thread_stats_t stats[8];
+	int n = cdbscan_context_thread_stats(ctx, stats, 8);
+	for (int node = 0; node < num_nodes; node++) {
+		unsigned long long items = 0;
+		int threads = 0;
+		for (int t = 0; t < n; t++) {
+			assert(stats[t].node >= 0 && stats[t].node < num_nodes);
+			if (stats[t].node == node) {
+				items += stats[t].items;
+				threads++;
+			}
+		}
+		printf("Node %d: %d threads, %llu items\n", node, threads,
+		       items);
+	}
+
+	assert(cdbscan_context_set_numa(ctx, 0) == 0);
+	assert(cdbscan_context_num_nodes(ctx) == 1);
+
+	printf("[PASS] NUMA placement keeps results unchanged\n\n");
+
+	free_dataset(serial, num_points);
+	free_dataset(placed, num_points);
+	cdbscan_context_destroy(ctx);
+}
+
+int main()
+{
+	printf("Testing Parallel Execution\n");
+	printf("==========================\n\n");
+
+	test_parallel_clustering();
+	test_parallel_utilities();
+	test_single_large_cluster();
+	test_thread_stats();
+	test_numa_placement();
+
+	printf("[SUCCESS] All parallel tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: product-quantized clustering of embeddings finds most exact
+ * neighbors, and re-ranking everything gives the exact labels */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+#define DIMS 32
+
+static double gauss(void)
+{
+	double u = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double v = rand() / (double)RAND_MAX;
+	return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/* Embeddings around a few topic vectors, plus uniform noise */
+static double *make_embeddings(int num_points)
+{
+	double topics[5][DIMS];
+	for (int t = 0; t < 5; t++) {
+		for (int d = 0; d < DIMS; d++) {
+			topics[t][d] = 2.0 * rand() / RAND_MAX;
+		}
+	}
+
+	double *coords = (double *)malloc(num_points * DIMS * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points; i++) {
+		int t = rand() % 6;
+		for (int d = 0; d < DIMS; d++) {
+			coords[i * DIMS + d] =
+				t < 5 ? topics[t][d] + 0.08 * gauss() :
+					2.0 * rand() / RAND_MAX;
+		}
+	}
+	return coords;
+}
+
+void test_pq_recall()
+{
+	printf("Test: Product Quantization Recall\n");
+	printf("=================================\n");
+
+	int num_points = 3000;
+	srand(21);
+	double *coords = make_embeddings(num_points);
+	cdbscan_dataset_t data = { coords, num_points, DIMS };
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	cdbscan_pq_opts_t opts = { .num_subspaces = 8, .seed = 1 };
+	cdbscan_pq_t *pq = cdbscan_pq_build(ctx, &data, &opts);
+	assert(pq);
+
+	cdbscan_params_t params = { .eps = 0.6,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	cdbscan_pq_quality_t codes_only, reranked;
+	assert(cdbscan_pq_measure(ctx, pq, &data, 0.0, params, 200, 7,
+				  &codes_only) == 0);
+	assert(cdbscan_pq_measure(ctx, pq, &data, 0.3, params, 200, 7,
+				  &reranked) == 0);
+	printf("Codes only: recall %.3f, precision %.3f\n", codes_only.recall,
+	       codes_only.precision);
+	printf("Reranked:   recall %.3f, precision %.3f\n", reranked.recall,
+	       reranked.precision);
+	assert(codes_only.recall > 0.85 && codes_only.precision > 0.6);
+	assert(reranked.recall > 0.99 && reranked.precision > 0.99);
+
+	/* The topics are found from the codes alone */
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	assert(labels && expected);
+	params.use_kdtree = 1;
+	int n_ref = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	int n = cdbscan_cluster_pq(ctx, pq, NULL, 0.0, params, labels);
+	printf("Clusters: %d (exact %d)\n", n, n_ref);
+	assert(n == n_ref);
+
+	/* A band that covers every candidate makes the queries exact */
+	assert(cdbscan_cluster_pq(NULL, pq, &data, 1e9, params, labels) ==
+	       n_ref);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+
+	/* No room for the distance tables fails the call */
+	assert(cdbscan_context_set_memory_limit(ctx, 64) == 0);
+	assert(cdbscan_cluster_pq(ctx, pq, NULL, 0.0, params, labels) == -1);
+	assert(cdbscan_pq_measure(ctx, pq, &data, 0.0, params, 10, 7,
+				  &reranked) == -1);
+	assert(cdbscan_context_set_memory_limit(ctx, 0) == 0);
+
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	assert(cdbscan_cluster_pq(ctx, pq, NULL, 0.0, params, labels) == -1);
+	opts.num_subspaces = DIMS + 1;
+	assert(cdbscan_pq_build(ctx, &data, &opts) == NULL);
+
+	printf("[PASS] Approximate queries keep high recall\n\n");
+	cdbscan_pq_free(pq);
+	cdbscan_context_destroy(ctx);
+	free(coords);
+	free(labels);
+	free(expected);
+}
+
+int main()
+{
+	printf("Testing Product Quantization\n");
+	printf("============================\n\n");
+
+	test_pq_recall();
+
+	printf("[SUCCESS] All product quantization tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: quantized clustering gives exactly the unquantized labels, with
+ * only pairs near eps checked against the original coordinates */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+static void check_quantized(cdbscan_context_t *ctx, const double *coords,
+			    int num_points, int dims, int bits,
+			    cdbscan_params_t params,
+			    unsigned long long *verified)
+{
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(expected && labels);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	cdbscan_quant_opts_t opts = { .bits = bits };
+	cdbscan_params_t ref = params;
+	ref.use_kdtree = 1;
+	int n_ref = cdbscan_cluster_dataset(NULL, &data, ref, expected);
+	int n = cdbscan_cluster_quantized(ctx, &data, &opts, params, labels);
+	assert(n == n_ref && n > 0);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == expected[i]);
+	}
+	printf("%2d bits, metric %d: %d clusters, %llu pairs verified\n",
+	       bits, params.dist_type, n, opts.verified);
+	*verified = opts.verified;
+
+	free(expected);
+	free(labels);
+}
+
+void test_quantized_labels()
+{
+	printf("Test: Quantized Labels\n");
+	printf("======================\n");
+
+	int num_points = 2000, dims = 3;
+	srand(3);
+	double *coords = make_blobs(num_points, dims, 4, 5.0, 1.0, 1.0);
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+
+	cdbscan_params_t params = { .eps = 0.3,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	unsigned long long v8, v16;
+	check_quantized(NULL, coords, num_points, dims, 8, params, &v8);
+	check_quantized(ctx, coords, num_points, dims, 16, params, &v16);
+	assert(v8 > 0 && v16 < v8);
+
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	params.eps = 0.45;
+	check_quantized(ctx, coords, num_points, dims, 8, params, &v8);
+	params.dist_type = CDBSCAN_DIST_MINKOWSKI;
+	params.minkowski_p = 3.0;
+	params.eps = 0.3;
+	check_quantized(ctx, coords, num_points, dims, 16, params, &v16);
+
+	/* No band for Minkowski p < 1: the original data is clustered */
+	params.minkowski_p = 0.5;
+	params.eps = 1.5;
+	check_quantized(ctx, coords, num_points, dims, 8, params, &v8);
+	assert(v8 == 0);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	cdbscan_quant_opts_t opts = { .bits = 12 };
+	int labels[1];
+	assert(cdbscan_cluster_quantized(ctx, &data, &opts, params, labels) ==
+	       -1);
+
+	printf("[PASS] Quantized labels match the original data\n\n");
+	cdbscan_context_destroy(ctx);
+	free(coords);
+}
+
+void test_quantized_mmap()
+{
+	printf("Test: Original Data Memory-Mapped\n");
+	printf("=================================\n");
+
+	int num_points = 3000, dims = 2;
+	size_t size = num_points * dims * sizeof(double);
+	srand(8);
+	double *coords = make_blobs(num_points, dims, 4, 5.0, 1.0, 1.0);
+
+	char path[] = "/tmp/cdbscan_quantXXXXXX";
+	int fd = mkstemp(path);
+	assert(fd >= 0);
+	assert(write(fd, coords, size) == (ssize_t)size);
+	double *mapped =
+		(double *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	assert(mapped != MAP_FAILED);
+
+	cdbscan_params_t params = { .eps = 0.2,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	unsigned long long verified;
+	check_quantized(NULL, mapped, num_points, dims, 8, params, &verified);
+
+	printf("[PASS] Band pairs read from the mapped file\n\n");
+	munmap(mapped, size);
+	close(fd);
+	unlink(path);
+	free(coords);
+}
+
+int main()
+{
+	printf("Testing Quantized Clustering\n");
+	printf("============================\n\n");
+
+	test_quantized_labels();
+	test_quantized_mmap();
+
+	printf("[SUCCESS] All quantized tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: many threads clustering independent datasets at the same time
+ * get the same labels as a lone serial call */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include "cdbscan.h"
+
+#define NUM_CALLERS 64
+#define NUM_ROUNDS 4
+
+typedef struct {
+	int id;
+	int num_points;
+	cdbscan_params_t params;
+	double *coords; /* Row-major copy of the dataset */
+	int *expected; /* Labels from a serial run */
+	int expected_clusters;
+	cdbscan_context_t *shared; /* Context shared by several callers */
+	int failures;
+} caller_t;
+
+/* Small blobs from a per-caller generator (rand() is not re-entrant) */
+static void make_coords(caller_t *c, int dims)
+{
+	unsigned long long state = 0x9e3779b97f4a7c15ULL * (c->id + 1);
+
+	c->coords = (double *)malloc(c->num_points * dims * sizeof(double));
+	assert(c->coords);
+	for (int i = 0; i < c->num_points; i++) {
+		state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+		int blob = (int)((state >> 33) % 4);
+		for (int d = 0; d < dims; d++) {
+			state = state * 6364136223846793005ULL +
+				1442695040888963407ULL;
+			double u = (state >> 11) * (1.0 / 9007199254740992.0);
+			c->coords[i * dims + d] = blob * 3.0 + u * (1.0 + blob);
+		}
+	}
+}
+
+static cdbscan_point_t *load_points(const caller_t *c, int dims)
+{
+	cdbscan_point_t *points = cdbscan_create_points(c->num_points, dims);
+	assert(points);
+	for (int i = 0; i < c->num_points; i++) {
+		memcpy(points[i].coords, c->coords + i * dims,
+		       dims * sizeof(double));
+	}
+	return points;
+}
+
+static void free_points(cdbscan_point_t *points, int num_points)
+{
+	for (int i = 0; i < num_points; i++) {
+		free(points[i].coords);
+	}
+	free(points);
+}
+
+/* Callers take turns between no context, the shared context and a
+ * context of their own */
+static void *caller_main(void *arg)
+{
+	caller_t *c = (caller_t *)arg;
+	cdbscan_context_t *own = NULL;
+
+	if (c->id % 3 == 2)
+		own = cdbscan_context_create(2);
+
+	for (int round = 0; round < NUM_ROUNDS; round++) {
+		cdbscan_point_t *points = load_points(c, 2);
+		int n;
+
+		switch ((c->id + round) % 3) {
+		case 0:
+			n = cdbscan_cluster(points, c->num_points, c->params);
+			break;
+		case 1:
+			n = cdbscan_cluster_ctx(c->shared, points,
+						c->num_points, c->params);
+			break;
+		default:
+			n = cdbscan_cluster_ctx(own, points, c->num_points,
+						c->params);
+			break;
+		}
+
+		if (n != c->expected_clusters)
+			c->failures++;
+		for (int i = 0; i < c->num_points; i++) {
+			if (points[i].cluster_id != c->expected[i])
+				c->failures++;
+		}
+		free_points(points, c->num_points);
+	}
+
+	cdbscan_context_destroy(own);
+	return NULL;
+}
+
+void test_concurrent_callers()
+{
+	printf("Test: %d Concurrent Callers\n", NUM_CALLERS);
+	printf("===========================\n");
+
+	caller_t callers[NUM_CALLERS];
+	pthread_t threads[NUM_CALLERS];
+	cdbscan_context_t *shared = cdbscan_context_create(4);
+	assert(shared);
+
+	for (int t = 0; t < NUM_CALLERS; t++) {
+		caller_t *c = &callers[t];
+		memset(c, 0, sizeof(*c));
+		c->id = t;
+		c->num_points = 200 + (t * 97) % 1800;
+		c->params.eps = 0.15;
+		c->params.min_pts = 4;
+		c->params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+		c->params.use_kdtree = t % 4 != 0;
+		c->shared = shared;
+		make_coords(c, 2);
+
+		/* Reference labels from one serial call */
+		cdbscan_point_t *points = load_points(c, 2);
+		c->expected_clusters =
+			cdbscan_cluster(points, c->num_points, c->params);
+		assert(c->expected_clusters > 0);
+		c->expected = (int *)malloc(c->num_points * sizeof(int));
+		assert(c->expected);
+		for (int i = 0; i < c->num_points; i++) {
+			c->expected[i] = points[i].cluster_id;
+		}
+		free_points(points, c->num_points);
+	}
+
+	for (int t = 0; t < NUM_CALLERS; t++) {
+		assert(pthread_create(&threads[t], NULL, caller_main,
+				      &callers[t]) == 0);
+	}
+
+	int failures = 0;
+	for (int t = 0; t < NUM_CALLERS; t++) {
+		pthread_join(threads[t], NULL);
+		failures += callers[t].failures;
+		free(callers[t].coords);
+		free(callers[t].expected);
+	}
+
+	printf("%d callers x %d rounds, %d mismatched labels\n", NUM_CALLERS,
+	       NUM_ROUNDS, failures);
+	assert(failures == 0);
+	printf("[PASS] Concurrent calls match serial results\n\n");
+
+	cdbscan_context_destroy(shared);
+}
+
+void test_scratch_reuse()
+{
+	printf("Test: Context Scratch Reuse Across Sizes\n");
+	printf("========================================\n");
+
+	cdbscan_context_t *ctx = cdbscan_context_create(2);
+	assert(ctx);
+
+	/* Growing and shrinking inputs through the same scratch memory */
+	int sizes[] = { 1500, 100, 3000, 10, 800 };
+	for (int s = 0; s < 5; s++) {
+		caller_t c;
+		memset(&c, 0, sizeof(c));
+		c.id = s;
+		c.num_points = sizes[s];
+		c.params.eps = 0.2;
+		c.params.min_pts = 3;
+		c.params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+		c.params.use_kdtree = 1;
+		make_coords(&c, 2);
+
+		cdbscan_point_t *a = load_points(&c, 2);
+		cdbscan_point_t *b = load_points(&c, 2);
+		int n_a = cdbscan_cluster(a, c.num_points, c.params);
+		int n_b = cdbscan_cluster_ctx(ctx, b, c.num_points, c.params);
+		assert(n_a == n_b);
+		for (int i = 0; i < c.num_points; i++) {
+			assert(a[i].cluster_id == b[i].cluster_id);
+		}
+		printf("%d points: %d clusters\n", c.num_points, n_a);
+
+		free_points(a, c.num_points);
+		free_points(b, c.num_points);
+		free(c.coords);
+	}
+
+	printf("[PASS] Results do not depend on earlier calls\n\n");
+	cdbscan_context_destroy(ctx);
+}
+
+int main()
+{
+	printf("Testing Re-entrancy\n");
+	printf("===================\n\n");
+
+	test_scratch_reuse();
+	test_concurrent_callers();
+
+	printf("[SUCCESS] All re-entrancy tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: frame-to-frame clustering agrees with clustering every frame from
+ * scratch, re-checks little when little moves and keeps cluster ids */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "cdbscan.h"
+
+#define DIMS 2
+
+static double frand(void)
+{
+	return rand() / (double)RAND_MAX;
+}
+
+/* Four blobs, the first of which drifts */
+static double *make_frame(int num_points)
+{
+	double *coords = (double *)malloc(num_points * DIMS * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points; i++) {
+		int blob = i % 4;
+		coords[i * DIMS] = blob * 3.0 + frand();
+		coords[i * DIMS + 1] = (blob % 2) * 3.0 + frand();
+	}
+	return coords;
+}
+
+static double distance(const double *coords, int a, int b,
+		       cdbscan_dist_type_t type)
+{
+	const double *p = coords + a * DIMS, *q = coords + b * DIMS;
+	if (type == CDBSCAN_DIST_MANHATTAN)
+		return cdbscan_manhattan_distance(p, q, DIMS);
+	return cdbscan_euclidean_distance(p, q, DIMS);
+}
+
+/* Same noise, same grouping of core points (up to renaming) and every
+ * border point next to a core point of its cluster */
+static void check_frame(const double *coords, int num_points,
+			cdbscan_params_t params, const int *labels)
+{
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	unsigned char *core = (unsigned char *)calloc(num_points, 1);
+	assert(expected && core);
+
+	cdbscan_dataset_t data = { coords, num_points, DIMS };
+	int n = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	assert(n >= 0);
+
+	for (int i = 0; i < num_points; i++) {
+		int count = 0;
+		for (int j = 0; j < num_points; j++) {
+			count += distance(coords, i, j, params.dist_type) <=
+				 params.eps;
+		}
+		core[i] = count >= params.min_pts;
+	}
+
+	for (int i = 0; i < num_points; i++) {
+		assert((labels[i] == CDBSCAN_NOISE) ==
+		       (expected[i] == CDBSCAN_NOISE));
+		if (!core[i])
+			continue;
+		for (int j = i + 1; j < num_points; j++) {
+			if (core[j])
+				assert((labels[i] == labels[j]) ==
+				       (expected[i] == expected[j]));
+		}
+	}
+
+	for (int i = 0; i < num_points; i++) {
+		if (core[i] || labels[i] == CDBSCAN_NOISE)
+			continue;
+		int found = 0;
+		for (int j = 0; j < num_points && !found; j++) {
+			found = core[j] && labels[j] == labels[i] &&
+				distance(coords, i, j, params.dist_type) <=
+					params.eps;
+		}
+		assert(found);
+	}
+
+	free(expected);
+	free(core);
+}
+
+static void run_frames(cdbscan_context_t *ctx, cdbscan_dist_type_t type)
+{
+	int num_points = 1200;
+	cdbscan_params_t params = { .eps = 0.12,
+				    .min_pts = 5,
+				    .dist_type = type,
+				    .use_kdtree = 1 };
+	cdbscan_tracker_t *tracker = cdbscan_tracker_create(params);
+	assert(tracker);
+
+	srand(17);
+	double *coords = make_frame(num_points);
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	int *first = (int *)malloc(num_points * sizeof(int));
+	assert(labels && first);
+
+	cdbscan_dataset_t frame = { coords, num_points, DIMS };
+	int n = cdbscan_tracker_update(tracker, ctx, &frame, labels);
+	assert(n > 0);
+	check_frame(coords, num_points, params, labels);
+	memcpy(first, labels, num_points * sizeof(int));
+
+	/* An unchanged frame changes nothing, and with the KD-tree kept
+	 * between frames it needs no queries */
+	assert(cdbscan_tracker_update(tracker, ctx, &frame, labels) == n);
+	if (type == CDBSCAN_DIST_EUCLIDEAN)
+		assert(cdbscan_tracker_verified(tracker) == 0);
+	for (int i = 0; i < num_points; i++) {
+		assert(labels[i] == first[i]);
+	}
+
+	/* Nudge a few points of the first blob per frame */
+	for (int f = 0; f < 20; f++) {
+		for (int k = 0; k < 30; k++) {
+			int i = 4 * (rand() % (num_points / 4));
+			coords[i * DIMS] += (frand() - 0.5) * 0.2;
+			coords[i * DIMS + 1] += (frand() - 0.5) * 0.2;
+		}
+		n = cdbscan_tracker_update(tracker, ctx, &frame, labels);
+		assert(n > 0);
+		check_frame(coords, num_points, params, labels);
+		assert(cdbscan_tracker_verified(tracker) < num_points / 2 ||
+		       type != CDBSCAN_DIST_EUCLIDEAN);
+	}
+	printf("%s: %d clusters after 20 frames, last update checked %d "
+	       "points\n",
+	       type == CDBSCAN_DIST_EUCLIDEAN ? "Euclidean" : "Manhattan", n,
+	       cdbscan_tracker_verified(tracker));
+
+	/* Blobs that never moved keep their ids */
+	for (int i = 0; i < num_points; i++) {
+		if (i % 4 != 0 && first[i] >= 0)
+			assert(labels[i] == first[i]);
+	}
+
+	/* A different number of points starts over */
+	frame.num_points = num_points / 2;
+	assert(cdbscan_tracker_update(tracker, ctx, &frame, labels) >= 0);
+	assert(cdbscan_tracker_verified(tracker) == num_points / 2);
+
+	free(coords);
+	free(labels);
+	free(first);
+	cdbscan_tracker_destroy(tracker);
+}
+
+void test_tracker_frames()
+{
+	printf("Test: Frame-to-Frame Clustering\n");
+	printf("===============================\n");
+
+	run_frames(NULL, CDBSCAN_DIST_EUCLIDEAN);
+	run_frames(NULL, CDBSCAN_DIST_MANHATTAN);
+
+	cdbscan_context_t *ctx = cdbscan_context_create(4);
+	assert(ctx);
+	run_frames(ctx, CDBSCAN_DIST_EUCLIDEAN);
+	cdbscan_context_destroy(ctx);
+
+	printf("[PASS] Every frame matches a full clustering\n\n");
+}
+
+void test_tracker_new_ids()
+{
+	printf("Test: Ids of Split Clusters\n");
+	printf("===========================\n");
+
+	/* A bar of points that is cut in two halves */
+	int num_points = 200;
+	double coords[200 * DIMS];
+	int labels[200];
+	for (int i = 0; i < num_points; i++) {
+		coords[i * DIMS] = i * 0.05;
+		coords[i * DIMS + 1] = 0.0;
+	}
+
+	cdbscan_params_t params = { .eps = 0.11,
+				    .min_pts = 3,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	cdbscan_tracker_t *tracker = cdbscan_tracker_create(params);
+	assert(tracker);
+	cdbscan_dataset_t frame = { coords, num_points, DIMS };
+
+	assert(cdbscan_tracker_update(tracker, NULL, &frame, labels) == 1);
+	assert(labels[0] == 0);
+
+	for (int i = num_points / 2; i < num_points; i++) {
+		coords[i * DIMS] += 1.0;
+	}
+	assert(cdbscan_tracker_update(tracker, NULL, &frame, labels) == 2);
+
+	/* Each half is a new cluster; the old id goes to one of them */
+	int a = labels[0], b = labels[num_points - 1];
+	printf("Halves: %d and %d\n", a, b);
+	assert(a != b && (a == 0 || b == 0) && (a == 1 || b == 1));
+
+	assert(cdbscan_tracker_create((cdbscan_params_t){ .eps = -1 }) ==
+	       NULL);
+	assert(cdbscan_tracker_update(tracker, NULL, NULL, labels) == -1);
+
+	printf("[PASS] Split clusters keep one old id\n\n");
+	cdbscan_tracker_destroy(tracker);
+}
+
+void test_tracker_merge()
+{
+	printf("Test: Clusters Joined by a New Core Point\n");
+	printf("=========================================\n");
+
+	/* Point 0 borders two clusters on a line; when point 10 moves next
+	 * to it, it becomes core and joins them */
+	double x[11] = { 2, 2.5, 3, 3.5, -1.5, -2, -1, -0.5, 0, 1, 10 };
+	double coords[11 * DIMS];
+	int labels[11];
+	for (int i = 0; i < 11; i++) {
+		coords[i * DIMS] = x[i];
+		coords[i * DIMS + 1] = 0.0;
+	}
+
+	cdbscan_params_t params = { .eps = 1.0,
+				    .min_pts = 4,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN };
+	cdbscan_tracker_t *tracker = cdbscan_tracker_create(params);
+	assert(tracker);
+	cdbscan_dataset_t frame = { coords, 11, DIMS };
+	assert(cdbscan_tracker_update(tracker, NULL, &frame, labels) == 2);
+	check_frame(coords, 11, params, labels);
+
+	coords[10 * DIMS] = 1.9;
+	assert(cdbscan_tracker_update(tracker, NULL, &frame, labels) == 1);
+	check_frame(coords, 11, params, labels);
+
+	printf("[PASS] The clusters merge\n\n");
+	cdbscan_tracker_destroy(tracker);
+}
+
+int main()
+{
+	printf("Testing Frame-to-Frame Clustering\n");
+	printf("=================================\n\n");
+
+	test_tracker_frames();
+	test_tracker_new_ids();
+	test_tracker_merge();
+
+	printf("[SUCCESS] All tracker tests passed!\n");
+	return 0;
+}
@@ -0,0 +1,97 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Point generators and a counting allocator shared by the tests */
+#ifndef CDBSCAN_TEST_UTIL_H
+#define CDBSCAN_TEST_UTIL_H
+
+#include <stdlib.h>
+#include <assert.h>
+
+/* Row-major points, each in blob rand() % blobs, with coordinates
+ * blob * spacing + u * (width + growth * blob) for u uniform in [0, 1] */
+static inline double *make_blobs(int num_points, int dims, int blobs,
+				 double spacing, double width, double growth)
+{
+	double *coords = (double *)malloc(num_points * dims * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points; i++) {
+		int blob = rand() % blobs;
+		for (int d = 0; d < dims; d++) {
+			double u = rand() / (double)RAND_MAX;
+			coords[i * dims + d] =
+				blob * spacing + u * (width + growth * blob);
+		}
+	}
+	return coords;
+}
+
+/* Row-major points uniform in the unit cube */
+static inline double *make_uniform(int num_points, int dims)
+{
+	double *coords = (double *)malloc(num_points * dims * sizeof(double));
+	assert(coords);
+	for (int i = 0; i < num_points * dims; i++) {
+		coords[i] = rand() / (double)RAND_MAX;
+	}
+	return coords;
+}
+
+/* cdbscan_allocator_t that counts calls and bytes, user is the stats */
+typedef struct {
+	int allocs;
+	int aligned;
+	size_t live; /* Bytes allocated and not freed */
+	size_t peak;
+} alloc_stats_t;
+
+static inline void counting_add(alloc_stats_t *stats, size_t size)
+{
+	stats->live += size;
+	if (stats->live > stats->peak)
+		stats->peak = stats->live;
+}
+
+static inline void *counting_alloc(size_t size, void *user)
+{
+	alloc_stats_t *stats = (alloc_stats_t *)user;
+	stats->allocs++;
+	counting_add(stats, size);
+	return malloc(size);
+}
+
+static inline void *counting_aligned_alloc(size_t alignment, size_t size,
+					   void *user)
+{
+	alloc_stats_t *stats = (alloc_stats_t *)user;
+	void *ptr = NULL;
+	stats->aligned++;
+	counting_add(stats, size);
+	assert(posix_memalign(&ptr, alignment, size) == 0);
+	return ptr;
+}
+
+static inline void counting_free(void *ptr, size_t size, void *user)
+{
+	alloc_stats_t *stats = (alloc_stats_t *)user;
+	assert(stats->live >= size);
+	stats->live -= size;
+	free(ptr);
+}
+
+#endif /* CDBSCAN_TEST_UTIL_H */
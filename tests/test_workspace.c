@@ -0,0 +1,121 @@
+/*
+ * cdbscan - DBSCAN clustering algorithm implementation in C
+ * Copyright (C) 2025 The cdbscan developers
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* Test: clustering inside a caller's workspace gives the labels of
+ * cdbscan_cluster_dataset() and needs no more than the size it reports */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cdbscan.h"
+#include "test_util.h"
+
+/* Labels in an exactly sized workspace, placed off alignment */
+static void check_workspace(int num_points, int dims,
+			    cdbscan_params_t params)
+{
+	double *coords = make_blobs(num_points, dims, 4, 3.0, 1.0, 1.0);
+	int *expected = (int *)malloc(num_points * sizeof(int));
+	int *labels = (int *)malloc(num_points * sizeof(int));
+	assert(expected && labels);
+
+	cdbscan_dataset_t data = { coords, num_points, dims };
+	int n_ref = cdbscan_cluster_dataset(NULL, &data, params, expected);
+	assert(n_ref > 0);
+
+	size_t size = cdbscan_workspace_size(num_points, dims, params);
+	assert(size > 0);
+	char *block = (char *)malloc(size + 1);
+	assert(block);
+	assert(cdbscan_cluster_workspace(&data, params, block + 1, size - 1,
+					 labels) == -1);
+	for (int run = 0; run < 2; run++) {
+		memset(labels, 0, num_points * sizeof(int));
+		assert(cdbscan_cluster_workspace(&data, params, block + run,
+						 size, labels) == n_ref);
+		for (int i = 0; i < num_points; i++) {
+			assert(labels[i] == expected[i]);
+		}
+	}
+	printf("%d points, %dD, metric %d: %d clusters in %zu bytes\n",
+	       num_points, dims, params.dist_type, n_ref, size);
+
+	free(block);
+	free(coords);
+	free(expected);
+	free(labels);
+}
+
+void test_workspace_labels()
+{
+	printf("Test: Clustering in a Workspace\n");
+	printf("===============================\n");
+
+	srand(29);
+	cdbscan_params_t params = { .eps = 0.3,
+				    .min_pts = 5,
+				    .dist_type = CDBSCAN_DIST_EUCLIDEAN,
+				    .use_kdtree = 1 };
+
+	/* Curve-sorted with KD-tree and sketch, then without the sort */
+	check_workspace(6000, 2, params);
+	check_workspace(500, 3, params);
+	params.eps = 1.2;
+	check_workspace(5000, 6, params);
+	params.eps = 2.5;
+	check_workspace(3000, 12, params);
+
+	/* Brute force, where clustering with the heap may use more */
+	params.eps = 0.4;
+	params.dist_type = CDBSCAN_DIST_MANHATTAN;
+	check_workspace(3000, 2, params);
+	params.eps = 0.01;
+	params.dist_type = CDBSCAN_DIST_COSINE;
+	check_workspace(2000, 4, params);
+
+	/* Invalid input */
+	int labels[4];
+	double coords[8] = { 0 };
+	char block[4096];
+	cdbscan_dataset_t data = { coords, 4, 2 };
+	params.eps = -1.0;
+	assert(cdbscan_workspace_size(4, 2, params) == 0);
+	assert(cdbscan_cluster_workspace(&data, params, block, sizeof(block),
+					 labels) == -1);
+	params.eps = 1.0;
+	params.min_pts = 4;
+	params.dist_type = CDBSCAN_DIST_EUCLIDEAN;
+	assert(cdbscan_workspace_size(0, 2, params) == 0);
+	assert(cdbscan_cluster_workspace(&data, params, NULL, sizeof(block),
+					 labels) == -1);
+	assert(cdbscan_cluster_workspace(&data, params, block, sizeof(block),
+					 labels) == 1);
+
+	printf("[PASS] Workspace labels match\n\n");
+}
+
+int main()
+{
+	printf("Testing Workspace Clustering\n");
+	printf("============================\n\n");
+
+	test_workspace_labels();
+
+	printf("[SUCCESS] All workspace tests passed!\n");
+	return 0;
+}